@@ -0,0 +1,78 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+Tracked heap allocations of the parser (level and behaviour files, their scripts), the board (its
+cells, bitplanes and entities) and the display (the frame buffer of the ANSI backend). Every block
+is counted against the subsystem that asked for it: allocations, frees, bytes in use and the most
+ever in use at once. The blocks come from malloc unless other hooks were set with alloc_set_hooks,
+and carry a small header with their size, so they must be given back with alloc_free (and only them)
+
+What libraries allocate on their own (ncurses, stdio, scandir) is counted too, with glibc: the executable
+defines malloc, calloc, realloc, free and the aligned ones, forwarding to the C library's. Those calls are
+counted against the subsystem the thread charges them to (alloc_charge), ALLOC_OTHER unless it says so.
+Having no header, their blocks only count towards the most in use at once, not a subsystem's bytes in use.
+Builds with AddressSanitizer keep its allocator, and count only the tracked blocks
+
+A thread can also declare that it must not allocate (alloc_forbid): what it still allocates is counted
+as a violation, as the game's -A mode does for the plays of a level once it is loaded
+*/
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define ALLOC_INTERPOSED 1
+#else
+#define ALLOC_INTERPOSED 0
+#endif
+
+typedef enum { ALLOC_PARSER, ALLOC_BOARD, ALLOC_DISPLAY, ALLOC_OTHER, ALLOC_SUBSYSTEMS } alloc_subsystem_t;
+
+typedef struct {
+    void* (*malloc)(size_t size);
+    void* (*calloc)(size_t n, size_t size);
+    void* (*realloc)(void* block, size_t size);
+    void (*free)(void* block);
+} alloc_hooks_t;
+
+typedef struct {
+    uint64_t allocations;   // including reallocs
+    uint64_t frees;
+    uint64_t bytes;         // asked for, in total
+    size_t in_use;
+    size_t peak;
+    uint64_t violations;    // allocations while forbidden
+} alloc_stats_t;
+
+/*Where the blocks come from from now on, NULL for the C library's allocator (hooks that call malloc
+would count every block twice). Only to be set before the first tracked allocation, as a block goes back
+to the allocator that made it*/
+void alloc_set_hooks(const alloc_hooks_t* hooks);
+
+/*As malloc, calloc and realloc, counted against 'subsystem' (realloc(NULL, size) allocates)*/
+void* alloc_malloc(alloc_subsystem_t subsystem, size_t size);
+void* alloc_calloc(alloc_subsystem_t subsystem, size_t n, size_t size);
+void* alloc_realloc(alloc_subsystem_t subsystem, void* block, size_t size);
+
+/*Gives back a block of alloc_malloc, alloc_calloc or alloc_realloc, from any thread; NULL is ignored*/
+void alloc_free(void* block);
+
+/*From now on what the calling thread allocates and frees through malloc and friends is counted against
+'subsystem'. Returns the one it was charging, to be set back*/
+alloc_subsystem_t alloc_charge(alloc_subsystem_t subsystem);
+
+/*From now on the calling thread must (forbid != 0) or may (0) allocate*/
+void alloc_forbid(int forbid);
+
+/*The counts of 'subsystem' so far*/
+void alloc_stats(alloc_subsystem_t subsystem, alloc_stats_t* stats);
+
+/*Allocations made while forbidden, by every subsystem and thread*/
+uint64_t alloc_violations(void);
+
+/*Writes a line per subsystem, and the most that was in use at once by all of them*/
+void alloc_report(FILE* file);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef BATCHREAD_H
+#define BATCHREAD_H
+
+#include <stddef.h>
+
+/*
+Reads a set of small files all at once instead of one open/read after another: every open is
+submitted to an io_uring in one go, each read as soon as its open completes, and a file is handed
+over as soon as its read completes. Where io_uring is not available (old kernel, disabled by
+the system) the files are read by a small pool of threads
+*/
+
+#define BATCH_QUEUE_DEPTH 64    // operations in flight at once, larger batches go through in waves
+#define BATCH_READ_SIZE 16384   // first read of each file, longer files are read again with more room
+#define BATCH_THREADS 8         // threads of the fallback
+
+typedef struct {
+    const char* path;
+    char* data;     // whole contents, '\0' terminated, to be freed with alloc_free; NULL if the file could not be read
+    size_t len;
+    int error;      // errno of the failure when data is NULL
+} batch_file_t;
+
+/*Called once per file of the batch, as soon as it is read (or failed)*/
+typedef void (*batch_done_t)(void* context, batch_file_t* file);
+
+/*Reads every file of 'files' and hands each one to 'done', in the order they complete.
+With io_uring 'done' runs on the calling thread, with the fallback it may run on several threads
+at once (for different files). The data is left in the files for the caller to free*/
+void batch_read(batch_file_t* files, int n, batch_done_t done, void* context);
+
+#endif
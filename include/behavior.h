@@ -0,0 +1,74 @@
+#ifndef BEHAVIOR_H
+#define BEHAVIOR_H
+
+#include "board.h"
+#include <stdatomic.h>
+
+/*
+The commands of .p and .m files are compiled once, when the level is loaded, into a compact
+bytecode that the entity runs one play at a time. Besides the original commands
+(W, A, S, D, R, C and T n) a script may use:
+
+  D 8                             a count after a move or C repeats it
+  REP n ... END                   repeats a block n times, up to MAX_LOOP_DEPTH nested blocks
+  IF FREE <W|A|S|D> ... END       runs the block if that neighbour cell is neither a wall nor a ghost
+  IF NEAR n ... ELSE ... END      runs the first block if the closest opponent is at most n cells away
+
+The program starts over when it reaches its end, as the command list always did
+*/
+
+#define MAX_BLOCK_DEPTH 32 // open REP and IF blocks while compiling
+
+/*Compiled script, shared by every copy of the board it was loaded into*/
+struct program {
+    atomic_int refs;        // boards holding this program
+    int size;               // bytes of code
+    unsigned char code[];
+};
+
+/*Compiler state, scripts are fed to it one token at a time*/
+typedef struct {
+    unsigned char* code;
+    int size, capacity;
+    int blocks[MAX_BLOCK_DEPTH]; // offset of the REP, IF or ELSE instruction of each open block
+    int n_blocks;
+    int loops;      // REP blocks among the open ones
+    int last;       // offset of the instruction a following count applies to, -1 if none
+    int expect;     // what the next token has to be, after REP or IF
+    int plays;      // instructions that take a play
+    int failed;     // out of memory
+} behavior_compiler_t;
+
+/*Starts an empty program*/
+void behavior_compiler_init(behavior_compiler_t* compiler);
+
+/*Compiles one token, mistakes are written to the debug file and the token is skipped*/
+void behavior_compile_token(behavior_compiler_t* compiler, const char* token);
+
+/*Closes the blocks left open and returns the program
+Returns NULL if no command takes a play (the entity is then not scripted) or out of memory*/
+program_t* behavior_compile_finish(behavior_compiler_t* compiler);
+
+/*Compiles a whole script held in a string*/
+program_t* behavior_compile(const char* text);
+
+/*Rebuilds a program from the code of one compiled by this same version (read back from a checkpoint)*/
+program_t* behavior_from_code(const unsigned char* code, int size);
+
+/*Whether 'program' (which may be NULL) has IF blocks, the only instructions that look at the board
+behavior_next may be given a NULL board for programs without them*/
+int behavior_reads_board(const program_t* program);
+
+/*Takes another reference to 'program' (which may be NULL) and returns it*/
+program_t* behavior_retain(program_t* program);
+
+/*Drops a reference to 'program', freeing it with the last one*/
+void behavior_release(program_t* program);
+
+/*Runs 'program' up to the next instruction that takes a play and stores it in 'command':
+a move (W, A, S, D, R), C or T, whose whole wait is handed over at once in 'turns'
+(x, y) is the entity position, 'type' is 'P' or 'M'*/
+void behavior_next(const program_t* program, behavior_state_t* state, const board_t* board,
+                   int x, int y, char type, command_t* command);
+
+#endif
@@ -1,13 +1,19 @@
 #ifndef BOARD_H
 #define BOARD_H
 
-#define MAX_MOVES 20
 #define MAX_LEVELS 20
 #define MAX_FILENAME 256
 #define MAX_GHOSTS 25
+#define MAX_PACMANS 16
+#define MAX_LOOP_DEPTH 8 // nested REP blocks in a behaviour script
+#define MAX_CHANGES (3 * MAX_PACMANS + 2 * MAX_GHOSTS) // cells one play can write: two per move, one per death
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 
 typedef enum {
-    REACHED_PORTAL = 1,
+    REACHED_PORTAL = 1, // level won: portal reached, or the last dot eaten on a LIMPAR level
     VALID_MOVE = 0,
     INVALID_MOVE = -1,
     DEAD_PACMAN = -2,
@@ -16,58 +22,268 @@ typedef enum {
 typedef struct {
     char command;
     int turns;
-    int turns_left;
 } command_t;
 
+typedef struct program program_t; // compiled behaviour script, see behavior.h
+typedef struct journal journal_t; // undo log of the last plays, see journal.h
+typedef struct heatmap heatmap_t; // where entities went and pacmans died over many runs, see heatmap.h
+
+/*Where an entity is in its behaviour program*/
+typedef struct {
+    int pc;                     // offset of the next instruction
+    int depth;                  // REP blocks being repeated
+    int loops[MAX_LOOP_DEPTH];  // iterations left of each of them
+} behavior_state_t;
+
 typedef struct {
     int pos_x, pos_y; //current position
     int alive; // if is alive
     int points; // how many points have been collected
     int passo; // number of plays to wait before starting
-    command_t moves[MAX_MOVES];
-    int current_move;
-    int n_moves; // number of predefined moves, 0 if controlled by user, >0 if readed from level file
-    int waiting;
+    program_t* program; // predefined moves readed from level file, NULL if controlled by user
+    behavior_state_t behavior;
+    long wake; // play at which it moves next, passo and T waits push it forward
 } pacman_t;
 
 typedef struct {
     int pos_x, pos_y; //current position
     int passo; // number of plays to wait between each move
-    command_t moves[MAX_MOVES];
-    int n_moves; // number of predefined moves from level file
-    int current_move;
-    int waiting;
+    program_t* program; // predefined moves from level file, NULL if it does not move
+    behavior_state_t behavior;
+    long wake; // play at which it moves next, passo and T waits push it forward
     int charged;
 } ghost_t;
 
+/*Move a ghost wants to make in a play, as a change of cell*/
+typedef struct {
+    int ghost;
+    long from, to;  // cells (y * width + x), to == from when it stays
+} ghost_intent_t;
+
+/*Cells written by the plays of a board since the list was last emptied (by its owner), see board_t*/
+typedef struct {
+    int n;
+    int overflow;           // more cells were written than fit, the list is incomplete
+    long cells[MAX_CHANGES]; // y * width + x, a cell written twice is listed twice
+} changes_t;
+
+/*Scheduled move of a ghost*/
+typedef struct {
+    long tick;
+    int ghost;
+} event_t;
+
 typedef struct {
     char content;   // stuff like 'P' for pacman 'M' for monster/ghost and 'W' for wall
     int has_dot;    // whether there is a dot in this position or not
     int has_portal; // whether there is a portal in this position or not
 } board_pos_t;
 
+#define TILE_SHIFT 4
+#define TILE_SIZE (1 << TILE_SHIFT) // the cells are kept in square tiles of TILE_SIZE x TILE_SIZE
+#define TILE_MASK (TILE_SIZE - 1)
+#define TILE_CELLS (TILE_SIZE * TILE_SIZE)
+#define TILE_WORDS (TILE_CELLS / 64) // words of a bitplane of a tile
+
+#define CHUNK_SHIFT 4
+#define CHUNK_SIZE (1 << CHUNK_SHIFT) // the tile table is kept in square chunks of CHUNK_SIZE x CHUNK_SIZE tiles
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_TILES (CHUNK_SIZE * CHUNK_SIZE)
+#define OWN_BLANK_TILES (1 << 16) // boards of up to this many tiles get all of them from own_tiles
+
+/*A square of cells, row-major. A tile no cell of which was ever set is not kept at all and reads as
+blank cells; the others are shared (by copies of a board, and by the tiles of a map that hold the same
+cell everywhere) until a board writes to one, which then gets a copy of its own*/
+typedef struct tile {
+    atomic_int refs;        // boards (or places of one board) holding this tile
+    uint64_t dots[TILE_WORDS];      // bitplane of the cells with a dot: bit i % 64 of word i / 64 is cells[i]
+    uint64_t visited[TILE_WORDS];   // bitplane of the cells a pacman has stood on
+    board_pos_t cells[TILE_CELLS];
+} tile_t;
+
+#define TILE_BYTES (sizeof(tile_t) - offsetof(tile_t, dots)) // what a tile holds, from 'dots' to its end
+
 typedef struct {
     int width, height;      // dimensions of the board
-    board_pos_t* board;     // actual board, a row-major matrix
+    tile_t*** chunks;       // the tile table, in row-major chunks of CHUNK_TILES row-major tiles each,
+                            // NULL for a chunk none of whose tiles is kept (see board_tile)
+    int chunks_x, chunks_y; // chunks in each row and in each column
+    int tiles_x, tiles_y;   // tiles in each row and in each column
     int n_pacmans;          // number of pacmans in the board
-    pacman_t* pacmans;      // array containing every pacman in the board to iterate through when processing (Just 1)
+    pacman_t* pacmans;      // array containing every pacman in the board, pacman 0 is the one the player controls
     int n_ghosts;           // number of ghosts in the board
     ghost_t* ghosts;        // array containing every ghost in the board to iterate through when processing
     char level_name[256];   //name for the level file to keep track of which will be the next
-    char pacman_file[256];  // file with pacman movements
+    char pacman_files[MAX_PACMANS][256]; // files with pacman movements
     char ghosts_files[MAX_GHOSTS][256]; // files with monster movements
     int tempo;              // Duration of each play
+    unsigned int seed;      // random state used by 'R' moves, copied along with the board
+    long tick;              // plays processed so far
+    event_t agenda[MAX_GHOSTS]; // min-heap of the scripted ghosts by (wake, index), see schedule_ghosts
+    int n_events;
+    int dots_left, dots_total;
+    long cells_visited, open_cells; // open cells are the ones that are not walls
+    int clear_to_win;       // the level is won by eating every dot (LIMPAR in the level file)
+    int simultaneous;       // ghosts move at the same time instead of in index order (SIMULTANEO in the level file)
+    journal_t* journal;     // records what each play changes so it can be undone, NULL if off (never copied)
+    heatmap_t* heat;        // counts the cells moved onto and the deaths, NULL if off (never copied)
+    changes_t* changes;     // lists the cells the plays write (not rewind_plays), NULL if off (never copied)
 } board_t;
 
+/*Progress through a level, see level_stats*/
+typedef struct {
+    int dots_left, dots_total;
+    long cells_visited, open_cells;
+    double cleared;         // fraction of the dots eaten
+    double coverage;        // fraction of the open cells visited
+} level_stats_t;
+
+/*What the tiles that are not kept hold*/
+extern const tile_t blank_tile;
+
+/*Cell of (x, y) in its tile*/
+static inline int tile_cell(int x, int y) {
+    return (y & TILE_MASK) << TILE_SHIFT | (x & TILE_MASK);
+}
+
+/*Tile (tx, ty) of the board, NULL if it is not kept*/
+static inline tile_t* board_tile(const board_t* board, int tx, int ty) {
+    tile_t** chunk = board->chunks[(long) (ty >> CHUNK_SHIFT) * board->chunks_x + (tx >> CHUNK_SHIFT)];
+    return chunk ? chunk[(ty & CHUNK_MASK) << CHUNK_SHIFT | (tx & CHUNK_MASK)] : NULL;
+}
+
+/*Cell (x, y) of the board, to read, inside the board*/
+static inline const board_pos_t* board_cell(const board_t* board, int x, int y) {
+    const tile_t* tile = board_tile(board, x >> TILE_SHIFT, y >> TILE_SHIFT);
+    return &(tile ? tile : &blank_tile)->cells[tile_cell(x, y)];
+}
+
+/*Same, for the cell of index y * width + x*/
+static inline const board_pos_t* board_cell_at(const board_t* board, long index) {
+    return board_cell(board, (int) (index % board->width), (int) (index / board->width));
+}
+
+/*Gives the board a tile of its own at (tx, ty), a new blank one or a copy of the shared one
+Returns NULL out of memory*/
+tile_t* own_tile(board_t* board, int tx, int ty);
+
+/*Puts 'tile' at (tx, ty) as well, one more place holding it. Returns -1 out of memory*/
+int share_tile(board_t* board, int tx, int ty, tile_t* tile);
+
+/*Tile (tx, ty) of the board, to write. Returns NULL out of memory, the board is then left as it was*/
+static inline tile_t* touch_tile(board_t* board, int tx, int ty) {
+    tile_t* tile = board_tile(board, tx, ty);
+    if (!tile || atomic_load_explicit(&tile->refs, memory_order_acquire) != 1) tile = own_tile(board, tx, ty);
+    return tile;
+}
+
+/*Cell (x, y) of the board, to write. Returns NULL out of memory, the board is then left as it was*/
+static inline board_pos_t* touch_cell(board_t* board, int x, int y) {
+    tile_t* tile = touch_tile(board, x >> TILE_SHIFT, y >> TILE_SHIFT);
+    return tile ? &tile->cells[tile_cell(x, y)] : NULL;
+}
+
+/*Makes the (empty) tile table of a board of width x height, once they are set: one pointer per chunk, so
+that a board of mostly blank cells takes memory for the cells that are set only. Returns -1 out of memory*/
+int init_tiles(board_t* board);
+
+/*Drops the tiles of the board, its chunks and its table*/
+void release_tiles(board_t* board);
+
+/*Once a map is in place: stops keeping the tiles that are all blank (and the chunks left without tiles)
+and makes the tiles holding the same cell everywhere (all wall, all floor) share one copy*/
+void compact_tiles(board_t* board);
+
+/*The opposite, for a board about to be played on its own: gives it its own copy of every tile a pacman
+or a ghost could step on (all but the ones of walls only), so that no play has to. The blank tiles of a
+board of more than OWN_BLANK_TILES tiles are left to the plays that first step on them. Returns -1 out of memory*/
+int own_tiles(board_t* board);
+
+/*Copies the cells of 'src' into 'dst', of the same size, into tiles of dst's own that are not shared,
+reusing the ones dst already has. Returns -1 out of memory*/
+int copy_cells(board_t* dst, const board_t* src);
+
+/*Writes the cells of the board, row-major, to 'out' (width x height cells)*/
+void flatten_cells(const board_t* board, board_pos_t* out);
+
+/*Sets every cell of the board from the row-major 'cells'. Returns -1 out of memory*/
+int set_cells(board_t* board, const board_pos_t* cells);
+
 /*Makes the current thread sleep for 'int milliseconds' miliseconds*/
 void sleep_ms(int milliseconds);
 
 /*Processes a command for Pacman or Ghost(Monster)
 *_index - corresponding index in board's pacman_t/ghost_t array
-command - command to be processed*/
+command - command to be processed, NULL to run the next one of the entity's program*/
 int move_pacman(board_t* board, int pacman_index, command_t* command);
 int move_ghost(board_t* board, int ghost_index, command_t* command);
 
+/*Processes one play: moves pacman 0 with 'command' (NULL if it is scripted), the other scripted pacmans and
+then the scripted ghosts whose turn it is, ghosts that are waiting are not visited at all
+Returns REACHED_PORTAL when a pacman reaches the portal, DEAD_PACMAN when none is left alive,
+otherwise the result of the move of pacman 0*/
+int play_turn(board_t* board, command_t* command);
+
+/*First phase of a simultaneous play: runs the next instruction of ghost 'ghost_index' and stores where it
+wants to go. Only that ghost is written, the board is just read, so different ghosts may be planned at once*/
+void plan_ghost(board_t* board, int ghost_index, ghost_intent_t* intent);
+
+/*Second phase: settles the conflicts between the planned moves and applies them. Two ghosts after the same
+cell leave it to the lower index, two ghosts swapping cells both stay, and a ghost only enters an occupied
+cell if its ghost leaves it. The outcome does not depend on the order of 'intents'*/
+void resolve_ghosts(board_t* board, ghost_intent_t* intents, int n);
+
+/*(Re)builds the agenda from the 'wake' of every scripted ghost, after loading or changing them*/
+void schedule_ghosts(board_t* board);
+
+/*Undoes the last 'plays' plays recorded in the board's journal. Returns how many were undone*/
+int rewind_plays(board_t* board, int plays);
+
+/*Play at which the next ghost or scripted pacman moves (never before board->tick)*/
+long next_event(const board_t* board);
+
+/*Headless runs only: skips the plays in which nobody moves, jumping board->tick to next_event
+but not past 'until'. Returns the number of plays skipped*/
+long fast_forward(board_t* board, long until);
+
+/*Builds the dot bitplanes of the tiles from the cells and marks the cells of the pacmans as visited, once
+the map and the pacmans are in place. They are then kept up to date move by move. Returns -1 out of memory*/
+int init_progress(board_t* board);
+
+/*Puts the pacmans on their cells, so that they block each other from the first play
+Collisions are then found among the pacmans themselves (at most MAX_PACMANS). Returns -1 out of memory*/
+int place_pacmans(board_t* board);
+
+/*Points of every pacman of the board together*/
+int total_points(const board_t* board);
+
+/*Number of bits set in the first 'words' words of a bitplane*/
+long count_bits(const uint64_t* plane, long words);
+
+/*Current progress through the level, without looking at the cells*/
+void level_stats(const board_t* board, level_stats_t* stats);
+
+/*Fingerprint of the cells and of where every entity is, to tell whether two runs ended the same way
+Only the cells that are not blank are looked at, tile by tile*/
+unsigned long board_digest(const board_t* board);
+
+/*Whether the plays of 'board' depend on its tick only through the entities' waits, so that a board found
+again where it was some plays before will go on repeating itself (not so for SIMULTANEO levels, whose random
+moves are drawn from the tick)*/
+int course_repeats(const board_t* board);
+
+/*Fingerprint of what decides how 'board' plays on: what board_digest covers, with the waits of the
+entities that still move taken from the tick instead of the tick itself. Only a few words per entity*/
+unsigned long course_digest(const board_t* board);
+
+/*Whether 'later' is 'earlier' some plays on, that is whether from then on it will play the same way.
+Compares every cell, but tiles both boards share are skipped whole*/
+int same_course(const board_t* earlier, const board_t* later);
+
+/*Jumps 'board' 'plays' plays ahead without playing them, by moving its tick and the waits of the entities
+that still move. Right only if the board repeats every 'plays' plays (a multiple of a cycle found with same_course)*/
+void skip_plays(board_t* board, long plays);
+
 /*Process the death of a Pacman*/
 void kill_pacman(board_t* board, int pacman_index);
 
@@ -80,9 +296,13 @@ int load_ghost(board_t* board);
 /*Loads a level into board*/
 int load_level(board_t* board, int accumulated_points);
 
-/*Unloads levels loaded by load_level*/
+/*Unloads levels loaded by load_level, dropping the board's references to the behaviour programs*/
 void unload_level(board_t * board);
 
+/*Deep copies 'src' into 'dst' so that both can be played independently
+'dst' must be released with unload_level*/
+int clone_board(board_t* dst, const board_t* src);
+
 // DEBUG FILE
 
 /*Opens the debug file*/
@@ -91,6 +311,9 @@ void open_debug_file(char *filename);
 /*Closes the debug file*/
 void close_debug_file();
 
+/*Silences (1) or restores (0) the debug output of the calling thread*/
+void mute_debug(int mute);
+
 /*Writes to the open debug file*/
 void debug(const char * format, ...);
 
@@ -0,0 +1,74 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "board.h"
+#include <stdint.h>
+
+/*
+Checkpoints: the whole state of a level being played, on disk, so that a game can be resumed
+after the process ends
+
+  header      checkpoint_header_t, with the size and CRC-32C of everything after it
+  board       checkpoint_board_t
+  chunks      a uint32 per chunk of the tile table, row-major: 1 if the board keeps it, 0 otherwise
+  tiles       for each chunk kept, a uint32 per tile of it (CHUNK_TILES, row-major): 0 for a tile that is not
+              kept (blank cells), otherwise the number (from 1) of the stored tile it holds
+  stored      the tiles themselves, TILE_BYTES each (their bitplanes and cells); a tile shared by several places once
+  entities    checkpoint_entity_t for every pacman and then every ghost
+  programs    the bytecode of each entity with a program, in the same order
+
+The layout is that of the running binary (no byte swapping), CHECKPOINT_VERSION changes whenever
+any of these structures or the bytecode does. A checkpoint is written to a temporary file with
+writev, straight from the tiles and programs, and renamed over the old one, so a crash leaves
+either the old or the new checkpoint
+*/
+
+#define CHECKPOINT_MAGIC "PACMCKP1"
+#define CHECKPOINT_VERSION 3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t payload_size;  // bytes after the header
+    uint32_t checksum;      // CRC-32C of the payload
+    int32_t level_index;    // level of the game being played
+} checkpoint_header_t;
+
+typedef struct {
+    int32_t width, height, tempo;
+    uint32_t seed;
+    int64_t tick;
+    int32_t n_pacmans, n_ghosts;
+    int32_t clear_to_win, simultaneous;
+    int32_t dots_total;
+    char level_name[256];
+    char pacman_files[MAX_PACMANS][256];
+    char ghosts_files[MAX_GHOSTS][256];
+} checkpoint_board_t;
+
+typedef struct {
+    int32_t pos_x, pos_y;
+    int32_t alive;          // pacmans only
+    int32_t points;         // pacmans only
+    int32_t passo;
+    int32_t charged;        // ghosts only
+    int64_t wake;
+    behavior_state_t behavior;
+    int32_t program_size;   // 0 without a program
+} checkpoint_entity_t;
+
+/*Writes the state of 'board', level 'level_index' of the game, to 'path'. Only one thread saves at a
+time: the buffers it writes from are kept from one save to the next
+Returns 0 once the checkpoint is on disk, -1 (with errno) otherwise*/
+int checkpoint_save(const char* path, const board_t* board, int level_index);
+
+/*Makes those buffers large enough for 'board' (for the chunks of its tile table kept so far), so that saving
+it allocates nothing. -1 if out of memory*/
+int checkpoint_reserve(const board_t* board);
+
+/*Loads the checkpoint 'path' into 'board' (to be released with unload_level) and its level index
+Returns -1 if the file is missing, not a checkpoint of this version or damaged*/
+int checkpoint_load(const char* path, board_t* board, int* level_index);
+
+#endif
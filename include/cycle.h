@@ -0,0 +1,39 @@
+#ifndef CYCLE_H
+#define CYCLE_H
+
+#include "board.h"
+
+/*
+Brent's cycle detection over the plays of a headless board. Scripts start over when they reach
+their end, so a level nobody wins or loses ends up repeating itself: cycle_check is handed the board
+after every play, keeps a copy of it at plays 1, 2, 4, 8, ... and compares the board with the latest
+copy (by course_digest, then same_course). A cycle of length L is found at most 2L plays after it
+starts, and the copies share their tiles with the board, so the cost is a digest per play
+
+Once found, skip_plays jumps the board over as many whole cycles as fit before the limit of the run,
+and the plays left are played as usual: the run ends exactly as it would have. With cycle_set_skipping(0)
+the cycles are still found but every lap is played, to check that claim
+*/
+
+typedef struct {
+    board_t saved;          // the board at the start of the current window
+    unsigned long digest;   // course_digest of 'saved'
+    int has_saved;
+    long window;            // plays the current window may grow to, a power of two
+    long plays;             // plays since 'saved'
+} cycle_t;
+
+void cycle_init(cycle_t* cycle);
+
+/*Called after each play of 'board' (before the next fast_forward). Returns the length of the cycle,
+in plays of board->tick, once 'board' is back where it was; 0 until then or if it never can be (see course_repeats)*/
+long cycle_check(cycle_t* cycle, const board_t* board);
+
+/*Releases the saved copy*/
+void cycle_release(cycle_t* cycle);
+
+/*Whether the cycles found are jumped over (the default) or played through, for every board and thread*/
+void cycle_set_skipping(int skip);
+int cycle_skipping(void);
+
+#endif
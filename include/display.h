@@ -9,16 +9,38 @@
 #define DRAW_WIN 1
 #define DRAW_MENU 2
 
+#define DISPLAY_NCURSES 0 // draws through ncurses (default)
+#define DISPLAY_ANSI 1    // draws into our own frame buffer, written as ANSI escapes (framebuffer.h)
+
+#define VIEW_MARGIN 4    // default cells kept between pacman and the edges of the view
+#define MINIMAP_MAX_W 24 // largest minimap, in characters
+#define MINIMAP_MAX_H 12
+
 
 /*
 Potential Structures for ncurses
 */
 
-/*Initialize everything ncurses requires*/
+/*Selects the backend used by every function below, must be called before terminal_init*/
+void set_display_backend(int backend);
+
+/*Initialize everything ncurses (or the selected backend) requires*/
 int terminal_init();
 
-/*Draw the board on the screen*/
-void draw_board(board_t* board, int mode);
+/*Draw the board on the screen
+Boards larger than the terminal are drawn through a view that follows pacman, only visible cells are visited*/
+void draw_board(const board_t* board, int mode);
+
+/*Sets how many cells the view keeps between pacman and its edges before scrolling*/
+void set_view_margins(int horizontal, int vertical);
+
+/*Shows (1) or hides (0) a downsampled map of the whole board next to the view, when the board does not fit*/
+void set_minimap(int enabled);
+
+/*Draws 'heat' (see heatmap.h, NULL for none) over the free cells of boards of its size: the cells
+where a pacman died as a red 'x', the others pacman went through as a yellow digit and those only
+ghosts went through as a cyan one, 1 for the least visited up to 9 for the most (on a log scale)*/
+void set_heatmap(const heatmap_t* heat);
 
 /*Add a specific character with colour i into position (pos_x,pos_y) of the creen
 Pre loaded colours:
@@ -32,12 +54,15 @@ Pre loaded colours:
 */
 void draw(char c, int colour_i, int pos_x, int pos_y);
 
-/*Call ncurses refresh() to update the screen*/
+/*Call ncurses refresh() (or write the frame buffer differences) to update the screen*/
 void refresh_screen();
 
 /*Ncurses will be reading the player's inputs*/
 char get_input();
 
+/*Makes get_input wait at most 'milliseconds' for a key, -1 waits until one is pressed*/
+void set_input_delay(int milliseconds);
+
 void terminal_cleanup();
 
 #endif
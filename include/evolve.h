@@ -0,0 +1,58 @@
+#ifndef EVOLVE_H
+#define EVOLVE_H
+
+#include "board.h"
+#include <stdio.h>
+
+/*
+Evolves the ghost scripts of a level: each candidate gives every ghost a PASSO and a flat list of
+W/A/S/D/R/C/T n commands, and is scored by playing copies of the level against a set of pacman
+scripts. The best candidates of a generation go on unchanged, the others are rebuilt from mutated
+(and crossed) winners of small tournaments. The candidates of a generation are played by several
+threads, each on its own copies of the board
+*/
+
+#define EVOLVE_GENERATIONS 30
+#define EVOLVE_POPULATION 64
+#define EVOLVE_PLAYS 500        // plays of a game before it is scored as it stands
+#define EVOLVE_MAX_COMMANDS 24  // commands of an evolved script
+#define EVOLVE_MAX_PASSO 4
+#define EVOLVE_ELITE 4          // best candidates copied to the next generation as they are
+#define EVOLVE_TOURNAMENT 3
+
+typedef struct {
+    int generations;
+    int population;
+    int plays;
+    int n_threads;      // 0 for one per core
+    unsigned int seed;  // random state of the games and of the search, the same seed gives the same scripts
+} evolve_opts_t;
+
+/*Script of one ghost*/
+typedef struct {
+    int passo;
+    int n_commands;
+    command_t commands[EVOLVE_MAX_COMMANDS]; // turns is only used by T
+} ghost_script_t;
+
+typedef struct {
+    ghost_script_t scripts[MAX_GHOSTS]; // one per ghost of the level
+    long fitness;       // of the best candidate
+    long original;      // of the level's own ghost scripts, for comparison
+    long simulations;   // games played
+} evolve_result_t;
+
+/*Fills 'opts' with the default parameters*/
+void evolve_default_opts(evolve_opts_t* opts);
+
+/*Evolves the scripts of the ghosts of 'level' against the 'n_opponents' pacmans of 'opponents'
+(only their program and PASSO are used, they start where pacman 0 of the level does)
+The higher the fitness the better the ghosts do: pacmans killed early, few points, portal not reached
+Returns 0 when the search ran, -1 on allocation errors*/
+int evolve_ghosts(const board_t* level, const pacman_t* opponents, int n_opponents, const evolve_opts_t* opts,
+                  evolve_result_t* result);
+
+/*Writes 'script' as a .m file, with the POS of 'ghost'*/
+int write_ghost_script(FILE* file, const ghost_script_t* script, const ghost_t* ghost);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+/*
+Terminal backend that does not use ncurses: frames are composed into our own buffer of
+characters and attributes, compared with the previous frame, and only the differences are
+written as ANSI escape sequences, with a single write() per frame
+*/
+
+#define FB_BOLD 1
+#define FB_DIM 2
+#define FB_REVERSE 4
+
+typedef struct {
+    char ch;
+    unsigned char colour; // colour pair, same numbering as display.h (0 for the default)
+    unsigned char attrs;  // FB_BOLD | FB_DIM | FB_REVERSE
+} fb_cell_t;
+
+/*Puts the terminal in raw mode on the alternate screen and sizes the buffers*/
+int fb_init();
+
+/*Restores the terminal*/
+void fb_cleanup();
+
+/*Blanks the frame being composed*/
+void fb_clear();
+
+/*Sets one cell of the frame being composed, cells outside the terminal are ignored*/
+void fb_put(int row, int col, char ch, int colour, int attrs);
+
+/*Writes what changed since the last frame to the terminal
+Returns the number of bytes written, -1 on error*/
+long fb_flush();
+
+/*Terminal size*/
+int fb_rows();
+int fb_cols();
+
+/*Waits at most 'milliseconds' (-1 forever) for a key, returns it or -1 if none was pressed*/
+int fb_read_key(int milliseconds);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "board.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+Occupancy heatmap of a level: how many times a pacman or a ghost moved onto each cell, and how many
+pacmans died on it, summed over many runs. A board counts into the heatmap its 'heat' field points at,
+from move_pacman, move_ghost and kill_pacman; each thread counts into its own and they are merged at the end
+
+The heatmap file holds one record per level:
+
+  HEATMAP <level> <width> <height> <runs>
+  pacman  then <height> lines of <width> counts
+  ghosts  same
+  deaths  same
+*/
+
+#define HEATMAP_NAME 256
+
+struct heatmap {
+    int width, height;
+    long runs;          // games counted
+    uint64_t* pacman;   // by cell index, as the board's bitplanes
+    uint64_t* ghosts;
+    uint64_t* deaths;
+};
+
+/*An empty heatmap for a width x height level, NULL if out of memory*/
+heatmap_t* heatmap_create(int width, int height);
+
+/*Adds the counts of 'from' to 'into', which must be of the same size*/
+void heatmap_merge(heatmap_t* into, const heatmap_t* from);
+
+void heatmap_free(heatmap_t* heat);
+
+/*Appends the record of 'level' to 'file'*/
+int heatmap_write(FILE* file, const char* level, const heatmap_t* heat);
+
+/*The next record of a heatmap file, its level's name copied to 'level' (HEATMAP_NAME bytes). NULL at
+the end of the file, or at a record it cannot read (or out of memory)*/
+heatmap_t* heatmap_read(FILE* file, char* level);
+
+/*The record of 'level' in the heatmap file 'path', NULL if it has none (or the file is missing)*/
+heatmap_t* heatmap_load(const char* path, const char* level);
+
+#endif
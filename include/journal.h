@@ -0,0 +1,54 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Undo log of the last plays: before the board is written, the bytes about to change are copied
+into a ring buffer, so a play is undone by copying them back, newest first, in time proportional
+to what it changed. Only the memory handed to journal_record is tracked (cells, bitplane words,
+counters, the pacman or ghost that moved), never whole boards
+
+  ring        per change: the old bytes and then a journal_entry_t naming where they came from
+  marks       offset in the ring where each play kept starts
+
+When the ring is full the oldest plays are dropped. A play that does not fit in the whole ring
+cannot be undone, and neither can any before it, so the journal starts over after it
+*/
+
+typedef struct {
+    void* at;       // memory the old bytes are copied back to
+    size_t size;
+} journal_entry_t;
+
+struct journal {
+    unsigned char* data;
+    size_t capacity;        // bytes of the ring
+    uint64_t head, tail;    // bytes written ever, offset of the oldest play kept (ring position = offset % capacity)
+    uint64_t* marks;        // ring of max_plays offsets
+    int max_plays, first, n_plays;
+    int broken;             // the current play did not fit, nothing is recorded until the next one
+};
+
+typedef struct journal journal_t;
+
+/*Journal that keeps at most 'max_plays' plays in a ring of 'capacity' bytes, NULL out of memory*/
+journal_t* journal_create(int max_plays, size_t capacity);
+
+/*Releases the journal*/
+void journal_destroy(journal_t* journal);
+
+/*Starts recording a new play*/
+void journal_begin(journal_t* journal);
+
+/*Saves the 'size' bytes at 'at', which the current play is about to write*/
+void journal_record(journal_t* journal, void* at, size_t size);
+
+/*Undoes the last 'plays' plays (fewer if fewer are kept). Returns how many were undone*/
+int journal_rewind(journal_t* journal, int plays);
+
+/*Forgets every play, after a change that cannot be undone (a reload, a new level)*/
+void journal_clear(journal_t* journal);
+
+#endif
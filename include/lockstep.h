@@ -0,0 +1,44 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "board.h"
+
+/*
+Lockstep engine: plays many copies of one level, each from its own random seed, one play at a
+time for all of them. Every copy keeps its dots and the cells holding 'M' and 'P' as one 64-bit
+word per row (bit x is column x) next to the walls and portals all copies share, so a copy is a
+few hundred bytes instead of a board_t, and wall checks, dot collection and the slides of charged
+ghosts are shifts and masks. The moves follow move_pacman, move_ghost and play_turn exactly, so
+each copy ends as a board_t played with the same seed would, and counts into the level's heatmap
+(its 'heat') what the board would have counted
+
+Copies that fall into a loop are found as cycle.h finds boards that do, and jump over the whole laps
+that fit before the last play, unless a heatmap is being counted
+
+Only levels up to LOCKSTEP_MAX_WIDTH columns with a single pacman, ghosts moving in index
+order and scripts without IF blocks are supported, see lockstep_supported
+*/
+
+#define LOCKSTEP_MAX_WIDTH 64
+
+typedef struct {
+    int result;             // REACHED_PORTAL, DEAD_PACMAN, or VALID_MOVE if still playing
+    long tick;
+    int points;
+    int dots_left;
+    int pac_x, pac_y;
+    unsigned long ghosts;   // fingerprint of where the ghosts ended and whether they are charged
+    long cycle;             // plays per lap of the loop the copy fell into, 0 if none (see cycle.h)
+} lockstep_outcome_t;
+
+/*Whether 'level' can be played by lockstep_run*/
+int lockstep_supported(const board_t* level);
+
+/*Plays 'n' copies of 'level', copy i with seeds[i], until each one ends or reaches play 'max_plays'
+Pacman follows its program, or stands still if it has none. Returns 0, -1 if unsupported or out of memory*/
+int lockstep_run(const board_t* level, const unsigned int* seeds, int n, long max_plays, lockstep_outcome_t* out);
+
+/*The fingerprint of lockstep_outcome_t.ghosts for a board_t*/
+unsigned long lockstep_ghosts_digest(const board_t* board);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "board.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Level pack: a whole campaign in one file, read one level at a time
+
+  header      pack_header_t
+  index       pack_entry_t[n_levels], where each level record is
+  records     per level: n_files x (uint32 name length, uint32 data length, name, data),
+              the .lvl first and then the .p/.m files it names
+
+Integers are little-endian, whatever the host (pack.c converts them). Only the index entry and the record of the level being loaded are
+ever read, so memory use does not grow with the number of levels
+*/
+
+#define PACK_MAGIC "PACMPAK1"
+#define PACK_NAME_SIZE 48
+
+typedef struct {
+    char magic[8];
+    uint32_t n_levels;
+    uint32_t reserved;
+} pack_header_t;
+
+typedef struct {
+    uint64_t offset;    // of the record, from the start of the file
+    uint32_t size;      // of the record
+    uint32_t n_files;
+    char name[PACK_NAME_SIZE]; // of the .lvl file
+} pack_entry_t;
+
+/*The levels of a game: the .lvl files of a directory or the records of a pack*/
+typedef struct {
+    const char* directory;          // NULL for a pack
+    char* level_dir;                // directory of a lone .lvl file, owned; NULL otherwise
+    char (*files)[MAX_FILENAME];    // .lvl files of the directory, in alphabetical order
+    int pack_fd;                    // -1 for a directory
+    int n_levels;
+} level_set_t;
+
+/*Writes every level of 'directory', with the behaviour files they name, to the pack 'pack_path'*/
+int pack_directory(const char* directory, const char* pack_path);
+
+/*Opens a directory of levels, a single .lvl file (as a directory holding only it) or else a pack*/
+int open_levels(const char* path, level_set_t* levels);
+
+/*Name of the level 'index' (its .lvl file)*/
+int level_name(level_set_t* levels, int index, char* name, size_t size);
+
+/*Loads the level 'index' into board, as load_level_from_file does*/
+int load_level_at(level_set_t* levels, int index, board_t* board);
+
+/*Releases what open_levels took*/
+void close_levels(level_set_t* levels);
+
+#endif
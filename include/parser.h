@@ -0,0 +1,53 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "board.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*Files are read whole into memory and parsed from there*/
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t pos; // next character to read
+} token_reader_t;
+
+/*Reads the next whitespace separated token of 'reader' into 'buffer', skipping '#' comments
+Returns 1 if a token was read, 0 at the end of the data*/
+int get_next_token(token_reader_t *reader, char *buffer, int max_len);
+
+/*Reads the whole file 'path' into memory ('\0' terminated, to be freed with alloc_free), NULL on error*/
+char *read_file(const char *path, size_t *len);
+
+/*Loads the PASSO, POS and commands of a .p (type 'P') or .m (type 'M') file into the entity 'index' of board*/
+void load_entity_behavior(const char *path, board_t *board, char type, int index);
+
+/*Decodes the map rows first_row.. of board from the text [p, end), one line per row, as the
+rest of the map after its first line. Large maps are decoded by several threads*/
+void parse_map_rows(board_t *board, int first_row, const char *p, const char *end);
+
+/*Same, from the contents of the file*/
+void load_entity_from_buffer(const char *data, size_t len, board_t *board, char type, int index);
+
+/*Loads the behaviour file 'name', named by a level, into the entity 'index' of board*/
+typedef void (*entity_loader_t)(void *context, const char *name, board_t *board, char type, int index);
+
+/*Re-reads the behaviour file 'filename' (in 'base_dir') into every entity of board that uses it:
+their programs and PASSO are replaced, positions and the rest of the game are kept
+Returns the number of entities patched*/
+int reload_entity_files(board_t *board, const char *base_dir, const char *filename);
+
+/*Loads the .lvl file 'filepath' into board, entity files are looked up in 'base_dir'*/
+int load_level_from_file(const char *filepath, board_t *board, const char *base_dir);
+
+/*Loads the contents of a .lvl file into board, its entity files are handed to 'load_entity'
+(level_name is left to the caller)*/
+int load_level_from_buffer(const char *data, size_t len, board_t *board, entity_loader_t load_entity, void *context);
+
+/*Whether filename ends in .lvl*/
+bool has_lvl_extension(const char *filename);
+
+/*Fills level_files with the .lvl files of levels_directory, in alphabetical order*/
+int load_levels_from_dir(const char *levels_directory, char level_files[][MAX_FILENAME], int *numLevels);
+
+#endif
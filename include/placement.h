@@ -0,0 +1,56 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+/*
+Placement of the headless runs (-F with -U) on large hosts. Each worker thread is pinned to a core,
+taking the cores of the NUMA nodes in turn, and the storage of the boards it plays (tiles, bitplanes
+and the pacman lookup) comes from its own slice of a region of 2MB pages: hugetlbfs pages if the system
+has them set aside, transparent huge pages (madvise) otherwise. The slice is only ever touched by its
+worker, so the kernel places its pages on that worker's node
+
+Outside such a run, or once a slice is full, the board storage comes from malloc as usual (through alloc.h)
+*/
+
+#define PLACEMENT_HUGE_PAGE (2UL << 20)
+#define PLACEMENT_SLICE (1UL << 30)     // address space of each worker, only what is used takes memory
+#define PLACEMENT_ALIGN 64              // of every block, a cache line
+
+typedef enum { PAGES_NONE, PAGES_PLAIN, PAGES_HUGETLB, PAGES_THP } placement_pages_t;
+
+/*Sets up the region for 'n_workers' workers and finds the order the cores are handed out in
+Returns the kind of pages the region got: PAGES_PLAIN if huge pages were refused, PAGES_NONE if it could
+not be mapped at all (the workers are still pinned, the boards then come from malloc)*/
+placement_pages_t placement_init(int n_workers);
+
+/*Pins the calling thread as worker 'worker' and gives it its slice of the region
+Returns the core it was pinned to, -1 if it could not be*/
+int placement_join(int worker);
+
+/*Forgets every block of the calling worker's slice, once the boards using them are gone*/
+void placement_reset(void);
+
+/*Unmaps the region and lets the calling thread run on every core again*/
+void placement_end(void);
+
+/*NUMA nodes the workers were spread over, 0 before placement_init*/
+int placement_nodes(void);
+
+/*Bytes of the region handed out so far, by every worker (the most each one used at once)*/
+size_t placement_used(void);
+
+/*Board storage: from the calling worker's slice while there is room, from malloc otherwise.
+placement_calloc clears the block; placement_free takes either kind, from any thread*/
+void* placement_alloc(size_t size);
+void* placement_calloc(size_t n, size_t size);
+void placement_free(void* block);
+
+/*Counter of the dTLB load misses of the calling thread, from the perf events of the kernel
+Returns -1 where they are not available (no PMU, perf_event_paranoid)*/
+int tlb_counter_open(void);
+
+/*Misses counted so far, and closes the counter*/
+unsigned long long tlb_counter_close(int counter);
+
+#endif
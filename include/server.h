@@ -0,0 +1,48 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "board.h"
+
+#define SERVER_WORKERS 4       // threads (including the event loop) that play due sessions
+#define WHEEL_SLOTS 1024       // timer wheel slots, one per millisecond
+#define MAX_SESSIONS 65536     // sessions hosted at the same time
+#define MAX_CONNECTIONS 4096   // clients connected at the same time
+#define LOAD_CLIENT_SECONDS 10 // duration of a run of the stand-in client
+
+/*
+Protocol over the Unix-domain socket, integers in host byte order
+Client -> server:
+  MSG_OPEN  [u8 type][u32 level]                  starts a session on level 'level' of the directory (or pack)
+  MSG_KEY   [u8 type][u32 session][u8 key]        key played by the session's pacman on its next play
+  MSG_CLOSE [u8 type][u32 session]                ends a session
+Server -> client:
+  MSG_FRAME [u8 type][u32 session][u16 width][u16 height][width*height glyphs]
+  MSG_DELTA [u8 type][u32 session][u32 tick][i32 points][u16 n][n * ([u32 cell index][u8 glyph])]
+  MSG_END   [u8 type][u32 session][i8 outcome]   outcome is REACHED_PORTAL, DEAD_PACMAN or INVALID_MOVE
+*/
+#define MSG_OPEN 'O'
+#define MSG_KEY 'K'
+#define MSG_CLOSE 'X'
+#define MSG_FRAME 'F'
+#define MSG_DELTA 'D'
+#define MSG_END 'E'
+
+#define MSG_OPEN_SIZE 5
+#define MSG_KEY_SIZE 6
+#define MSG_CLOSE_SIZE 5
+#define MSG_FRAME_HEADER 9
+#define MSG_DELTA_HEADER 15
+#define MSG_DELTA_CELL 5
+#define MSG_END_SIZE 6
+
+/*Glyph shown for cell 'index' of board: '#' wall, 'C' pacman, 'M' ghost, '@' portal, '.' dot or ' '*/
+char cell_glyph(const board_t* board, long index);
+
+/*Hosts game sessions of the levels in levels_path (a directory or a pack) on socket_path until SIGINT/SIGTERM*/
+int run_server(const char* socket_path, const char* levels_path, int n_workers);
+
+/*Stand-in client: keeps n_sessions sessions open on the server, playing random keys,
+and reports the traffic it received after LOAD_CLIENT_SECONDS seconds*/
+int run_load_client(const char* socket_path, int n_levels, int n_sessions);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "board.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define SHARED_MAGIC 0x50434d53 // "PCMS"
+#define SHARED_CAPACITY (512 * 512) // cells of the largest board that can be published
+#define SHARED_NAME_FORMAT "/pacmanist-%s"          // shared memory object of a game
+#define SHARED_FIFO_FORMAT "/tmp/pacmanist-%s.keys" // FIFO carrying the keys of the controlling client
+
+/*One published board: everything draw_board needs, nothing more*/
+typedef struct {
+    atomic_uint version;  // odd while the simulation is writing this frame
+    int mode;             // DRAW_MENU, DRAW_WIN or DRAW_GAME_OVER
+    int width, height;
+    int n_pacmans;
+    pacman_t pacmans[MAX_PACMANS];
+    int dots_left, dots_total;
+    int n_ghosts;
+    ghost_t ghosts[MAX_GHOSTS];
+    char level_name[256];
+    board_pos_t cells[];  // 'capacity' cells, row-major
+} shared_frame_t;
+
+/*Shared memory region: a header followed by two frames (double buffer)
+The simulation always writes the frame readers are not pointed at, then flips 'latest'*/
+typedef struct {
+    unsigned magic;
+    int capacity;         // cells available in each frame
+    atomic_uint latest;   // number of frames published, the newest is in frames[latest % 2]
+    atomic_int closed;    // set when the simulation ends
+} shared_board_t;
+
+/*Creates the shared memory object 'name' and the key FIFO, for the simulation side*/
+shared_board_t* shared_create(const char* name);
+
+/*Maps an existing shared memory object, read-only*/
+shared_board_t* shared_attach(const char* name);
+
+/*Publishes the current state of board, never waits for the readers*/
+int shared_publish(shared_board_t* shared, board_t* board, int mode);
+
+/*Copies the newest frame into 'frame' (which must hold 'capacity' cells) and returns its number
+Returns 0 (no frame) if it stays mid-write for SHARED_READ_TRIES attempts or the simulation has ended meanwhile*/
+unsigned shared_read(shared_board_t* shared, shared_frame_t* frame);
+
+/*Size of a frame holding 'capacity' cells*/
+size_t shared_frame_size(int capacity);
+
+/*Unmaps the region, and removes it and the FIFO if 'owner'*/
+void shared_close(shared_board_t* shared, const char* name, int owner);
+
+/*Thin ncurses client: draws the frames published under 'name'
+When 'control' is set the keys pressed are sent to the simulation, otherwise it only watches*/
+int shared_view(const char* name, int control);
+
+#endif
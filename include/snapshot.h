@@ -0,0 +1,65 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "board.h"
+#include <stdatomic.h>
+
+/*
+Read-mostly copies of the board for whoever looks at the game while it runs (the screen, the
+observer of -O): after each play the simulation publishes a copy and readers take the newest one,
+RCU style. Neither side ever waits for the other: a copy that was replaced is only reused once
+every reader that could still be looking at it has moved on, which each reader announces by
+recording the epoch at which it took its copy
+*/
+
+#define MAX_SNAPSHOT_READERS 8
+#define SNAPSHOT_SPARES 2 // replaced copies kept for reuse, so a steady game allocates nothing
+
+/*One published board, never written while readers can see it*/
+typedef struct snapshot {
+    board_t board;          // cells, pacmans and ghosts are copies; programs and bitplanes are left out
+    int mode;               // DRAW_MENU, DRAW_WIN or DRAW_GAME_OVER
+    unsigned long number;   // publications before this one
+    unsigned long retired;  // epoch at which a newer copy replaced it
+    pacman_t pacmans[MAX_PACMANS];
+    ghost_t ghosts[MAX_GHOSTS];
+    struct snapshot* next;  // in the retired or the spare list
+} snapshot_t;
+
+typedef struct {
+    _Atomic(snapshot_t*) current;
+    atomic_ulong epoch;                         // starts at 1, one more per publication
+    atomic_ulong readers[MAX_SNAPSHOT_READERS]; // epoch each reader took its copy at, 0 when it holds none
+    atomic_uint slots;                          // bitmask of the reader slots in use
+    snapshot_t* retired;    // replaced copies readers may still hold (simulation side only)
+    snapshot_t* spares;     // replaced copies no reader holds
+    int n_spares;
+} snapshot_board_t;
+
+/*Starts with nothing published*/
+void snapshot_init(snapshot_board_t* snapshots);
+
+/*Publishes a copy of 'board' drawn in 'mode'. Only one thread may publish
+Returns -1 out of memory, the previous copy stays published*/
+int snapshot_publish(snapshot_board_t* snapshots, const board_t* board, int mode);
+
+/*Gives the spares tiles for the cells of 'board' and makes them SNAPSHOT_SPARES, so that publishing
+it (or a board of the same size) allocates nothing while readers keep up. Returns -1 out of memory*/
+int snapshot_reserve(snapshot_board_t* snapshots, const board_t* board);
+
+/*Registers a reader, returns its slot or -1 if there are already MAX_SNAPSHOT_READERS*/
+int snapshot_join(snapshot_board_t* snapshots);
+
+/*Gives the slot back, the reader must not hold a copy*/
+void snapshot_leave(snapshot_board_t* snapshots, int reader);
+
+/*Newest copy (NULL before the first publication), valid until snapshot_release*/
+const snapshot_t* snapshot_acquire(snapshot_board_t* snapshots, int reader);
+
+/*Lets go of the copy taken by snapshot_acquire*/
+void snapshot_release(snapshot_board_t* snapshots, int reader);
+
+/*Frees every copy, once no reader is left*/
+void snapshot_destroy(snapshot_board_t* snapshots);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "board.h"
+
+#define SOLVER_BEAM_WIDTH 256
+#define SOLVER_MAX_TICKS 5000
+#define SOLVER_DOT_WEIGHT 2
+
+typedef struct {
+    int beam_width; // number of states kept from one play to the next
+    int max_ticks;  // plays to simulate before giving up
+    int n_threads;  // threads used to simulate the candidate moves, 0 for one per core
+} solver_opts_t;
+
+typedef struct {
+    int solved;     // 1 if the plan takes pacman to the portal
+    int ticks;      // number of plays the plan takes (plays searched when unsolved, 0 if the portal is walled off)
+    int points;     // points collected along the plan
+    long explored;  // number of simulated board copies
+    char* moves;    // the plan itself, one W/A/S/D command per play ('\0' terminated)
+} solver_result_t;
+
+/*Fills 'opts' with the default search parameters*/
+void solver_default_opts(solver_opts_t* opts);
+
+/*Searches a sequence of pacman commands that collects dots and reaches the portal
+The search plays on copies of 'board' (beam search), so 'board' itself is left untouched
+Returns 0 when the search ran (check result->solved), -1 on allocation errors*/
+int solve_board(const board_t* board, const solver_opts_t* opts, solver_result_t* result);
+
+/*Releases the plan stored in 'result'*/
+void solver_free_result(solver_result_t* result);
+
+#endif
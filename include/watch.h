@@ -0,0 +1,27 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "board.h"
+
+#define MAX_WATCH_CHANGES 32 // files reported by one call to watch_changes
+
+/*
+Watches the level directory with inotify so that levels and behaviour files can be edited
+while the game runs: only files written (or moved in, as editors that save through a
+temporary file do) with a .lvl, .p or .m name are reported
+*/
+
+/*Starts watching 'directory', returns the descriptor to pass to the other calls or -1*/
+int watch_open(const char* directory);
+
+/*Waits at most 'milliseconds' for a change, returns 1 if there are changes waiting*/
+int watch_wait(int fd, int milliseconds);
+
+/*Stores the names of the files changed since the last call in 'names', each one once, without waiting
+Returns how many there are*/
+int watch_changes(int fd, char names[][MAX_FILENAME], int max);
+
+/*Stops watching*/
+void watch_close(int fd);
+
+#endif
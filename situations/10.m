@@ -0,0 +1,4 @@
+PASSO 4
+POS 3 6
+S
+W
@@ -0,0 +1,4 @@
+PASSO 1
+POS 601 12
+A 3
+D 3
@@ -0,0 +1,3 @@
+PASSO 0
+POS 600 1
+D 20
@@ -0,0 +1,4 @@
+PASSO 1
+POS 3 1
+D 4
+A 4
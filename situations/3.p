@@ -0,0 +1,3 @@
+PASSO 0
+POS 1 1
+D 4
@@ -0,0 +1,3 @@
+PASSO 0
+POS 1 6
+A
@@ -0,0 +1,3 @@
+PASSO 1
+POS 1 1
+D
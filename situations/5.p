@@ -0,0 +1,10 @@
+PASSO 1
+POS 1 1
+REP 2
+D 2
+S 2
+END
+D 2
+S
+D 2
+T 3
@@ -0,0 +1,3 @@
+PASSO 0
+POS 3 7
+R
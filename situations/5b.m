@@ -0,0 +1,5 @@
+PASSO 1
+POS 5 3
+R
+R
+T 1
@@ -0,0 +1,14 @@
+PASSO 3
+POS 1 7
+C
+A
+T 2
+C
+S
+C
+A
+T 4
+C
+D
+C
+W
@@ -0,0 +1,6 @@
+PASSO 2
+POS 3 1
+D 6
+W 2
+A 6
+S 2
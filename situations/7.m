@@ -0,0 +1,3 @@
+PASSO 0
+POS 4 2
+T 50
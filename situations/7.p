@@ -0,0 +1,6 @@
+PASSO 0
+POS 1 1
+D 3
+S
+A 3
+W
@@ -0,0 +1,7 @@
+PASSO 2
+POS 3 1
+IF NEAR 1
+A
+ELSE
+D
+END
@@ -0,0 +1,4 @@
+PASSO 0
+POS 1 1
+D 6
+A 6
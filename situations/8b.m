@@ -0,0 +1,4 @@
+PASSO 0
+POS 1 7
+A 6
+D 6
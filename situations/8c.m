@@ -0,0 +1,6 @@
+PASSO 0
+POS 1 4
+R
+S
+R
+W
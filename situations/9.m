@@ -0,0 +1,4 @@
+PASSO 2
+POS 1 3
+D 2
+A 2
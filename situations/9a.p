@@ -0,0 +1,5 @@
+PASSO 0
+POS 1 1
+D 5
+S 2
+D
@@ -0,0 +1,3 @@
+PASSO 1
+POS 3 1
+D 3
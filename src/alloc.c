@@ -0,0 +1,238 @@
+#include "alloc.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include <errno.h>
+
+// In front of every block, as large as the strictest alignment so that the block keeps it
+typedef union {
+    struct {
+        size_t size;
+        alloc_subsystem_t subsystem;
+    } info;
+    max_align_t align;
+} header_t;
+
+typedef struct {
+    atomic_uint_fast64_t allocations, frees, bytes, violations;
+    atomic_size_t in_use, peak;
+} counters_t;
+
+static const char* const names[ALLOC_SUBSYSTEMS] = {"parser", "board", "display", "other"};
+
+#if ALLOC_INTERPOSED
+// The C library's own allocator, which the malloc and friends below forward to
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* block, size_t size);
+extern void __libc_free(void* block);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+#define LIBC_HOOKS {__libc_malloc, __libc_calloc, __libc_realloc, __libc_free}
+#else
+#define LIBC_HOOKS {malloc, calloc, realloc, free}
+#endif
+
+static alloc_hooks_t hooks = LIBC_HOOKS;
+static counters_t counters[ALLOC_SUBSYSTEMS];
+static atomic_size_t total_in_use, total_peak;
+static _Thread_local int forbidden;
+static _Thread_local alloc_subsystem_t charged = ALLOC_OTHER;
+
+void alloc_set_hooks(const alloc_hooks_t* with) {
+    alloc_hooks_t libc = LIBC_HOOKS;
+    hooks = with ? *with : libc;
+}
+
+// Helper private function to raise 'peak' to 'value' if it is below
+static void raise_peak(atomic_size_t* peak, size_t value) {
+    size_t seen = atomic_load_explicit(peak, memory_order_relaxed);
+    while (seen < value && !atomic_compare_exchange_weak_explicit(peak, &seen, value, memory_order_relaxed,
+                                                                  memory_order_relaxed));
+}
+
+// Helper private function counting an allocation of 'size' bytes, 'freed' of them given back by it (a realloc)
+static void count_allocation(alloc_subsystem_t subsystem, size_t size, size_t freed) {
+    counters_t* c = &counters[subsystem];
+    atomic_fetch_add_explicit(&c->allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->bytes, size, memory_order_relaxed);
+    if (forbidden) atomic_fetch_add_explicit(&c->violations, 1, memory_order_relaxed);
+    raise_peak(&c->peak, atomic_fetch_add_explicit(&c->in_use, size, memory_order_relaxed) + size - freed);
+    atomic_fetch_sub_explicit(&c->in_use, freed, memory_order_relaxed);
+    raise_peak(&total_peak, atomic_fetch_add_explicit(&total_in_use, size, memory_order_relaxed) + size - freed);
+    atomic_fetch_sub_explicit(&total_in_use, freed, memory_order_relaxed);
+}
+
+// Helper private function counting the free of a block of 'size' bytes
+static void count_free(alloc_subsystem_t subsystem, size_t size) {
+    counters_t* c = &counters[subsystem];
+    atomic_fetch_add_explicit(&c->frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&c->in_use, size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&total_in_use, size, memory_order_relaxed);
+}
+
+// Helper private function: fills in the header of a new block and counts it
+static void* track(header_t* header, alloc_subsystem_t subsystem, size_t size) {
+    if (!header) return NULL;
+    header->info.size = size;
+    header->info.subsystem = subsystem;
+    count_allocation(subsystem, size, 0);
+    return header + 1;
+}
+
+void* alloc_malloc(alloc_subsystem_t subsystem, size_t size) {
+    if (size > SIZE_MAX - sizeof(header_t)) return NULL;
+    return track(hooks.malloc(sizeof(header_t) + size), subsystem, size);
+}
+
+void* alloc_calloc(alloc_subsystem_t subsystem, size_t n, size_t size) {
+    if (size && n > (SIZE_MAX - sizeof(header_t)) / size) return NULL;
+    // Through calloc and not memset, as it knows which pages are still zero and leaves them untouched
+    return track(hooks.calloc(1, sizeof(header_t) + n * size), subsystem, n * size);
+}
+
+void* alloc_realloc(alloc_subsystem_t subsystem, void* block, size_t size) {
+    if (!block) return alloc_malloc(subsystem, size);
+    if (size > SIZE_MAX - sizeof(header_t)) return NULL;
+    header_t* header = (header_t*) block - 1;
+    size_t old_size = header->info.size;
+    alloc_subsystem_t old_subsystem = header->info.subsystem;
+    header = hooks.realloc(header, sizeof(header_t) + size);
+    if (!header) return NULL;
+    header->info.size = size;
+    header->info.subsystem = subsystem;
+    if (old_subsystem == subsystem) {
+        count_allocation(subsystem, size, old_size);
+    } else {
+        count_free(old_subsystem, old_size);
+        count_allocation(subsystem, size, 0);
+    }
+    return header + 1;
+}
+
+void alloc_free(void* block) {
+    if (!block) return;
+    header_t* header = (header_t*) block - 1;
+    count_free(header->info.subsystem, header->info.size);
+    hooks.free(header);
+}
+
+alloc_subsystem_t alloc_charge(alloc_subsystem_t subsystem) {
+    alloc_subsystem_t before = charged;
+    charged = subsystem;
+    return before;
+}
+
+void alloc_forbid(int forbid) {
+    forbidden = forbid;
+}
+
+#if ALLOC_INTERPOSED
+// Helper private function counting a block of malloc and friends against the subsystem the thread is charging,
+// 'size' bytes asked for. It has no header: its usable size stands for it in the total in use
+static void* count_untracked(void* block, size_t size, size_t freed) {
+    if (!block) return NULL;
+    counters_t* c = &counters[charged];
+    atomic_fetch_add_explicit(&c->allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->bytes, size, memory_order_relaxed);
+    if (forbidden) atomic_fetch_add_explicit(&c->violations, 1, memory_order_relaxed);
+    size_t usable = malloc_usable_size(block);
+    raise_peak(&total_peak, atomic_fetch_add_explicit(&total_in_use, usable, memory_order_relaxed) + usable - freed);
+    atomic_fetch_sub_explicit(&total_in_use, freed, memory_order_relaxed);
+    return block;
+}
+
+// Helper private function for the same on free
+static void count_untracked_free(void* block) {
+    atomic_fetch_add_explicit(&counters[charged].frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&total_in_use, malloc_usable_size(block), memory_order_relaxed);
+}
+
+void* malloc(size_t size) {
+    return count_untracked(__libc_malloc(size), size, 0);
+}
+
+void* calloc(size_t n, size_t size) {
+    return count_untracked(__libc_calloc(n, size), n * size, 0);
+}
+
+void* realloc(void* block, size_t size) {
+    if (!block) return malloc(size);
+    size_t freed = malloc_usable_size(block);
+    void* moved = __libc_realloc(block, size);
+    if (!moved) {
+        // realloc(block, 0) frees it
+        if (size == 0) {
+            atomic_fetch_add_explicit(&counters[charged].frees, 1, memory_order_relaxed);
+            atomic_fetch_sub_explicit(&total_in_use, freed, memory_order_relaxed);
+        }
+        return NULL;
+    }
+    return count_untracked(moved, size, freed);
+}
+
+void* reallocarray(void* block, size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) return NULL;
+    return realloc(block, n * size);
+}
+
+void free(void* block) {
+    if (!block) return;
+    count_untracked_free(block);
+    __libc_free(block);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return count_untracked(__libc_memalign(alignment, size), size, 0);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** block, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void* aligned = memalign(alignment, size);
+    if (!aligned) return ENOMEM;
+    *block = aligned;
+    return 0;
+}
+
+void* valloc(size_t size) {
+    return count_untracked(__libc_valloc(size), size, 0);
+}
+
+void* pvalloc(size_t size) {
+    return count_untracked(__libc_pvalloc(size), size, 0);
+}
+#endif
+
+void alloc_stats(alloc_subsystem_t subsystem, alloc_stats_t* stats) {
+    counters_t* c = &counters[subsystem];
+    stats->allocations = atomic_load(&c->allocations);
+    stats->frees = atomic_load(&c->frees);
+    stats->bytes = atomic_load(&c->bytes);
+    stats->in_use = atomic_load(&c->in_use);
+    stats->peak = atomic_load(&c->peak);
+    stats->violations = atomic_load(&c->violations);
+}
+
+uint64_t alloc_violations(void) {
+    uint64_t violations = 0;
+    for (int s = 0; s < ALLOC_SUBSYSTEMS; s++) violations += atomic_load(&counters[s].violations);
+    return violations;
+}
+
+void alloc_report(FILE* file) {
+    fprintf(file, "%-8s %12s %12s %14s %12s %12s %10s\n", "memory", "allocations", "frees", "bytes", "in use",
+            "peak", "forbidden");
+    for (int s = 0; s < ALLOC_SUBSYSTEMS; s++) {
+        alloc_stats_t stats;
+        alloc_stats(s, &stats);
+        fprintf(file, "%-8s %12llu %12llu %14llu %12zu %12zu %10llu\n", names[s],
+                (unsigned long long) stats.allocations, (unsigned long long) stats.frees,
+                (unsigned long long) stats.bytes, stats.in_use, stats.peak, (unsigned long long) stats.violations);
+    }
+    fprintf(file, "at most %zu bytes in use at once\n", (size_t) atomic_load(&total_peak));
+}
@@ -0,0 +1,311 @@
+#define _DEFAULT_SOURCE
+#include "batchread.h"
+#include "parser.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+// Helper private function: reads one file the plain way, for the thread pool
+static void read_one(batch_file_t* file) {
+    errno = 0;
+    file->data = read_file(file->path, &file->len);
+    file->error = file->data ? 0 : (errno ? errno : ENOMEM);
+}
+
+typedef struct {
+    batch_file_t* files;
+    const int* todo;    // indices of the files left to read
+    int n_todo;
+    atomic_int next;
+    batch_done_t done;
+    void* context;
+} pool_t;
+
+// Helper private function run by each thread of the pool, files are taken one at a time
+static void* pool_worker(void* arg) {
+    pool_t* pool = arg;
+    int i;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->n_todo) {
+        batch_file_t* file = &pool->files[pool->todo[i]];
+        read_one(file);
+        pool->done(pool->context, file);
+    }
+    return NULL;
+}
+
+// Helper private function: reads the files 'todo' with a few threads, the caller being one of them
+static void read_with_threads(batch_file_t* files, const int* todo, int n_todo, batch_done_t done, void* context) {
+    pool_t pool = {.files = files, .todo = todo, .n_todo = n_todo, .done = done, .context = context};
+    atomic_init(&pool.next, 0);
+
+    pthread_t threads[BATCH_THREADS];
+    int n_threads = n_todo < BATCH_THREADS ? n_todo : BATCH_THREADS;
+    int started = 0;
+    for (int t = 1; t < n_threads; t++) {
+        if (pthread_create(&threads[started], NULL, pool_worker, &pool) != 0) break;
+        started++;
+    }
+    pool_worker(&pool);
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+}
+
+#ifdef HAVE_IO_URING
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned queued;    // entries filled since the last io_uring_enter
+} uring_t;
+
+enum { SLOT_PENDING, SLOT_DONE, SLOT_DROPPED };
+
+typedef struct {
+    int fd;             // -1 while opening
+    int busy;           // an operation of this file is in the ring
+    int state;          // SLOT_DONE once handed over, SLOT_DROPPED if left to the fallback
+    size_t cap;         // room in data, besides the '\0'
+    size_t want;        // bytes asked by the read in flight
+} slot_t;
+
+// Helper private function to release what uring_init mapped
+static void uring_close(uring_t* ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_size);
+    close(ring->fd);
+}
+
+// Helper private function: sets up the ring and maps its queues, -1 if the kernel will not
+static int uring_init(uring_t* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return -1;
+
+    ring->entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single ? ring->sq_ring
+                           : mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return -1;
+    }
+
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Helper private function to queue one operation, sent with the next uring_enter
+// At most 'entries' operations are ever in flight, so there is always room
+static void uring_queue(uring_t* ring, int opcode, int fd, const void* addr, unsigned len, size_t offset,
+                        int flags, int index) {
+    unsigned tail = *ring->sq_tail;
+    unsigned i = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char) opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->open_flags = (unsigned) flags;
+    sqe->user_data = (unsigned long) index;
+    ring->sq_array[i] = i;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+}
+
+// Helper private function: submits what was queued and waits for at least one completion
+static int uring_enter(uring_t* ring) {
+    int n;
+    do {
+        n = (int) syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    ring->queued -= (unsigned) n;
+    return 0;
+}
+
+// Helper private function: asks for the next piece of a file, growing its buffer when full
+static int queue_read(uring_t* ring, batch_file_t* file, slot_t* slot, int index) {
+    if (file->len == slot->cap) {
+        size_t cap = slot->cap ? slot->cap * 2 : BATCH_READ_SIZE;
+        char* grown = alloc_realloc(ALLOC_PARSER, file->data, cap + 1);
+        if (!grown) return ENOMEM;
+        file->data = grown;
+        slot->cap = cap;
+    }
+    slot->want = slot->cap - file->len;
+    uring_queue(ring, IORING_OP_READ, slot->fd, file->data + file->len, (unsigned) slot->want, file->len, 0, index);
+    slot->busy = 1;
+    return 0;
+}
+
+// Helper private function: the file is done, with its contents or with 'error'
+static void finish(batch_file_t* file, slot_t* slot, int error, batch_done_t done, void* context) {
+    if (slot->fd >= 0) close(slot->fd);
+    slot->fd = -1;
+    slot->state = SLOT_DONE;
+    if (error) {
+        alloc_free(file->data);
+        file->data = NULL;
+        file->len = 0;
+    } else {
+        file->data[file->len] = '\0';
+    }
+    file->error = error;
+    done(context, file);
+}
+
+// Helper private function: one completion of the ring
+// Returns 1 if the file is settled (handed over or dropped), 0 if another read of it was queued
+static int complete(uring_t* ring, batch_file_t* file, slot_t* slot, int index, int res,
+                    batch_done_t done, void* context) {
+    slot->busy = 0;
+    if (res == -EINVAL || res == -EOPNOTSUPP) {
+        // Kernel without this operation: the file is left to the fallback
+        if (slot->fd >= 0) close(slot->fd);
+        slot->fd = -1;
+        slot->state = SLOT_DROPPED;
+        return 1;
+    }
+
+    int error = 0;
+    if (slot->fd < 0) {
+        // The open completed
+        if (res < 0) error = -res;
+        else slot->fd = res;
+    } else if (res < 0 && res != -EINTR && res != -EAGAIN) {
+        error = -res;
+    } else if (res >= 0) {
+        file->len += (size_t) res;
+        if ((size_t) res < slot->want) {
+            // A short read is the end of a regular file
+            finish(file, slot, 0, done, context);
+            return 1;
+        }
+    }
+    if (!error) error = queue_read(ring, file, slot, index);
+    if (error) {
+        finish(file, slot, error, done, context);
+        return 1;
+    }
+    return 0;
+}
+
+// Helper private function: the batch through io_uring
+// Returns the number of files left for the fallback (their indices in 'todo'), -1 if there is no ring
+static int read_with_uring(batch_file_t* files, int n, batch_done_t done, void* context, int* todo) {
+    uring_t ring;
+    if (uring_init(&ring, BATCH_QUEUE_DEPTH) != 0) return -1;
+    slot_t* slots = calloc(n, sizeof(slot_t));
+    if (!slots) {
+        uring_close(&ring);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        slots[i].fd = -1;
+        files[i].data = NULL;
+        files[i].len = 0;
+    }
+
+    int next = 0, in_flight = 0, settled = 0, broken = 0;
+    while (settled < n) {
+        // Opens of the files not started yet, as far as the ring allows
+        for (; next < n && in_flight < (int) ring.entries; next++, in_flight++) {
+            uring_queue(&ring, IORING_OP_OPENAT, AT_FDCWD, files[next].path, 0, 0, O_RDONLY | O_CLOEXEC, next);
+            slots[next].busy = 1;
+        }
+        if (uring_enter(&ring) != 0) {
+            broken = 1;
+            break;
+        }
+
+        // Each completion either settles its file or queues the next read of it, in its place
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            int i = (int) cqe->user_data;
+            int res = cqe->res;
+            head++;
+            if (complete(&ring, &files[i], &slots[i], i, res, done, context)) {
+                in_flight--;
+                settled++;
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    int n_todo = 0;
+    for (int i = 0; i < n; i++) {
+        if (slots[i].state == SLOT_DONE) continue;
+        if (broken && slots[i].busy) files[i].data = NULL; // the kernel may still write into it, it is left alone
+        if (slots[i].fd >= 0) close(slots[i].fd);
+        alloc_free(files[i].data);
+        files[i].data = NULL;
+        files[i].len = 0;
+        todo[n_todo++] = i;
+    }
+    uring_close(&ring);
+    free(slots);
+    return n_todo;
+}
+
+#endif
+
+void batch_read(batch_file_t* files, int n, batch_done_t done, void* context) {
+    if (n <= 0) return;
+    int* todo = malloc(n * sizeof(int));
+    if (!todo) {
+        for (int i = 0; i < n; i++) {
+            read_one(&files[i]);
+            done(context, &files[i]);
+        }
+        return;
+    }
+
+    int n_todo = -1;
+#ifdef HAVE_IO_URING
+    n_todo = read_with_uring(files, n, done, context, todo);
+#endif
+    if (n_todo < 0) {
+        for (int i = 0; i < n; i++) todo[i] = i;
+        n_todo = n;
+    }
+    if (n_todo > 0) read_with_threads(files, todo, n_todo, done, context);
+    free(todo);
+}
@@ -0,0 +1,431 @@
+#include "behavior.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_CONTROL_STEPS 256 // instructions run in one play without reaching a command
+
+/*Instruction set, operands are 32 bit and follow the opcode*/
+enum {
+    OP_W, OP_S, OP_A, OP_D, OP_R, // move, one play
+    OP_CHARGE,                    // C, one play
+    OP_WAIT,                      // [plays] T, that many plays
+    OP_REPEAT,                    // [count] opens a REP block
+    OP_LOOP,                      // [body] closes it, back to 'body' while iterations are left
+    OP_JUMP,                      // [target]
+    OP_IF_FREE,                   // [direction][else] on to 'else' unless that cell can be entered
+    OP_IF_NEAR,                   // [distance][else] on to 'else' unless an opponent is that close
+    OP_RESTART,                   // end of the program
+    OP_COUNT
+};
+
+// Size of each instruction, opcode included
+static const int op_size[OP_COUNT] = {1, 1, 1, 1, 1, 1, 5, 5, 5, 5, 9, 9, 1};
+
+static const char move_commands[] = "WSADR";
+
+enum { EXPECT_COMMAND, EXPECT_REP_COUNT, EXPECT_CONDITION, EXPECT_FREE_DIRECTION, EXPECT_NEAR_DISTANCE };
+
+// Helper private function to read an operand
+static inline int operand(const unsigned char* at) {
+    uint32_t value;
+    memcpy(&value, at, sizeof(value));
+    return (int) value;
+}
+
+// Helper private function to overwrite an operand
+static inline void set_operand(unsigned char* at, int value) {
+    uint32_t v = (uint32_t) value;
+    memcpy(at, &v, sizeof(v));
+}
+
+// Helper private function to append bytes to the code, returns the offset they were put at
+static int emit(behavior_compiler_t* c, const unsigned char* bytes, int n) {
+    if (c->size + n > c->capacity) {
+        int capacity = c->capacity ? c->capacity * 2 : 64;
+        while (capacity < c->size + n) capacity *= 2;
+        unsigned char* grown = alloc_realloc(ALLOC_PARSER, c->code, capacity);
+        if (!grown) {
+            c->failed = 1;
+            return -1;
+        }
+        c->code = grown;
+        c->capacity = capacity;
+    }
+    memcpy(c->code + c->size, bytes, n);
+    c->size += n;
+    return c->size - n;
+}
+
+// Helper private function to append an instruction with up to two operands
+static int emit_op(behavior_compiler_t* c, int op, int a, int b) {
+    unsigned char bytes[9];
+    bytes[0] = (unsigned char) op;
+    set_operand(bytes + 1, a);
+    set_operand(bytes + 5, b);
+    if (op == OP_IF_FREE) {
+        bytes[1] = (unsigned char) a; // the direction fits in one byte, 'else' is still at +5
+        memset(bytes + 2, 0, 3);
+    }
+    return emit(c, bytes, op_size[op]);
+}
+
+// Helper private function for tokens made only of digits
+static int is_number(const char* token) {
+    if (*token == '\0') return 0;
+    for (; *token; token++) {
+        if (!isdigit((unsigned char) *token)) return 0;
+    }
+    return 1;
+}
+
+// Helper private function to apply a count to the last instruction, at 'last': the T plays, or a repetition
+static void apply_count(behavior_compiler_t* c, int last, int count) {
+    int op = c->code[last];
+    if (count < 1) {
+        debug("Behaviour: count %d ignored\n", count);
+        return;
+    }
+    if (op == OP_WAIT) {
+        set_operand(c->code + last + 1, count);
+        return;
+    }
+    if (count == 1) return;
+
+    if (c->loops < MAX_LOOP_DEPTH) {
+        // The move is the last byte of the code, wrap it: REPEAT count, move, LOOP
+        c->size = last;
+        int at = emit_op(c, OP_REPEAT, count, 0);
+        if (at < 0) return;
+        unsigned char move = (unsigned char) op;
+        emit(c, &move, 1);
+        emit_op(c, OP_LOOP, at + op_size[OP_REPEAT], 0);
+    }
+    else {
+        // No loop counter left at this depth, unroll it
+        unsigned char move = (unsigned char) op;
+        for (int i = 1; i < count && !c->failed; i++) emit(c, &move, 1);
+    }
+    c->plays += count - 1;
+}
+
+void behavior_compiler_init(behavior_compiler_t* compiler) {
+    memset(compiler, 0, sizeof(*compiler));
+    compiler->last = -1;
+}
+
+void behavior_compile_token(behavior_compiler_t* c, const char* token) {
+    int last = c->last;
+    c->last = -1;
+
+    switch (c->expect) {
+        case EXPECT_REP_COUNT: {
+            c->expect = EXPECT_COMMAND;
+            int count = is_number(token) ? atoi(token) : 0;
+            if (count < 1) {
+                debug("Behaviour: REP needs a count, got '%s'\n", token);
+                count = 1;
+            }
+            int at = emit_op(c, OP_REPEAT, count, 0);
+            if (at < 0) return;
+            c->blocks[c->n_blocks++] = at;
+            c->loops++;
+            if (!is_number(token)) break; // the token is not the count, compile it as a command
+            return;
+        }
+        case EXPECT_CONDITION:
+            if (strcmp(token, "FREE") == 0) c->expect = EXPECT_FREE_DIRECTION;
+            else if (strcmp(token, "NEAR") == 0) c->expect = EXPECT_NEAR_DISTANCE;
+            else {
+                debug("Behaviour: unknown condition '%s'\n", token);
+                c->expect = EXPECT_COMMAND;
+            }
+            return;
+        case EXPECT_FREE_DIRECTION: {
+            c->expect = EXPECT_COMMAND;
+            const char* dir = strchr("WSAD", token[0]);
+            if (!dir || token[0] == '\0' || token[1] != '\0') {
+                debug("Behaviour: IF FREE needs W, A, S or D, got '%s'\n", token);
+                return;
+            }
+            int at = emit_op(c, OP_IF_FREE, (int) (dir - "WSAD"), 0);
+            if (at >= 0) c->blocks[c->n_blocks++] = at;
+            return;
+        }
+        case EXPECT_NEAR_DISTANCE: {
+            c->expect = EXPECT_COMMAND;
+            if (!is_number(token)) {
+                debug("Behaviour: IF NEAR needs a distance, got '%s'\n", token);
+                return;
+            }
+            int at = emit_op(c, OP_IF_NEAR, atoi(token), 0);
+            if (at >= 0) c->blocks[c->n_blocks++] = at;
+            return;
+        }
+    }
+
+    if (is_number(token)) {
+        if (last >= 0) apply_count(c, last, atoi(token));
+        else debug("Behaviour: count '%s' does not follow a command\n", token);
+        return;
+    }
+
+    if (strcmp(token, "REP") == 0 || strcmp(token, "IF") == 0) {
+        if (c->n_blocks == MAX_BLOCK_DEPTH || (token[0] == 'R' && c->loops == MAX_LOOP_DEPTH)) {
+            debug("Behaviour: %s nested too deep, ignored\n", token);
+            return;
+        }
+        c->expect = token[0] == 'R' ? EXPECT_REP_COUNT : EXPECT_CONDITION;
+        return;
+    }
+
+    if (strcmp(token, "ELSE") == 0) {
+        int top = c->n_blocks > 0 ? c->blocks[c->n_blocks - 1] : -1;
+        if (top < 0 || (c->code[top] != OP_IF_FREE && c->code[top] != OP_IF_NEAR)) {
+            debug("Behaviour: ELSE without IF\n");
+            return;
+        }
+        int at = emit_op(c, OP_JUMP, 0, 0);
+        if (at < 0) return;
+        set_operand(c->code + top + 5, c->size); // the condition failing lands after the jump
+        c->blocks[c->n_blocks - 1] = at;
+        return;
+    }
+
+    if (strcmp(token, "END") == 0) {
+        if (c->n_blocks == 0) {
+            debug("Behaviour: END without REP or IF\n");
+            return;
+        }
+        int top = c->blocks[--c->n_blocks];
+        switch (c->code[top]) {
+            case OP_REPEAT:
+                emit_op(c, OP_LOOP, top + op_size[OP_REPEAT], 0);
+                c->loops--;
+                break;
+            case OP_JUMP:
+                set_operand(c->code + top + 1, c->size);
+                break;
+            default: // IF without ELSE
+                set_operand(c->code + top + 5, c->size);
+                break;
+        }
+        return;
+    }
+
+    // Commands, the count may also be glued to them (T2)
+    int op;
+    const char* move = strchr(move_commands, token[0]);
+    if (token[0] != '\0' && move) op = (int) (move - move_commands);
+    else if (token[0] == 'C') op = OP_CHARGE;
+    else if (token[0] == 'T') op = OP_WAIT;
+    else {
+        debug("Behaviour: unknown command '%s'\n", token);
+        return;
+    }
+    int at = emit_op(c, op, 1, 0);
+    if (at < 0) return;
+    c->plays++;
+    c->last = at;
+    if (is_number(token + 1)) apply_count(c, at, atoi(token + 1));
+}
+
+program_t* behavior_compile_finish(behavior_compiler_t* c) {
+    if (c->expect != EXPECT_COMMAND) {
+        debug("Behaviour: script ends in the middle of a REP or IF\n");
+        c->expect = EXPECT_COMMAND;
+    }
+    while (c->n_blocks > 0 && !c->failed) {
+        debug("Behaviour: END missing at the end of the script\n");
+        behavior_compile_token(c, "END");
+    }
+    emit_op(c, OP_RESTART, 0, 0);
+
+    program_t* program = NULL;
+    if (!c->failed && c->plays > 0) {
+        program = alloc_malloc(ALLOC_PARSER, sizeof(program_t) + c->size);
+    }
+    if (program) {
+        atomic_init(&program->refs, 1);
+        program->size = c->size;
+        memcpy(program->code, c->code, c->size);
+    }
+    alloc_free(c->code);
+    behavior_compiler_init(c);
+    return program;
+}
+
+program_t* behavior_compile(const char* text) {
+    behavior_compiler_t compiler;
+    behavior_compiler_init(&compiler);
+    char token[128];
+    while (*text) {
+        while (isspace((unsigned char) *text)) text++;
+        int len = 0;
+        while (*text && !isspace((unsigned char) *text)) {
+            if (len < (int) sizeof(token) - 1) token[len++] = *text;
+            text++;
+        }
+        if (len == 0) break;
+        token[len] = '\0';
+        behavior_compile_token(&compiler, token);
+    }
+    return behavior_compile_finish(&compiler);
+}
+
+program_t* behavior_from_code(const unsigned char* code, int size) {
+    if (size <= 0) return NULL;
+    program_t* program = alloc_malloc(ALLOC_PARSER, sizeof(program_t) + size);
+    if (program) {
+        atomic_init(&program->refs, 1);
+        program->size = size;
+        memcpy(program->code, code, size);
+    }
+    return program;
+}
+
+int behavior_reads_board(const program_t* program) {
+    for (int pc = 0; program && pc < program->size; pc += op_size[program->code[pc]]) {
+        if (program->code[pc] == OP_IF_FREE || program->code[pc] == OP_IF_NEAR) return 1;
+    }
+    return 0;
+}
+
+program_t* behavior_retain(program_t* program) {
+    if (program) atomic_fetch_add_explicit(&program->refs, 1, memory_order_relaxed);
+    return program;
+}
+
+void behavior_release(program_t* program) {
+    if (program && atomic_fetch_sub_explicit(&program->refs, 1, memory_order_acq_rel) == 1) {
+        alloc_free(program);
+    }
+}
+
+// Helper private function for IF FREE: the neighbour cell is inside the board and holds no wall or ghost
+static int cell_is_free(const board_t* board, int x, int y, int direction) {
+    static const int dx[] = {0, 0, -1, 1}; // W, S, A, D
+    static const int dy[] = {-1, 1, 0, 0};
+    x += dx[direction];
+    y += dy[direction];
+    if (x < 0 || x >= board->width || y < 0 || y >= board->height) return 0;
+    char content = board_cell(board, x, y)->content;
+    return content != 'W' && content != 'M';
+}
+
+// Helper private function for IF NEAR: walking distance, ignoring walls, to the closest opponent
+static int opponent_distance(const board_t* board, int x, int y, char type) {
+    int best = board->width + board->height;
+    if (type == 'M') {
+        for (int p = 0; p < board->n_pacmans; p++) {
+            const pacman_t* pac = &board->pacmans[p];
+            int d = abs(pac->pos_x - x) + abs(pac->pos_y - y);
+            if (pac->alive && d < best) best = d;
+        }
+    }
+    else {
+        for (int g = 0; g < board->n_ghosts; g++) {
+            int d = abs(board->ghosts[g].pos_x - x) + abs(board->ghosts[g].pos_y - y);
+            if (d < best) best = d;
+        }
+    }
+    return best;
+}
+
+// Threaded dispatch where the compiler has labels as values, a switch elsewhere
+#ifdef __GNUC__
+#define THREADED_DISPATCH
+#define CASE(op) label_##op:
+#define DISPATCH() goto *dispatch[code[pc]]
+#else
+#define CASE(op) case op:
+#define DISPATCH() goto dispatch
+#endif
+
+void behavior_next(const program_t* program, behavior_state_t* state, const board_t* board,
+                   int x, int y, char type, command_t* command) {
+#ifdef THREADED_DISPATCH
+    static const void* dispatch[OP_COUNT] = {
+        [OP_W] = &&label_OP_W, [OP_S] = &&label_OP_S, [OP_A] = &&label_OP_A, [OP_D] = &&label_OP_D,
+        [OP_R] = &&label_OP_R, [OP_CHARGE] = &&label_OP_CHARGE, [OP_WAIT] = &&label_OP_WAIT,
+        [OP_REPEAT] = &&label_OP_REPEAT, [OP_LOOP] = &&label_OP_LOOP, [OP_JUMP] = &&label_OP_JUMP,
+        [OP_IF_FREE] = &&label_OP_IF_FREE, [OP_IF_NEAR] = &&label_OP_IF_NEAR,
+        [OP_RESTART] = &&label_OP_RESTART,
+    };
+#endif
+    const unsigned char* code = program->code;
+    int pc = state->pc;
+    int steps = 0;
+    command->turns = 1;
+
+#ifdef THREADED_DISPATCH
+    DISPATCH();
+#else
+dispatch:
+    switch (code[pc]) {
+#endif
+    CASE(OP_W) CASE(OP_S) CASE(OP_A) CASE(OP_D) CASE(OP_R)
+        command->command = move_commands[code[pc]];
+        state->pc = pc + 1;
+        return;
+
+    CASE(OP_CHARGE)
+        command->command = 'C';
+        state->pc = pc + 1;
+        return;
+
+    CASE(OP_WAIT)
+        command->command = 'T';
+        command->turns = operand(code + pc + 1);
+        state->pc = pc + op_size[OP_WAIT];
+        return;
+
+    CASE(OP_REPEAT)
+        if (++steps > MAX_CONTROL_STEPS) goto stalled;
+        state->loops[state->depth++] = operand(code + pc + 1);
+        pc += op_size[OP_REPEAT];
+        DISPATCH();
+
+    CASE(OP_LOOP)
+        if (++steps > MAX_CONTROL_STEPS) goto stalled;
+        if (--state->loops[state->depth - 1] > 0) {
+            pc = operand(code + pc + 1);
+        }
+        else {
+            state->depth--;
+            pc += op_size[OP_LOOP];
+        }
+        DISPATCH();
+
+    CASE(OP_JUMP)
+        if (++steps > MAX_CONTROL_STEPS) goto stalled;
+        pc = operand(code + pc + 1);
+        DISPATCH();
+
+    CASE(OP_IF_FREE)
+        if (++steps > MAX_CONTROL_STEPS) goto stalled;
+        pc = cell_is_free(board, x, y, code[pc + 1]) ? pc + op_size[OP_IF_FREE] : operand(code + pc + 5);
+        DISPATCH();
+
+    CASE(OP_IF_NEAR)
+        if (++steps > MAX_CONTROL_STEPS) goto stalled;
+        pc = opponent_distance(board, x, y, type) <= operand(code + pc + 1) ? pc + op_size[OP_IF_NEAR]
+                                                                              : operand(code + pc + 5);
+        DISPATCH();
+
+    CASE(OP_RESTART)
+        if (++steps > MAX_CONTROL_STEPS) goto stalled;
+        pc = 0;
+        state->depth = 0;
+        DISPATCH();
+#ifndef THREADED_DISPATCH
+    }
+#endif
+
+stalled:
+    // Only conditions that keep failing, the entity stands still this play
+    state->pc = pc;
+    command->command = 'T';
+}
@@ -1,17 +1,31 @@
 #include "board.h"
+#include "behavior.h"
+#include "journal.h"
+#include "placement.h"
+#include "heatmap.h"
+#include "alloc.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <string.h>
+#include <limits.h>
 
 FILE * debugfile;
+static _Thread_local int debug_muted = 0;
 
-// Helper private function to find and kill pacman at specific position
+// Helper private function to save what a play is about to overwrite, when the board keeps a journal
+static inline void note(board_t* board, void* at, size_t size) {
+    if (board->journal) journal_record(board->journal, at, size);
+}
+
+// Helper private function to find and kill pacman at specific position, among the (at most MAX_PACMANS) pacmans
 static int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
     for (int p = 0; p < board->n_pacmans; p++) {
         pacman_t* pac = &board->pacmans[p];
         if (pac->pos_x == new_x && pac->pos_y == new_y && pac->alive) {
+            note(board, pac, sizeof(*pac));
             pac->alive = 0;
             kill_pacman(board, p);
             return DEAD_PACMAN;
@@ -21,8 +35,29 @@ static int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
 }
 
 // Helper private function for getting board position index
-static inline int get_board_index(board_t* board, int x, int y) {
-    return y * board->width + x;
+static inline long get_board_index(const board_t* board, int x, int y) {
+    return (long) y * board->width + x;
+}
+
+// Helper private function to list a cell a play writes, when the board keeps that list
+static inline void mark_changed(board_t* board, long cell) {
+    changes_t* changes = board->changes;
+    if (!changes) return;
+    if (changes->n < MAX_CHANGES) changes->cells[changes->n++] = cell;
+    else changes->overflow = 1;
+}
+
+// Helper private functions for the bitplanes of a tile, 'index' being a cell of the tile
+static inline int test_bit(const uint64_t* plane, int index) {
+    return (plane[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void set_bit(uint64_t* plane, int index) {
+    plane[index >> 6] |= (uint64_t) 1 << (index & 63);
+}
+
+static inline void clear_bit(uint64_t* plane, int index) {
+    plane[index >> 6] &= ~((uint64_t) 1 << (index & 63));
 }
 
 // Helper private function for checking valid position
@@ -30,6 +65,246 @@ static inline int is_valid_position(board_t* board, int x, int y) {
     return (x >= 0 && x < board->width) && (y >= 0 && y < board->height); // Inside of the board boundaries
 }
 
+const tile_t blank_tile;
+
+// Helper private function to let go of a tile, freeing it with its last holder
+static void drop_tile(tile_t* tile) {
+    if (tile && atomic_fetch_sub_explicit(&tile->refs, 1, memory_order_acq_rel) == 1) placement_free(tile);
+}
+
+// Helper private function for a tile of one holder, its cells left to the caller
+static tile_t* new_tile() {
+    tile_t* tile = placement_alloc(sizeof(tile_t));
+    if (!tile) {
+        debug("Out of memory for a tile of the board\n");
+        return NULL;
+    }
+    atomic_init(&tile->refs, 1);
+    return tile;
+}
+
+// Helper private function, a tile's cells and bitplanes into another tile
+static inline void copy_tile(tile_t* dst, const tile_t* src) {
+    memcpy((char*) dst + offsetof(tile_t, dots), (const char*) src + offsetof(tile_t, dots), TILE_BYTES);
+}
+
+// Helper private function, chunks in the tile table
+static inline long n_chunks(const board_t* board) {
+    return (long) board->chunks_x * board->chunks_y;
+}
+
+// Helper private function: the tile at slot 's' of chunk 'c', as (tx, ty)
+static inline void chunk_tile(const board_t* board, long c, int s, int* tx, int* ty) {
+    *tx = (int) (c % board->chunks_x) << CHUNK_SHIFT | (s & CHUNK_MASK);
+    *ty = (int) (c / board->chunks_x) << CHUNK_SHIFT | s >> CHUNK_SHIFT;
+}
+
+// Helper private function: the slot of tile (tx, ty) in the table, making its chunk if there is none
+static tile_t** tile_slot(board_t* board, int tx, int ty) {
+    tile_t*** chunk = &board->chunks[(long) (ty >> CHUNK_SHIFT) * board->chunks_x + (tx >> CHUNK_SHIFT)];
+    if (!*chunk) {
+        *chunk = placement_calloc(CHUNK_TILES, sizeof(tile_t*));
+        if (!*chunk) {
+            debug("Out of memory for a chunk of the tile table\n");
+            return NULL;
+        }
+    }
+    return &(*chunk)[(ty & CHUNK_MASK) << CHUNK_SHIFT | (tx & CHUNK_MASK)];
+}
+
+tile_t* own_tile(board_t* board, int tx, int ty) {
+    tile_t** slot = tile_slot(board, tx, ty);
+    if (!slot) return NULL;
+    tile_t* shared = *slot;
+    tile_t* tile = new_tile();
+    if (!tile) return NULL;
+    copy_tile(tile, shared ? shared : &blank_tile);
+    *slot = tile;
+    drop_tile(shared);
+    return tile;
+}
+
+int share_tile(board_t* board, int tx, int ty, tile_t* tile) {
+    tile_t** slot = tile_slot(board, tx, ty);
+    if (!slot) return -1;
+    atomic_fetch_add_explicit(&tile->refs, 1, memory_order_relaxed);
+    drop_tile(*slot);
+    *slot = tile;
+    return 0;
+}
+
+int init_tiles(board_t* board) {
+    board->tiles_x = board->width > 0 ? (int) (((long) board->width + TILE_MASK) >> TILE_SHIFT) : 0;
+    board->tiles_y = board->height > 0 ? (int) (((long) board->height + TILE_MASK) >> TILE_SHIFT) : 0;
+    board->chunks_x = (board->tiles_x + CHUNK_MASK) >> CHUNK_SHIFT;
+    board->chunks_y = (board->tiles_y + CHUNK_MASK) >> CHUNK_SHIFT;
+    long n = n_chunks(board);
+    board->chunks = placement_calloc(n > 0 ? n : 1, sizeof(tile_t**));
+    return board->chunks ? 0 : -1;
+}
+
+void release_tiles(board_t* board) {
+    if (board->chunks) {
+        for (long c = 0; c < n_chunks(board); c++) {
+            if (!board->chunks[c]) continue;
+            for (int s = 0; s < CHUNK_TILES; s++) drop_tile(board->chunks[c][s]);
+            placement_free(board->chunks[c]);
+        }
+    }
+    placement_free(board->chunks);
+    board->chunks = NULL;
+    board->chunks_x = board->chunks_y = 0;
+    board->tiles_x = board->tiles_y = 0;
+}
+
+// Helper private function, the fields of two cells (their padding is never written)
+static inline int same_cell(const board_pos_t* a, const board_pos_t* b) {
+    return a->content == b->content && a->has_dot == b->has_dot && a->has_portal == b->has_portal;
+}
+
+// Helper private function: the cells of tile (tx, ty) that are inside the board, as [x0, x1) x [y0, y1)
+static void tile_bounds(const board_t* board, int tx, int ty, int* x0, int* x1, int* y0, int* y1) {
+    *x0 = tx << TILE_SHIFT;
+    *y0 = ty << TILE_SHIFT;
+    *x1 = *x0 < board->width - TILE_SIZE ? *x0 + TILE_SIZE : board->width;
+    *y1 = *y0 < board->height - TILE_SIZE ? *y0 + TILE_SIZE : board->height;
+}
+
+void compact_tiles(board_t* board) {
+    tile_t* uniform[8]; // one tile of each cell found everywhere in a tile, the others are replaced by it
+    int n_uniform = 0;
+    for (long c = 0; c < n_chunks(board); c++) {
+        tile_t** chunk = board->chunks[c];
+        if (!chunk) continue;
+        int kept = 0;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            tile_t* tile = chunk[s];
+            if (!tile) continue;
+
+            // Only the cells inside the board count, the rest of an edge tile is never looked at
+            int tx, ty, x0, x1, y0, y1;
+            chunk_tile(board, c, s, &tx, &ty);
+            tile_bounds(board, tx, ty, &x0, &x1, &y0, &y1);
+            const board_pos_t* first = &tile->cells[0];
+            int same = 1;
+            for (int y = y0; y < y1 && same; y++) {
+                const board_pos_t* row = &tile->cells[(y & TILE_MASK) << TILE_SHIFT];
+                for (int x = x0; x < x1 && same; x++) same = same_cell(&row[x & TILE_MASK], first);
+            }
+            if (same && same_cell(first, &blank_tile.cells[0])) {
+                chunk[s] = NULL;
+                drop_tile(tile);
+                continue;
+            }
+            kept++;
+            if (!same) continue;
+
+            int k = 0;
+            while (k < n_uniform && !same_cell(&uniform[k]->cells[0], first)) k++;
+            if (k == n_uniform) {
+                // Only a tile wholly inside the board stands for the others: past the edge its cells are blank
+                int whole = x1 - x0 == TILE_SIZE && y1 - y0 == TILE_SIZE;
+                if (whole && n_uniform < (int) (sizeof(uniform) / sizeof(uniform[0]))) uniform[n_uniform++] = tile;
+            }
+            else if (uniform[k] != tile) {
+                atomic_fetch_add_explicit(&uniform[k]->refs, 1, memory_order_relaxed);
+                chunk[s] = uniform[k];
+                drop_tile(tile);
+            }
+        }
+        if (!kept) {
+            board->chunks[c] = NULL;
+            placement_free(chunk);
+        }
+    }
+}
+
+// Helper private function, whether the cells of tile (tx, ty) inside the board are all walls
+static int only_walls(const board_t* board, int tx, int ty, const tile_t* tile) {
+    int x0, x1, y0, y1;
+    tile_bounds(board, tx, ty, &x0, &x1, &y0, &y1);
+    for (int y = y0; y < y1; y++) {
+        const board_pos_t* row = &tile->cells[(y & TILE_MASK) << TILE_SHIFT];
+        for (int x = x0; x < x1; x++) {
+            if (row[x & TILE_MASK].content != 'W') return 0;
+        }
+    }
+    return 1;
+}
+
+int own_tiles(board_t* board) {
+    int blanks = (long) board->tiles_x * board->tiles_y <= OWN_BLANK_TILES;
+    for (long c = 0; c < n_chunks(board); c++) {
+        if (!board->chunks[c] && !blanks) continue;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            int tx, ty;
+            chunk_tile(board, c, s, &tx, &ty);
+            if (tx >= board->tiles_x || ty >= board->tiles_y) continue;
+            tile_t* tile = board->chunks[c] ? board->chunks[c][s] : NULL;
+            if (!tile && !blanks) continue;
+            if (tile && atomic_load_explicit(&tile->refs, memory_order_acquire) == 1) continue;
+            if (tile && only_walls(board, tx, ty, tile)) continue;
+            if (!own_tile(board, tx, ty)) return -1;
+        }
+    }
+    return 0;
+}
+
+int copy_cells(board_t* dst, const board_t* src) {
+    if (!dst->chunks || dst->tiles_x != src->tiles_x || dst->tiles_y != src->tiles_y) {
+        release_tiles(dst);
+        dst->width = src->width;
+        dst->height = src->height;
+        if (init_tiles(dst) != 0) return -1;
+    }
+    // A chunk of dst is kept, emptied, where src has none: it is there for the next copy
+    for (long c = 0; c < n_chunks(src); c++) {
+        tile_t** from = src->chunks[c];
+        tile_t** to = dst->chunks[c];
+        if (!from && !to) continue;
+        if (!to) {
+            to = dst->chunks[c] = placement_calloc(CHUNK_TILES, sizeof(tile_t*));
+            if (!to) return -1;
+        }
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            if (!from || !from[s]) {
+                drop_tile(to[s]);
+                to[s] = NULL;
+                continue;
+            }
+            if (!to[s] || atomic_load_explicit(&to[s]->refs, memory_order_acquire) != 1) {
+                tile_t* tile = new_tile();
+                if (!tile) return -1;
+                drop_tile(to[s]);
+                to[s] = tile;
+            }
+            copy_tile(to[s], from[s]);
+        }
+    }
+    return 0;
+}
+
+void flatten_cells(const board_t* board, board_pos_t* out) {
+    for (int y = 0; y < board->height; y++) {
+        for (int x0 = 0; x0 < board->width; x0 += TILE_SIZE) {
+            int n = board->width - x0 < TILE_SIZE ? board->width - x0 : TILE_SIZE;
+            memcpy(&out[(long) y * board->width + x0], board_cell(board, x0, y), n * sizeof(board_pos_t));
+        }
+    }
+}
+
+int set_cells(board_t* board, const board_pos_t* cells) {
+    for (int y = 0; y < board->height; y++) {
+        for (int x0 = 0; x0 < board->width; x0 += TILE_SIZE) {
+            int n = board->width - x0 < TILE_SIZE ? board->width - x0 : TILE_SIZE;
+            board_pos_t* row = touch_cell(board, x0, y);
+            if (!row) return -1;
+            memcpy(row, &cells[(long) y * board->width + x0], n * sizeof(board_pos_t));
+        }
+    }
+    return 0;
+}
+
 void sleep_ms(int milliseconds) {
     struct timespec ts;
     ts.tv_sec = milliseconds / 1000;
@@ -47,17 +322,24 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     int new_y = pac->pos_y;
 
     // check passo
-    if (pac->waiting > 0) {
-        pac->waiting -= 1;
-        return VALID_MOVE;        
+    if (board->tick < pac->wake) {
+        return VALID_MOVE;
+    }
+    note(board, pac, sizeof(*pac));
+    pac->wake = board->tick + pac->passo + 1;
+
+    command_t scripted;
+    if (!command) {
+        if (!pac->program) return INVALID_MOVE;
+        behavior_next(pac->program, &pac->behavior, board, pac->pos_x, pac->pos_y, 'P', &scripted);
+        command = &scripted;
     }
-    pac->waiting = pac->passo;
-
     char direction = command->command;
 
     if (direction == 'R') {
         char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+        note(board, &board->seed, sizeof(board->seed));
+        direction = directions[rand_r(&board->seed) % 4];
     }
 
     // Calculate new position based on direction
@@ -74,37 +356,38 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
         case 'D': // Right
             new_x++;
             break;
-        case 'T': // Wait
-            if (command->turns_left == 1) {
-                pac->current_move += 1; // move on
-                command->turns_left = command->turns;
-            }
-            else command->turns_left -= 1;
+        case 'T': // Wait, as many moves as there are turns
+            pac->wake += (long) (command->turns - 1) * (pac->passo + 1);
             return VALID_MOVE;
         default:
             return INVALID_MOVE; // Invalid direction
     }
 
-    // Logic for the WASD movement
-    pac->current_move+=1;
-
     // Check boundaries
     if (!is_valid_position(board, new_x, new_y)) {
         return INVALID_MOVE;
     }
 
-    int new_index = get_board_index(board, new_x, new_y);
-    int old_index = get_board_index(board, pac->pos_x, pac->pos_y);
-    char target_content = board->board[new_index].content;
-
-    if (board->board[new_index].has_portal) {
-        board->board[old_index].content = ' ';
-        board->board[new_index].content = 'P';
+    long new_index = get_board_index(board, new_x, new_y);
+    const board_pos_t* target = board_cell(board, new_x, new_y);
+    char target_content = target->content;
+
+    if (target->has_portal) {
+        board_pos_t* from = touch_cell(board, pac->pos_x, pac->pos_y);
+        board_pos_t* to = touch_cell(board, new_x, new_y);
+        if (!from || !to) return INVALID_MOVE;
+        note(board, from, sizeof(board_pos_t));
+        note(board, to, sizeof(board_pos_t));
+        from->content = ' ';
+        to->content = 'P';
+        mark_changed(board, get_board_index(board, pac->pos_x, pac->pos_y));
+        mark_changed(board, new_index);
+        if (board->heat) board->heat->pacman[new_index]++;
         return REACHED_PORTAL;
     }
 
-    // Check for walls
-    if (target_content == 'W') {
+    // Check for walls and other pacmans
+    if (target_content == 'W' || target_content == 'P') {
         return INVALID_MOVE;
     }
 
@@ -114,16 +397,41 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
         return DEAD_PACMAN;
     }
 
+    board_pos_t* from = touch_cell(board, pac->pos_x, pac->pos_y);
+    tile_t* to_tile = touch_tile(board, new_x >> TILE_SHIFT, new_y >> TILE_SHIFT);
+    if (!from || !to_tile) return INVALID_MOVE;
+    int bit = tile_cell(new_x, new_y);
+    board_pos_t* to = &to_tile->cells[bit];
+
     // Collect points
-    if (board->board[new_index].has_dot) {
+    note(board, from, sizeof(board_pos_t));
+    note(board, to, sizeof(board_pos_t));
+    if (to->has_dot) {
         pac->points++;
-        board->board[new_index].has_dot = 0;
+        to->has_dot = 0;
+        note(board, &to_tile->dots[bit >> 6], sizeof(uint64_t));
+        note(board, &board->dots_left, sizeof(board->dots_left));
+        clear_bit(to_tile->dots, bit);
+        board->dots_left--;
     }
 
-    board->board[old_index].content = ' ';
+    from->content = ' ';
+    mark_changed(board, get_board_index(board, pac->pos_x, pac->pos_y));
+    mark_changed(board, new_index);
     pac->pos_x = new_x;
     pac->pos_y = new_y;
-    board->board[new_index].content = 'P';
+    to->content = 'P';
+    if (board->heat) board->heat->pacman[new_index]++;
+
+    if (!test_bit(to_tile->visited, bit)) {
+        note(board, &to_tile->visited[bit >> 6], sizeof(uint64_t));
+        note(board, &board->cells_visited, sizeof(board->cells_visited));
+        set_bit(to_tile->visited, bit);
+        board->cells_visited++;
+    }
+    if (board->clear_to_win && board->dots_left == 0) {
+        return REACHED_PORTAL;
+    }
 
     return VALID_MOVE;
 }
@@ -140,7 +448,7 @@ static int move_ghost_charged_direction(board_t* board, ghost_t* ghost, char dir
             if (y == 0) return INVALID_MOVE;
             *new_y = 0; // In case there is no colision
             for (int i = y - 1; i >= 0; i--) {
-                char target_content = board->board[get_board_index(board, x, i)].content;
+                char target_content = board_cell(board, x, i)->content;
                 if (target_content == 'W' || target_content == 'M') {
                     *new_y = i + 1; // stop before colision
                     return VALID_MOVE;
@@ -156,7 +464,7 @@ static int move_ghost_charged_direction(board_t* board, ghost_t* ghost, char dir
             if (y == board->height - 1) return INVALID_MOVE;
             *new_y = board->height - 1; // In case there is no colision
             for (int i = y + 1; i < board->height; i++) {
-                char target_content = board->board[get_board_index(board, x, i)].content;
+                char target_content = board_cell(board, x, i)->content;
                 if (target_content == 'W' || target_content == 'M') {
                     *new_y = i - 1; // stop before colision
                     return VALID_MOVE;
@@ -172,7 +480,7 @@ static int move_ghost_charged_direction(board_t* board, ghost_t* ghost, char dir
             if (x == 0) return INVALID_MOVE;
             *new_x = 0; // In case there is no colision
             for (int j = x - 1; j >= 0; j--) {
-                char target_content = board->board[get_board_index(board, j, y)].content;
+                char target_content = board_cell(board, j, y)->content;
                 if (target_content == 'W' || target_content == 'M') {
                     *new_x = j + 1; // stop before colision
                     return VALID_MOVE;
@@ -188,7 +496,7 @@ static int move_ghost_charged_direction(board_t* board, ghost_t* ghost, char dir
             if (x == board->width - 1) return INVALID_MOVE;
             *new_x = board->width - 1; // In case there is no colision
             for (int j = x + 1; j < board->width; j++) {
-                char target_content = board->board[get_board_index(board, j, y)].content;
+                char target_content = board_cell(board, j, y)->content;
                 if (target_content == 'W' || target_content == 'M') {
                     *new_x = j - 1; // stop before colision
                     return VALID_MOVE;
@@ -213,6 +521,7 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
     int new_x = x;
     int new_y = y;
 
+    note(board, ghost, sizeof(*ghost));
     ghost->charged = 0; //uncharge
     int result = move_ghost_charged_direction(board, ghost, direction, &new_x, &new_y);
     if (result == INVALID_MOVE) {
@@ -220,17 +529,23 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
         return INVALID_MOVE;
     }
 
-    // Get board indices
-    int old_index = get_board_index(board, ghost->pos_x, ghost->pos_y);
-    int new_index = get_board_index(board, new_x, new_y);
+    // Get board cells
+    board_pos_t* from = touch_cell(board, ghost->pos_x, ghost->pos_y);
+    board_pos_t* to = touch_cell(board, new_x, new_y);
+    if (!from || !to) return INVALID_MOVE;
 
     // Update board - clear old position (restore what was there)
-    board->board[old_index].content = ' '; // Or restore the dot if ghost was on one
+    note(board, from, sizeof(board_pos_t));
+    note(board, to, sizeof(board_pos_t));
+    from->content = ' '; // Or restore the dot if ghost was on one
+    mark_changed(board, get_board_index(board, ghost->pos_x, ghost->pos_y));
+    mark_changed(board, get_board_index(board, new_x, new_y));
     // Update ghost position
     ghost->pos_x = new_x;
     ghost->pos_y = new_y;
     // Update board - set new position
-    board->board[new_index].content = 'M';
+    to->content = 'M';
+    if (board->heat) board->heat->ghosts[get_board_index(board, new_x, new_y)]++;
     return result;
 }
 
@@ -240,17 +555,24 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
     int new_y = ghost->pos_y;
 
     // check passo
-    if (ghost->waiting > 0) {
-        ghost->waiting -= 1;
+    if (board->tick < ghost->wake) {
         return VALID_MOVE;
     }
-    ghost->waiting = ghost->passo;
-
+    note(board, ghost, sizeof(*ghost));
+    ghost->wake = board->tick + ghost->passo + 1;
+
+    command_t scripted;
+    if (!command) {
+        if (!ghost->program) return INVALID_MOVE;
+        behavior_next(ghost->program, &ghost->behavior, board, ghost->pos_x, ghost->pos_y, 'M', &scripted);
+        command = &scripted;
+    }
     char direction = command->command;
     
     if (direction == 'R') {
         char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+        note(board, &board->seed, sizeof(board->seed));
+        direction = directions[rand_r(&board->seed) % 4];
     }
 
     // Calculate new position based on direction
@@ -268,22 +590,16 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
             new_x++;
             break;
         case 'C': // Charge
-            ghost->current_move += 1;
             ghost->charged = 1;
             return VALID_MOVE;
-        case 'T': // Wait
-            if (command->turns_left == 1) {
-                ghost->current_move += 1; // move on
-                command->turns_left = command->turns;
-            }
-            else command->turns_left -= 1;
+        case 'T': // Wait, as many moves as there are turns
+            ghost->wake += (long) (command->turns - 1) * (ghost->passo + 1);
             return VALID_MOVE;
         default:
             return INVALID_MOVE; // Invalid direction
     }
 
     // Logic for the WASD movement
-    ghost->current_move++;
     if (ghost->charged)
         return move_ghost_charged(board, ghost_index, direction);
 
@@ -293,15 +609,17 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
     }
 
     // Check board position
-    int new_index = get_board_index(board, new_x, new_y);
-    int old_index = get_board_index(board, ghost->pos_x, ghost->pos_y);
-    char target_content = board->board[new_index].content;
+    char target_content = board_cell(board, new_x, new_y)->content;
 
     // Check for walls and ghosts
     if (target_content == 'W' || target_content == 'M') {
         return INVALID_MOVE;
     }
 
+    board_pos_t* from = touch_cell(board, ghost->pos_x, ghost->pos_y);
+    board_pos_t* to = touch_cell(board, new_x, new_y);
+    if (!from || !to) return INVALID_MOVE;
+
     int result = VALID_MOVE;
     // Check for pacman
     if (target_content == 'P') {
@@ -309,32 +627,584 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
     }
 
     // Update board - clear old position (restore what was there)
-    board->board[old_index].content = ' '; // Or restore the dot if ghost was on one
+    note(board, from, sizeof(board_pos_t));
+    note(board, to, sizeof(board_pos_t));
+    from->content = ' '; // Or restore the dot if ghost was on one
+    mark_changed(board, get_board_index(board, ghost->pos_x, ghost->pos_y));
+    mark_changed(board, get_board_index(board, new_x, new_y));
 
     // Update ghost position
     ghost->pos_x = new_x;
     ghost->pos_y = new_y;
 
     // Update board - set new position
-    board->board[new_index].content = 'M';
+    to->content = 'M';
+    if (board->heat) board->heat->ghosts[get_board_index(board, new_x, new_y)]++;
     return result;
 }
 
+// Helper private function to restore the heap order of the agenda from 'i' down
+static void sift_down(board_t* board, int i) {
+    event_t* agenda = board->agenda;
+    for (;;) {
+        int smallest = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2 && child < board->n_events; child++) {
+            if (agenda[child].tick < agenda[smallest].tick ||
+                (agenda[child].tick == agenda[smallest].tick && agenda[child].ghost < agenda[smallest].ghost)) {
+                smallest = child;
+            }
+        }
+        if (smallest == i) return;
+        event_t tmp = agenda[i];
+        agenda[i] = agenda[smallest];
+        agenda[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Helper private function to restore the heap order of the agenda from 'i' up
+static void sift_up(board_t* board, int i) {
+    event_t* agenda = board->agenda;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (agenda[parent].tick < agenda[i].tick ||
+            (agenda[parent].tick == agenda[i].tick && agenda[parent].ghost < agenda[i].ghost)) {
+            return;
+        }
+        event_t tmp = agenda[i];
+        agenda[i] = agenda[parent];
+        agenda[parent] = tmp;
+        i = parent;
+    }
+}
+
+void plan_ghost(board_t* board, int ghost_index, ghost_intent_t* intent) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    int x = ghost->pos_x;
+    int y = ghost->pos_y;
+    intent->ghost = ghost_index;
+    intent->from = intent->to = get_board_index(board, x, y);
+
+    // check passo
+    if (board->tick < ghost->wake) return;
+    note(board, ghost, sizeof(*ghost));
+    ghost->wake = board->tick + ghost->passo + 1;
+    if (!ghost->program) return;
+
+    command_t command;
+    behavior_next(ghost->program, &ghost->behavior, board, x, y, 'M', &command);
+    char direction = command.command;
+
+    if (direction == 'R') {
+        // Each ghost draws from its own stream, so the result does not depend on the planning order
+        unsigned int seed = board->seed ^ (unsigned int) (board->tick * 2654435761u) ^ (unsigned int) (ghost_index * 40503u);
+        char directions[] = {'W', 'S', 'A', 'D'};
+        direction = directions[rand_r(&seed) % 4];
+    }
+
+    int dx = 0, dy = 0;
+    switch (direction) {
+        case 'W': dy = -1; break;
+        case 'S': dy = 1; break;
+        case 'A': dx = -1; break;
+        case 'D': dx = 1; break;
+        case 'C': // Charge
+            ghost->charged = 1;
+            return;
+        case 'T': // Wait, as many moves as there are turns
+            ghost->wake += (long) (command.turns - 1) * (ghost->passo + 1);
+            return;
+        default:
+            return;
+    }
+
+    if (ghost->charged) {
+        // Slides until the cell before a wall or a ghost, or onto the first pacman
+        ghost->charged = 0;
+        while (is_valid_position(board, x + dx, y + dy)) {
+            char target_content = board_cell(board, x + dx, y + dy)->content;
+            if (target_content == 'W' || target_content == 'M') break;
+            x += dx;
+            y += dy;
+            if (target_content == 'P') break;
+        }
+        intent->to = get_board_index(board, x, y);
+        return;
+    }
+
+    // Ghosts in the way are left to resolve_ghosts, they may be moving away
+    if (is_valid_position(board, x + dx, y + dy) && board_cell(board, x + dx, y + dy)->content != 'W') {
+        intent->to = get_board_index(board, x + dx, y + dy);
+    }
+}
+
+// Helper private function, index of the ghost standing on 'cell' or -1
+static int ghost_at(const board_t* board, long cell) {
+    for (int g = 0; g < board->n_ghosts; g++) {
+        if ((long) board->ghosts[g].pos_y * board->width + board->ghosts[g].pos_x == cell) return g;
+    }
+    return -1;
+}
+
+void resolve_ghosts(board_t* board, ghost_intent_t* intents, int n) {
+    int moving[MAX_GHOSTS];  // intent of each ghost, -1 if it is not moving this play
+    for (int g = 0; g < MAX_GHOSTS; g++) moving[g] = -1;
+    for (int i = 0; i < n; i++) {
+        if (intents[i].to != intents[i].from) moving[intents[i].ghost] = i;
+    }
+
+    // Two ghosts after the same cell: the lower index gets it. Two ghosts swapping cells: neither moves
+    // Both are decided on the moves as planned, so that the order of the checks does not matter
+    long wanted[MAX_GHOSTS];
+    for (int i = 0; i < n; i++) wanted[i] = intents[i].to;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (j == i || wanted[i] == intents[i].from || wanted[j] == intents[j].from) continue;
+            if ((wanted[i] == wanted[j] && intents[j].ghost < intents[i].ghost) ||
+                (wanted[i] == intents[j].from && wanted[j] == intents[i].from)) {
+                intents[i].to = intents[i].from;
+                moving[intents[i].ghost] = -1;
+            }
+        }
+    }
+
+    // A ghost can only step into a cell whose ghost leaves it, staying ghosts block others in turn
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int i = 0; i < n; i++) {
+            if (intents[i].to == intents[i].from) continue;
+            int other = ghost_at(board, intents[i].to);
+            if (other >= 0 && moving[other] < 0) {
+                intents[i].to = intents[i].from;
+                moving[intents[i].ghost] = -1;
+                changed = 1;
+            }
+        }
+    }
+
+    // The cells written are taken first: out of memory, no ghost moves this play
+    board_pos_t* from[MAX_GHOSTS];
+    board_pos_t* to[MAX_GHOSTS];
+    for (int i = 0; i < n; i++) {
+        if (intents[i].to == intents[i].from) continue;
+        from[i] = touch_cell(board, (int) (intents[i].from % board->width), (int) (intents[i].from / board->width));
+        to[i] = touch_cell(board, (int) (intents[i].to % board->width), (int) (intents[i].to / board->width));
+        if (!from[i] || !to[i]) {
+            for (int j = 0; j < n; j++) intents[j].to = intents[j].from;
+            return;
+        }
+    }
+
+    // Commit: every mover leaves its cell before any of them lands
+    for (int i = 0; i < n; i++) {
+        if (intents[i].to != intents[i].from) {
+            note(board, from[i], sizeof(board_pos_t));
+            from[i]->content = ' ';
+            mark_changed(board, intents[i].from);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        ghost_intent_t* intent = &intents[i];
+        if (intent->to == intent->from) continue;
+        ghost_t* ghost = &board->ghosts[intent->ghost];
+        note(board, ghost, sizeof(*ghost));
+        note(board, to[i], sizeof(board_pos_t));
+        ghost->pos_x = (int) (intent->to % board->width);
+        ghost->pos_y = (int) (intent->to / board->width);
+        if (to[i]->content == 'P') {
+            find_and_kill_pacman(board, ghost->pos_x, ghost->pos_y);
+        }
+        to[i]->content = 'M';
+        mark_changed(board, intent->to);
+        if (board->heat) board->heat->ghosts[intent->to]++;
+    }
+}
+
+void schedule_ghosts(board_t* board) {
+    board->n_events = 0;
+    for (int i = 0; i < board->n_ghosts && i < MAX_GHOSTS; i++) {
+        if (board->ghosts[i].program) {
+            board->agenda[board->n_events].tick = board->ghosts[i].wake;
+            board->agenda[board->n_events].ghost = i;
+            board->n_events++;
+        }
+    }
+    for (int i = board->n_events / 2 - 1; i >= 0; i--) {
+        sift_down(board, i);
+    }
+}
+
+// Helper private function, whether any pacman is still playing
+static int any_pacman_alive(const board_t* board) {
+    for (int p = 0; p < board->n_pacmans; p++) {
+        if (board->pacmans[p].alive) return 1;
+    }
+    return 0;
+}
+
+int play_turn(board_t* board, command_t* command) {
+    if (board->journal) journal_begin(board->journal);
+    note(board, &board->tick, sizeof(board->tick));
+    int result = move_pacman(board, 0, command);
+    if (result == REACHED_PORTAL) {
+        board->tick++;
+        return result;
+    }
+
+    // The other pacmans always follow their programs
+    for (int p = 1; p < board->n_pacmans; p++) {
+        if (board->pacmans[p].program && move_pacman(board, p, NULL) == REACHED_PORTAL) {
+            board->tick++;
+            return REACHED_PORTAL;
+        }
+    }
+    if (!any_pacman_alive(board)) {
+        board->tick++;
+        return DEAD_PACMAN;
+    }
+
+    if (board->simultaneous) {
+        // Two phases: the ghosts due now plan their moves against the board as it is,
+        // which only touches each ghost's own state, and then the conflicts are settled at once
+        ghost_intent_t intents[MAX_GHOSTS];
+        int n = 0;
+        while (board->n_events > 0 && board->agenda[0].tick <= board->tick) {
+            intents[n++].ghost = board->agenda[0].ghost;
+            board->agenda[0] = board->agenda[--board->n_events];
+            sift_down(board, 0);
+        }
+        for (int i = 0; i < n; i++) {
+            plan_ghost(board, intents[i].ghost, &intents[i]);
+        }
+        resolve_ghosts(board, intents, n);
+        for (int i = 0; i < n; i++) {
+            board->agenda[board->n_events].tick = board->ghosts[intents[i].ghost].wake;
+            board->agenda[board->n_events].ghost = intents[i].ghost;
+            sift_up(board, board->n_events++);
+        }
+    }
+    else {
+        // Ghosts due now come out of the agenda in index order, as when every ghost was visited
+        while (board->n_events > 0 && board->agenda[0].tick <= board->tick) {
+            int i = board->agenda[0].ghost;
+            move_ghost(board, i, NULL);
+            board->agenda[0].tick = board->ghosts[i].wake;
+            sift_down(board, 0);
+        }
+    }
+    board->tick++;
+
+    if (!any_pacman_alive(board)) {
+        return DEAD_PACMAN;
+    }
+    return result == DEAD_PACMAN ? VALID_MOVE : result; // pacman 0 is dead but the others play on
+}
+
+int rewind_plays(board_t* board, int plays) {
+    if (!board->journal) return 0;
+    int undone = journal_rewind(board->journal, plays);
+    // The agenda is not journaled, it only depends on the wake of each ghost
+    if (undone > 0) schedule_ghosts(board);
+    return undone;
+}
+
+long next_event(const board_t* board) {
+    long next = LONG_MAX;
+    if (board->n_events > 0) {
+        next = board->agenda[0].tick;
+    }
+    for (int p = 0; p < board->n_pacmans; p++) {
+        const pacman_t* pac = &board->pacmans[p];
+        if (pac->program && pac->alive && pac->wake < next) {
+            next = pac->wake;
+        }
+    }
+    return next > board->tick ? next : board->tick;
+}
+
+long fast_forward(board_t* board, long until) {
+    long target = next_event(board);
+    if (target > until) target = until;
+    if (target <= board->tick) return 0;
+    long skipped = target - board->tick;
+    note(board, &board->tick, sizeof(board->tick));
+    board->tick = target;
+    return skipped;
+}
+
+int init_progress(board_t* board) {
+    // Tiles that are not kept hold no dots, no walls and no visits. The dots of a tile follow its cells, so
+    // writing them into a tile shared by several places leaves the same bits for all of them
+    board->open_cells = (long) board->width * board->height;
+    long dots = 0;
+    for (long c = 0; c < n_chunks(board); c++) {
+        if (!board->chunks[c]) continue;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            tile_t* tile = board->chunks[c][s];
+            if (!tile) continue;
+            int tx, ty, x0, x1, y0, y1;
+            chunk_tile(board, c, s, &tx, &ty);
+            tile_bounds(board, tx, ty, &x0, &x1, &y0, &y1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int cell = tile_cell(x, y);
+                    if (tile->cells[cell].has_dot) {
+                        set_bit(tile->dots, cell);
+                        dots++;
+                    }
+                    else {
+                        clear_bit(tile->dots, cell);
+                    }
+                    if (tile->cells[cell].content == 'W') board->open_cells--;
+                }
+            }
+        }
+    }
+    for (int p = 0; p < board->n_pacmans; p++) {
+        pacman_t* pac = &board->pacmans[p];
+        if (pac->alive && is_valid_position(board, pac->pos_x, pac->pos_y)) {
+            tile_t* tile = touch_tile(board, pac->pos_x >> TILE_SHIFT, pac->pos_y >> TILE_SHIFT);
+            if (!tile) return -1;
+            set_bit(tile->visited, tile_cell(pac->pos_x, pac->pos_y));
+        }
+    }
+
+    // Visits are only ever made on a tile of the board's own, so each is counted once
+    long visited = 0;
+    for (long c = 0; c < n_chunks(board); c++) {
+        if (!board->chunks[c]) continue;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            if (board->chunks[c][s]) visited += count_bits(board->chunks[c][s]->visited, TILE_WORDS);
+        }
+    }
+    board->dots_left = board->dots_total = (int) dots;
+    board->cells_visited = visited;
+    return 0;
+}
+
+int place_pacmans(board_t* board) {
+    for (int p = 0; p < board->n_pacmans; p++) {
+        pacman_t* pac = &board->pacmans[p];
+        if (pac->alive && is_valid_position(board, pac->pos_x, pac->pos_y) &&
+            board_cell(board, pac->pos_x, pac->pos_y)->content != 'W') {
+            board_pos_t* cell = touch_cell(board, pac->pos_x, pac->pos_y);
+            if (!cell) return -1;
+            cell->content = 'P'; // pacmans block each other from the first play
+        }
+    }
+    return 0;
+}
+
+int total_points(const board_t* board) {
+    int points = 0;
+    for (int p = 0; p < board->n_pacmans; p++) {
+        points += board->pacmans[p].points;
+    }
+    return points;
+}
+
+// With popcnt where the CPU has it, the loop is one instruction per 64 cells
+__attribute__((target_clones("popcnt", "default")))
+long count_bits(const uint64_t* plane, long words) {
+    long count = 0;
+    for (long i = 0; i < words; i++) {
+        count += __builtin_popcountll(plane[i]);
+    }
+    return count;
+}
+
+void level_stats(const board_t* board, level_stats_t* stats) {
+    stats->dots_left = board->dots_left;
+    stats->dots_total = board->dots_total;
+    stats->cells_visited = board->cells_visited;
+    stats->open_cells = board->open_cells;
+    stats->cleared = board->dots_total > 0 ? 1.0 - (double) board->dots_left / board->dots_total : 1.0;
+    stats->coverage = board->open_cells > 0 ? (double) board->cells_visited / board->open_cells : 0.0;
+}
+
+// Helper private function, one FNV-1a step
+static inline unsigned long digest_mix(unsigned long h, long value) {
+    for (int i = 0; i < 8; i++) {
+        h = (h ^ ((unsigned long) value & 0xff)) * 1099511628211UL;
+        value >>= 8;
+    }
+    return h;
+}
+
+unsigned long board_digest(const board_t* board) {
+    unsigned long h = 1469598103934665603UL;
+    h = digest_mix(h, board->width);
+    h = digest_mix(h, board->height);
+    h = digest_mix(h, board->tick);
+    h = digest_mix(h, board->seed);
+    // Tile by tile, each cell that is not blank with its index: a blank cell reads the same whether kept or not
+    for (long c = 0; c < n_chunks(board); c++) {
+        if (!board->chunks[c]) continue;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            const tile_t* tile = board->chunks[c][s];
+            if (!tile) continue;
+            int tx, ty, x0, x1, y0, y1;
+            chunk_tile(board, c, s, &tx, &ty);
+            tile_bounds(board, tx, ty, &x0, &x1, &y0, &y1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    const board_pos_t* cell = &tile->cells[tile_cell(x, y)];
+                    if (same_cell(cell, &blank_tile.cells[0])) continue;
+                    h = digest_mix(h, get_board_index(board, x, y));
+                    h = digest_mix(h, cell->content | cell->has_dot << 8 | cell->has_portal << 9);
+                }
+            }
+        }
+    }
+    for (int p = 0; p < board->n_pacmans; p++) {
+        const pacman_t* pac = &board->pacmans[p];
+        h = digest_mix(h, pac->pos_x);
+        h = digest_mix(h, pac->pos_y);
+        h = digest_mix(h, pac->alive);
+        h = digest_mix(h, pac->points);
+        h = digest_mix(h, pac->wake);
+    }
+    for (int g = 0; g < board->n_ghosts; g++) {
+        const ghost_t* ghost = &board->ghosts[g];
+        h = digest_mix(h, ghost->pos_x);
+        h = digest_mix(h, ghost->pos_y);
+        h = digest_mix(h, ghost->charged);
+        h = digest_mix(h, ghost->wake);
+        h = digest_mix(h, ghost->behavior.pc);
+    }
+    return h;
+}
+
+int course_repeats(const board_t* board) {
+    return !board->simultaneous;
+}
+
+// Helper private function: whether pacman 'p' may still move, as play_turn calls them (pacman 0 always, with
+// the player's or the idle command, the others only by their programs)
+static inline int pacman_moves(const board_t* board, int p) {
+    return board->pacmans[p].alive && (p == 0 || board->pacmans[p].program);
+}
+
+// Helper private function: the part of a behaviour state that is in use
+static int same_behavior(const behavior_state_t* a, const behavior_state_t* b) {
+    if (a->pc != b->pc || a->depth != b->depth) return 0;
+    for (int i = 0; i < a->depth; i++) {
+        if (a->loops[i] != b->loops[i]) return 0;
+    }
+    return 1;
+}
+
+unsigned long course_digest(const board_t* board) {
+    unsigned long h = 1469598103934665603UL;
+    h = digest_mix(h, board->seed);
+    // Dots are only ever eaten, so their count stands for the bitplane. The cells visited are left out:
+    // a board back where it was goes on visiting the cells of the last lap only, all of them visited already
+    h = digest_mix(h, board->dots_left);
+    for (int p = 0; p < board->n_pacmans; p++) {
+        const pacman_t* pac = &board->pacmans[p];
+        h = digest_mix(h, (long) pac->pos_y * board->width + pac->pos_x);
+        h = digest_mix(h, pac->alive);
+        h = digest_mix(h, pac->points);
+        if (pacman_moves(board, p)) {
+            h = digest_mix(h, pac->wake - board->tick);
+            h = digest_mix(h, pac->behavior.pc);
+        }
+    }
+    for (int g = 0; g < board->n_ghosts; g++) {
+        const ghost_t* ghost = &board->ghosts[g];
+        h = digest_mix(h, (long) ghost->pos_y * board->width + ghost->pos_x);
+        h = digest_mix(h, ghost->charged);
+        if (ghost->program) {
+            h = digest_mix(h, ghost->wake - board->tick);
+            h = digest_mix(h, ghost->behavior.pc);
+        }
+    }
+    return h;
+}
+
+int same_course(const board_t* earlier, const board_t* later) {
+    const board_t* a = earlier;
+    const board_t* b = later;
+    if (a->width != b->width || a->height != b->height || a->seed != b->seed || a->dots_left != b->dots_left ||
+        a->n_pacmans != b->n_pacmans || a->n_ghosts != b->n_ghosts) {
+        return 0;
+    }
+    for (int p = 0; p < a->n_pacmans; p++) {
+        const pacman_t* pa = &a->pacmans[p];
+        const pacman_t* pb = &b->pacmans[p];
+        if (pa->pos_x != pb->pos_x || pa->pos_y != pb->pos_y || pa->alive != pb->alive || pa->points != pb->points) {
+            return 0;
+        }
+        if (pacman_moves(a, p) && (pa->wake - a->tick != pb->wake - b->tick || !same_behavior(&pa->behavior, &pb->behavior))) {
+            return 0;
+        }
+    }
+    for (int g = 0; g < a->n_ghosts; g++) {
+        const ghost_t* ga = &a->ghosts[g];
+        const ghost_t* gb = &b->ghosts[g];
+        if (ga->pos_x != gb->pos_x || ga->pos_y != gb->pos_y || ga->charged != gb->charged) return 0;
+        if (ga->program && (ga->wake - a->tick != gb->wake - b->tick || !same_behavior(&ga->behavior, &gb->behavior))) {
+            return 0;
+        }
+    }
+    for (long c = 0; c < n_chunks(a); c++) {
+        tile_t** chunk_a = a->chunks[c];
+        tile_t** chunk_b = b->chunks[c];
+        if (!chunk_a && !chunk_b) continue;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            const tile_t* ta = chunk_a ? chunk_a[s] : NULL;
+            const tile_t* tb = chunk_b ? chunk_b[s] : NULL;
+            if (ta == tb) continue;
+            if (!ta) ta = &blank_tile;
+            if (!tb) tb = &blank_tile;
+            int tx, ty, x0, x1, y0, y1;
+            chunk_tile(a, c, s, &tx, &ty);
+            tile_bounds(a, tx, ty, &x0, &x1, &y0, &y1);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int cell = tile_cell(x, y);
+                    if (!same_cell(&ta->cells[cell], &tb->cells[cell])) return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+void skip_plays(board_t* board, long plays) {
+    if (plays <= 0) return;
+    for (int p = 0; p < board->n_pacmans; p++) {
+        if (pacman_moves(board, p)) board->pacmans[p].wake += plays;
+    }
+    for (int g = 0; g < board->n_ghosts; g++) {
+        if (board->ghosts[g].program) board->ghosts[g].wake += plays;
+    }
+    board->tick += plays;
+    schedule_ghosts(board);
+}
+
 void kill_pacman(board_t* board, int pacman_index) {
     debug("Killing %d pacman\n\n", pacman_index);
     pacman_t* pac = &board->pacmans[pacman_index];
-    int index = pac->pos_y * board->width + pac->pos_x;
+    long index = get_board_index(board, pac->pos_x, pac->pos_y);
 
     // Remove pacman from the board
-    board->board[index].content = ' ';
+    board_pos_t* cell = touch_cell(board, pac->pos_x, pac->pos_y);
+    if (cell) {
+        note(board, cell, sizeof(board_pos_t));
+        cell->content = ' ';
+        mark_changed(board, index);
+    }
+    note(board, pac, sizeof(*pac));
 
     // Mark pacman as dead
     pac->alive = 0;
+    if (board->heat) board->heat->deaths[index]++;
 }
 
 // Static Loading
 int load_pacman(board_t* board, int points) {
-    board->board[1 * board->width + 1].content = 'P'; // Pacman
+    touch_cell(board, 1, 1)->content = 'P'; // Pacman
     board->pacmans[0].pos_x = 1;
     board->pacmans[0].pos_y = 1;
     board->pacmans[0].alive = 1;
@@ -345,32 +1215,20 @@ int load_pacman(board_t* board, int points) {
 // Static Loading
 int load_ghost(board_t* board) {
     // Ghost 0
-    board->board[3 * board->width + 1].content = 'M'; // Monster
+    touch_cell(board, 1, 3)->content = 'M'; // Monster
     board->ghosts[0].pos_x = 1;
     board->ghosts[0].pos_y = 3;
     board->ghosts[0].passo = 0;
-    board->ghosts[0].waiting = 0;
-    board->ghosts[0].current_move = 0;
-    board->ghosts[0].n_moves = 16;
-    for (int i = 0; i < 8; i++) {
-        board->ghosts[0].moves[i].command = 'D';
-        board->ghosts[0].moves[i].turns = 1; 
-    }
-    for (int i = 8; i < 16; i++) {
-        board->ghosts[0].moves[i].command = 'A';
-        board->ghosts[0].moves[i].turns = 1; 
-    }
+    board->ghosts[0].wake = 0;
+    board->ghosts[0].program = behavior_compile("D 8 A 8");
 
     // Ghost 1
-    board->board[2 * board->width + 4].content = 'M'; // Monster
+    touch_cell(board, 4, 2)->content = 'M'; // Monster
     board->ghosts[1].pos_x = 4;
     board->ghosts[1].pos_y = 2;
     board->ghosts[1].passo = 1;
-    board->ghosts[1].waiting = 1;
-    board->ghosts[1].current_move = 0;
-    board->ghosts[1].n_moves = 1;
-    board->ghosts[1].moves[0].command = 'R'; // Random
-    board->ghosts[1].moves[0].turns = 1; 
+    board->ghosts[1].wake = 1;
+    board->ghosts[1].program = behavior_compile("R"); // Random
     
     return 0;
 }
@@ -379,53 +1237,127 @@ int load_level(board_t *board, int points) {
     board->height = 5;
     board->width = 10;
     board->tempo = 10;
+    board->seed = (unsigned int) rand();
+    board->tick = 0;
+    board->journal = NULL;
+    board->changes = NULL;
+    board->heat = NULL;
+    board->clear_to_win = 0;
+    board->simultaneous = 0;
 
     board->n_ghosts = 2;
     board->n_pacmans = 1;
 
-    board->board = calloc(board->width * board->height, sizeof(board_pos_t));
-    board->pacmans = calloc(board->n_pacmans, sizeof(pacman_t));
-    board->ghosts = calloc(board->n_ghosts, sizeof(ghost_t));
+    init_tiles(board);
+    board->pacmans = alloc_calloc(ALLOC_BOARD, board->n_pacmans, sizeof(pacman_t));
+    board->ghosts = alloc_calloc(ALLOC_BOARD, board->n_ghosts, sizeof(ghost_t));
 
     sprintf(board->level_name, "Static Level");
 
     for (int i = 0; i < board->height; i++) {
         for (int j = 0; j < board->width; j++) {
+            board_pos_t* cell = touch_cell(board, j, i);
             if (i == 0 || j == 0 || j == (board->width - 1)) {
-                board->board[i * board->width + j].content = 'W';
+                cell->content = 'W';
             }
             else if (i == 4 && j == 8) {
-                board->board[i * board->width + j].content = ' ';
-                board->board[i * board->width + j].has_portal = 1;
+                cell->content = ' ';
+                cell->has_portal = 1;
             }
             else {
-                board->board[i * board->width + j].content = ' ';
-                board->board[i * board->width + j].has_dot = 1;
+                cell->content = ' ';
+                cell->has_dot = 1;
             }
         }
     }
 
     load_ghost(board);
     load_pacman(board, points);
+    schedule_ghosts(board);
+    place_pacmans(board);
+    init_progress(board);
 
     return 0;
 }
 
 void unload_level(board_t * board) {
-    free(board->board);
-    free(board->pacmans);
-    free(board->ghosts);
+    for (int i = 0; i < board->n_pacmans; i++) behavior_release(board->pacmans[i].program);
+    for (int i = 0; i < board->n_ghosts; i++) behavior_release(board->ghosts[i].program);
+    release_tiles(board);
+    alloc_free(board->pacmans);
+    alloc_free(board->ghosts);
+}
+
+int clone_board(board_t* dst, const board_t* src) {
+    *dst = *src;
+    dst->journal = NULL;
+    dst->heat = NULL;
+    dst->changes = NULL;
+    long n = n_chunks(src);
+    dst->chunks = placement_calloc(n > 0 ? n : 1, sizeof(tile_t**));
+    dst->pacmans = alloc_malloc(ALLOC_BOARD, (src->n_pacmans > 0 ? src->n_pacmans : 1) * sizeof(pacman_t));
+    dst->ghosts = alloc_malloc(ALLOC_BOARD, (src->n_ghosts > 0 ? src->n_ghosts : 1) * sizeof(ghost_t));
+    if (!dst->chunks || !dst->pacmans || !dst->ghosts) {
+        placement_free(dst->chunks);
+        alloc_free(dst->pacmans);
+        alloc_free(dst->ghosts);
+        return -1;
+    }
+
+    // The tiles are shared until either board writes to one. Not those of a board keeping a journal:
+    // its journal points into the tiles it wrote, which must stay its own, so the copy gets its own tiles
+    // The chunks of the table are never shared, they are only a few pointers per kept tile
+    int failed = 0;
+    if (src->journal) {
+        failed = copy_cells(dst, src) != 0;
+    }
+    else {
+        for (long c = 0; c < n && !failed; c++) {
+            if (!src->chunks[c]) continue;
+            dst->chunks[c] = placement_alloc(CHUNK_TILES * sizeof(tile_t*));
+            if (!dst->chunks[c]) {
+                failed = 1;
+                break;
+            }
+            memcpy(dst->chunks[c], src->chunks[c], CHUNK_TILES * sizeof(tile_t*));
+            for (int s = 0; s < CHUNK_TILES; s++) {
+                if (dst->chunks[c][s]) atomic_fetch_add_explicit(&dst->chunks[c][s]->refs, 1, memory_order_relaxed);
+            }
+        }
+    }
+    if (failed) {
+        release_tiles(dst);
+        alloc_free(dst->pacmans);
+        alloc_free(dst->ghosts);
+        return -1;
+    }
+    memcpy(dst->pacmans, src->pacmans, src->n_pacmans * sizeof(pacman_t));
+    memcpy(dst->ghosts, src->ghosts, src->n_ghosts * sizeof(ghost_t));
+    // The programs never change once compiled, the copy shares them
+    for (int i = 0; i < dst->n_pacmans; i++) behavior_retain(dst->pacmans[i].program);
+    for (int i = 0; i < dst->n_ghosts; i++) behavior_retain(dst->ghosts[i].program);
+    return 0;
 }
 
 void open_debug_file(char *filename) {
+    static char buffer[BUFSIZ];
     debugfile = fopen(filename, "w");
+    // Its buffer from the start, or the first debug line of a play would allocate it (see alloc.h)
+    if (debugfile) setvbuf(debugfile, buffer, _IOFBF, sizeof(buffer));
 }
 
 void close_debug_file() {
-    fclose(debugfile);
+    if (debugfile) fclose(debugfile);
+    debugfile = NULL;
+}
+
+void mute_debug(int mute) {
+    debug_muted = mute;
 }
 
 void debug(const char * format, ...) {
+    if (!debugfile || debug_muted) return;
+
     va_list args;
     va_start(args, format);
     vfprintf(debugfile, format, args);
@@ -435,7 +1367,7 @@ void debug(const char * format, ...) {
 }
 
 void print_board(board_t *board) {
-    if (!board || !board->board) {
+    if (!board || !board->chunks) {
         debug("[%d] Board is empty or not initialized.\n", getpid());
         return;
     }
@@ -449,7 +1381,7 @@ void print_board(board_t *board) {
                        "Dimensions: %d x %d\n"
                        "Tempo: %d\n"
                        "Pacman file: %s\n",
-                       getpid(), board->height, board->width, board->tempo, board->pacman_file);
+                       getpid(), board->height, board->width, board->tempo, board->pacman_files[0]);
 
     offset += snprintf(buffer + offset, sizeof(buffer) - offset,
                        "Monster files (%d):\n", board->n_ghosts);
@@ -463,9 +1395,8 @@ void print_board(board_t *board) {
 
     for (int y = 0; y < board->height; y++) {
         for (int x = 0; x < board->width; x++) {
-            int idx = y * board->width + x;
             if (offset < sizeof(buffer) - 2) {
-                buffer[offset++] = board->board[idx].content;
+                buffer[offset++] = board_cell(board, x, y)->content;
             }
         }
         if (offset < sizeof(buffer) - 2) {
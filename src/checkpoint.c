@@ -0,0 +1,395 @@
+#include "checkpoint.h"
+#include "behavior.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
+
+#define CHECKPOINT_IOV (4 + MAX_PACMANS + MAX_GHOSTS) // header, board, chunks and tiles, entities, programs
+#define CHECKPOINT_SHARED_TILES 16 // shared tiles written once, more of them are written at each place
+#define WRITEV_BATCH 1024           // iovecs given to each writev (IOV_MAX on Linux)
+
+// What checkpoint_save writes from, grown by reserve and kept for the next save
+static uint32_t* numbers;           // a number per chunk, then one per tile of each chunk kept
+static struct iovec* iov;
+static long reserved_chunks, reserved_kept;
+
+// CRC-32C, with the SSE4.2 instruction when the CPU has it and a table otherwise
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static int crc_hardware = 0;
+
+// Helper private function run once, before the first checksum
+static void crc_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78u & -(crc & 1));
+        crc_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    crc_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_update_hardware(uint32_t crc, const unsigned char* data, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; len > 0; data++, len--) crc = __builtin_ia32_crc32qi(crc, *data);
+    return crc;
+}
+#endif
+
+// Helper private function to add 'len' bytes to a running CRC (started at ~0, finished with ~)
+static uint32_t crc_update(uint32_t crc, const void* data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+    if (crc_hardware) return crc_update_hardware(crc, data, len);
+#endif
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < len; i++) crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+// Helper private function for the entity record of a pacman or a ghost
+static void fill_entity(checkpoint_entity_t* entity, const pacman_t* pac, const ghost_t* ghost) {
+    memset(entity, 0, sizeof(*entity));
+    const program_t* program = pac ? pac->program : ghost->program;
+    entity->pos_x = pac ? pac->pos_x : ghost->pos_x;
+    entity->pos_y = pac ? pac->pos_y : ghost->pos_y;
+    entity->alive = pac ? pac->alive : 0;
+    entity->points = pac ? pac->points : 0;
+    entity->passo = pac ? pac->passo : ghost->passo;
+    entity->charged = pac ? 0 : ghost->charged;
+    entity->wake = pac ? pac->wake : ghost->wake;
+    entity->behavior = pac ? pac->behavior : ghost->behavior;
+    entity->program_size = program ? program->size : 0;
+}
+
+// Helper private function: writev until everything is written, picking up after short writes
+static int write_all(int fd, struct iovec* iov, int n_iov) {
+    while (n_iov > 0) {
+        ssize_t n = writev(fd, iov, n_iov < WRITEV_BATCH ? n_iov : WRITEV_BATCH);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        while (n_iov > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if (n_iov > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Helper private function, chunks of the tile table the board keeps
+static long kept_chunks(const board_t* board) {
+    long kept = 0;
+    for (long c = 0; c < (long) board->chunks_x * board->chunks_y; c++) kept += board->chunks[c] != NULL;
+    return kept;
+}
+
+// Helper private function: the buffers for a table of 'n_chunks' chunks, 'kept' of them kept
+static int reserve(long n_chunks, long kept) {
+    if (n_chunks > reserved_chunks || kept > reserved_kept || !numbers) {
+        uint32_t* more_numbers = realloc(numbers, (n_chunks + kept * CHUNK_TILES + 1) * sizeof(uint32_t));
+        if (!more_numbers) return -1;
+        numbers = more_numbers;
+        struct iovec* more_iov = realloc(iov, (CHECKPOINT_IOV + kept * CHUNK_TILES) * sizeof(struct iovec));
+        if (!more_iov) return -1;
+        iov = more_iov;
+        reserved_chunks = n_chunks;
+        reserved_kept = kept;
+    }
+    return 0;
+}
+
+int checkpoint_reserve(const board_t* board) {
+    return reserve((long) board->chunks_x * board->chunks_y, kept_chunks(board));
+}
+
+int checkpoint_save(const char* path, const board_t* board, int level_index) {
+    int n_pacmans = board->n_pacmans < MAX_PACMANS ? board->n_pacmans : MAX_PACMANS;
+    int n_ghosts = board->n_ghosts < MAX_GHOSTS ? board->n_ghosts : MAX_GHOSTS;
+
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.header_size = sizeof(header);
+    header.level_index = level_index;
+
+    checkpoint_board_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.width = board->width;
+    meta.height = board->height;
+    meta.tempo = board->tempo;
+    meta.seed = board->seed;
+    meta.tick = board->tick;
+    meta.n_pacmans = n_pacmans;
+    meta.n_ghosts = n_ghosts;
+    meta.clear_to_win = board->clear_to_win;
+    meta.simultaneous = board->simultaneous;
+    meta.dots_total = board->dots_total;
+    memcpy(meta.level_name, board->level_name, sizeof(meta.level_name));
+    memcpy(meta.pacman_files, board->pacman_files, sizeof(meta.pacman_files));
+    memcpy(meta.ghosts_files, board->ghosts_files, sizeof(meta.ghosts_files));
+
+    checkpoint_entity_t entities[MAX_PACMANS + MAX_GHOSTS];
+    for (int p = 0; p < n_pacmans; p++) fill_entity(&entities[p], &board->pacmans[p], NULL);
+    for (int g = 0; g < n_ghosts; g++) fill_entity(&entities[n_pacmans + g], NULL, &board->ghosts[g]);
+
+    // Tiles and programs are written from where they are, nothing is copied
+    long n_chunks = (long) board->chunks_x * board->chunks_y;
+    if (reserve(n_chunks, kept_chunks(board)) != 0) return -1;
+    int n_iov = 0;
+    iov[n_iov++] = (struct iovec){.iov_base = &header, .iov_len = sizeof(header)};
+    iov[n_iov++] = (struct iovec){.iov_base = &meta, .iov_len = sizeof(meta)};
+    struct iovec* table = &iov[n_iov++]; // the numbers, once they are all known
+    const tile_t* shared[CHECKPOINT_SHARED_TILES];
+    uint32_t shared_numbers[CHECKPOINT_SHARED_TILES];
+    int n_shared = 0;
+    uint32_t stored = 0;
+    long n_numbers = n_chunks;
+    for (long c = 0; c < n_chunks; c++) {
+        numbers[c] = board->chunks[c] != NULL;
+        if (!board->chunks[c]) continue;
+        for (int s = 0; s < CHUNK_TILES; s++) {
+            const tile_t* tile = board->chunks[c][s];
+            uint32_t* number = &numbers[n_numbers++];
+            *number = 0;
+            if (!tile) continue;
+            int refs = atomic_load_explicit(&tile->refs, memory_order_relaxed);
+            int k = 0;
+            while (refs > 1 && k < n_shared && shared[k] != tile) k++;
+            if (refs > 1 && k < n_shared) {
+                *number = shared_numbers[k];
+                continue;
+            }
+            *number = ++stored;
+            if (refs > 1 && n_shared < CHECKPOINT_SHARED_TILES) {
+                shared[n_shared] = tile;
+                shared_numbers[n_shared++] = stored;
+            }
+            iov[n_iov++] = (struct iovec){.iov_base = (char*) tile + offsetof(tile_t, dots), .iov_len = TILE_BYTES};
+        }
+    }
+    *table = (struct iovec){.iov_base = numbers, .iov_len = n_numbers * sizeof(uint32_t)};
+    iov[n_iov++] = (struct iovec){.iov_base = entities, .iov_len = (n_pacmans + n_ghosts) * sizeof(checkpoint_entity_t)};
+    for (int e = 0; e < n_pacmans + n_ghosts; e++) {
+        const program_t* program = e < n_pacmans ? board->pacmans[e].program : board->ghosts[e - n_pacmans].program;
+        if (program) iov[n_iov++] = (struct iovec){.iov_base = (void*) program->code, .iov_len = program->size};
+    }
+
+    uint32_t crc = ~0u;
+    for (int i = 1; i < n_iov; i++) {
+        header.payload_size += iov[i].iov_len;
+        crc = crc_update(crc, iov[i].iov_base, iov[i].iov_len);
+    }
+    header.checksum = ~crc;
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    int result = write_all(fd, iov, n_iov);
+    if (result == 0) result = fsync(fd);
+    if (close(fd) != 0) result = -1;
+    if (result == 0) result = rename(tmp_path, path);
+    if (result != 0) {
+        int saved = errno;
+        unlink(tmp_path);
+        errno = saved;
+    }
+    return result;
+}
+
+// Helper private function: the next 'size' bytes of the mapping, NULL past its end
+static const unsigned char* take(const unsigned char* data, size_t length, size_t* at, size_t size) {
+    if (size > length - *at) return NULL;
+    const unsigned char* p = data + *at;
+    *at += size;
+    return p;
+}
+
+// Helper private function for an entity read back, checked against its program
+static int valid_entity(const checkpoint_entity_t* entity, const checkpoint_board_t* meta) {
+    return entity->pos_x >= 0 && entity->pos_x < meta->width && entity->pos_y >= 0 && entity->pos_y < meta->height &&
+           entity->program_size >= 0 && entity->behavior.depth >= 0 && entity->behavior.depth <= MAX_LOOP_DEPTH &&
+           entity->behavior.pc >= 0 && (entity->program_size == 0 || entity->behavior.pc < entity->program_size);
+}
+
+// Helper private function: the chunks, the tile numbers and the stored tiles, into the (empty) tile table of board
+static int load_tiles(board_t* board, const unsigned char* data, size_t length, size_t* at) {
+    long n_chunks = (long) board->chunks_x * board->chunks_y;
+    const unsigned char* kept = take(data, length, at, n_chunks * sizeof(uint32_t));
+    if (!kept) return -1;
+    long n_kept = 0;
+    for (long c = 0; c < n_chunks; c++) {
+        uint32_t flag;
+        memcpy(&flag, kept + c * sizeof(uint32_t), sizeof(flag));
+        if (flag > 1) return -1;
+        n_kept += flag;
+    }
+    const unsigned char* p = take(data, length, at, n_kept * CHUNK_TILES * sizeof(uint32_t));
+    if (!p) return -1;
+    tile_t** by_number = malloc((n_kept * CHUNK_TILES + 1) * sizeof(tile_t*)); // stored tiles, by their number
+    if (!by_number) return -1;
+
+    // Stored tiles are numbered in the order of their first place
+    uint32_t stored = 0;
+    int result = 0;
+    for (long c = 0; c < n_chunks && result == 0; c++) {
+        uint32_t flag;
+        memcpy(&flag, kept + c * sizeof(uint32_t), sizeof(flag));
+        for (int s = 0; flag && s < CHUNK_TILES && result == 0; s++, p += sizeof(uint32_t)) {
+            uint32_t number;
+            memcpy(&number, p, sizeof(number));
+            int tx = (int) (c % board->chunks_x) << CHUNK_SHIFT | (s & CHUNK_MASK);
+            int ty = (int) (c / board->chunks_x) << CHUNK_SHIFT | s >> CHUNK_SHIFT;
+            if (number == 0) continue;
+            if (number > stored + 1 || tx >= board->tiles_x || ty >= board->tiles_y) {
+                result = -1;
+            }
+            else if (number == stored + 1) {
+                const unsigned char* bytes = take(data, length, at, TILE_BYTES);
+                tile_t* tile = bytes ? own_tile(board, tx, ty) : NULL;
+                if (!tile) result = -1;
+                else memcpy((char*) tile + offsetof(tile_t, dots), bytes, TILE_BYTES);
+                by_number[++stored] = tile;
+            }
+            else if (share_tile(board, tx, ty, by_number[number]) != 0) {
+                result = -1;
+            }
+        }
+    }
+    free(by_number);
+    return result;
+}
+
+int checkpoint_load(const char* path, board_t* board, int* level_index) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(checkpoint_header_t)) {
+        close(fd);
+        return -1;
+    }
+    size_t length = st.st_size;
+    const unsigned char* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    int result = -1;
+    memset(board, 0, sizeof(*board));
+    size_t at = 0;
+    checkpoint_header_t header;
+    checkpoint_board_t meta;
+    memcpy(&header, take(data, length, &at, sizeof(header)), sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION ||
+        header.header_size != sizeof(header) || header.payload_size != length - sizeof(header) ||
+        ~crc_update(~0u, data + at, header.payload_size) != header.checksum) {
+        goto done;
+    }
+
+    const unsigned char* p = take(data, length, &at, sizeof(meta));
+    if (!p) goto done;
+    memcpy(&meta, p, sizeof(meta));
+    long tiles_x = ((long) meta.width + TILE_MASK) >> TILE_SHIFT, tiles_y = ((long) meta.height + TILE_MASK) >> TILE_SHIFT;
+    long n_chunks = ((tiles_x + CHUNK_MASK) >> CHUNK_SHIFT) * ((tiles_y + CHUNK_MASK) >> CHUNK_SHIFT);
+    if (meta.width <= 0 || meta.height <= 0 || n_chunks > (long) (length / sizeof(uint32_t)) ||
+        meta.n_pacmans < 1 || meta.n_pacmans > MAX_PACMANS || meta.n_ghosts < 0 || meta.n_ghosts > MAX_GHOSTS) {
+        goto done;
+    }
+
+    board->width = meta.width;
+    board->height = meta.height;
+    board->tempo = meta.tempo;
+    board->seed = meta.seed;
+    board->tick = meta.tick;
+    board->n_pacmans = meta.n_pacmans;
+    board->n_ghosts = meta.n_ghosts;
+    board->clear_to_win = meta.clear_to_win;
+    board->simultaneous = meta.simultaneous;
+    memcpy(board->level_name, meta.level_name, sizeof(board->level_name));
+    memcpy(board->pacman_files, meta.pacman_files, sizeof(board->pacman_files));
+    memcpy(board->ghosts_files, meta.ghosts_files, sizeof(board->ghosts_files));
+    board->level_name[sizeof(board->level_name) - 1] = '\0';
+
+    board->pacmans = alloc_calloc(ALLOC_BOARD, MAX_PACMANS, sizeof(pacman_t));
+    board->ghosts = alloc_calloc(ALLOC_BOARD, MAX_GHOSTS, sizeof(ghost_t));
+    if (init_tiles(board) != 0 || !board->pacmans || !board->ghosts) goto done;
+    if (load_tiles(board, data, length, &at) != 0) goto done;
+    const unsigned char* records = take(data, length, &at, (meta.n_pacmans + meta.n_ghosts) * sizeof(checkpoint_entity_t));
+    if (!records) goto done;
+
+    for (int e = 0; e < meta.n_pacmans + meta.n_ghosts; e++) {
+        checkpoint_entity_t entity;
+        memcpy(&entity, records + e * sizeof(entity), sizeof(entity));
+        const unsigned char* code = take(data, length, &at, entity.program_size > 0 ? entity.program_size : 0);
+        if (!valid_entity(&entity, &meta) || !code) goto done;
+        program_t* program = entity.program_size > 0 ? behavior_from_code(code, entity.program_size) : NULL;
+        if (entity.program_size > 0 && !program) goto done;
+
+        if (e < meta.n_pacmans) {
+            pacman_t* pac = &board->pacmans[e];
+            pac->pos_x = entity.pos_x;
+            pac->pos_y = entity.pos_y;
+            pac->alive = entity.alive;
+            pac->points = entity.points;
+            pac->passo = entity.passo;
+            pac->wake = entity.wake;
+            pac->behavior = entity.behavior;
+            pac->program = program;
+        }
+        else {
+            ghost_t* ghost = &board->ghosts[e - meta.n_pacmans];
+            ghost->pos_x = entity.pos_x;
+            ghost->pos_y = entity.pos_y;
+            ghost->passo = entity.passo;
+            ghost->charged = entity.charged;
+            ghost->wake = entity.wake;
+            ghost->behavior = entity.behavior;
+            ghost->program = program;
+        }
+    }
+
+    // What is derived from the cells is rebuilt, the visits came with the tiles and the initial dots cannot be
+    if (place_pacmans(board) != 0 || init_progress(board) != 0) goto done;
+    board->dots_total = meta.dots_total;
+    schedule_ghosts(board);
+    *level_index = header.level_index;
+    result = 0;
+
+done:
+    munmap((void*) data, length);
+    if (result != 0) {
+        if (board->chunks && board->pacmans && board->ghosts) {
+            unload_level(board);
+        }
+        else {
+            release_tiles(board);
+            alloc_free(board->pacmans);
+            alloc_free(board->ghosts);
+        }
+        memset(board, 0, sizeof(*board));
+    }
+    return result;
+}
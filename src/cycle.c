@@ -0,0 +1,45 @@
+#include "cycle.h"
+#include <string.h>
+
+static int skipping = 1;
+
+void cycle_init(cycle_t* cycle) {
+    memset(cycle, 0, sizeof(*cycle));
+}
+
+// Helper private function: the window starts over at 'board', twice as long as the last one
+static void save(cycle_t* cycle, const board_t* board) {
+    cycle_release(cycle);
+    if (clone_board(&cycle->saved, board) != 0) return; // out of memory: no cycle will be found
+    cycle->has_saved = 1;
+    cycle->digest = course_digest(board);
+    cycle->window = cycle->window > 0 ? cycle->window * 2 : 1;
+    cycle->plays = 0;
+}
+
+long cycle_check(cycle_t* cycle, const board_t* board) {
+    if (!course_repeats(board)) return 0;
+    if (!cycle->has_saved) {
+        if (cycle->window == 0) save(cycle, board);
+        return 0;
+    }
+    cycle->plays++;
+    if (course_digest(board) == cycle->digest && same_course(&cycle->saved, board)) {
+        return board->tick - cycle->saved.tick;
+    }
+    if (cycle->plays == cycle->window) save(cycle, board);
+    return 0;
+}
+
+void cycle_release(cycle_t* cycle) {
+    if (cycle->has_saved) unload_level(&cycle->saved);
+    cycle->has_saved = 0;
+}
+
+void cycle_set_skipping(int skip) {
+    skipping = skip;
+}
+
+int cycle_skipping(void) {
+    return skipping;
+}
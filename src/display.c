@@ -1,10 +1,70 @@
 #include "display.h"
 #include "board.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "alloc.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
 
+static int backend = DISPLAY_NCURSES;
+static int input_delay = -1; // for the ANSI backend, ncurses keeps its own
+
+void set_display_backend(int display_backend)
+{
+    backend = display_backend;
+}
+
+// Helper private functions that send the drawing to the selected backend
+
+static int screen_rows()
+{
+    return backend == DISPLAY_ANSI ? fb_rows() : LINES;
+}
+
+static int screen_cols()
+{
+    return backend == DISPLAY_ANSI ? fb_cols() : COLS;
+}
+
+static void put_cell(int row, int col, char ch, int colour, int attrs)
+{
+    if (backend == DISPLAY_ANSI)
+    {
+        fb_put(row, col, ch, colour, attrs);
+        return;
+    }
+    chtype curses_attrs = COLOR_PAIR(colour);
+    if (attrs & FB_BOLD)
+        curses_attrs |= A_BOLD;
+    if (attrs & FB_DIM)
+        curses_attrs |= A_DIM;
+    if (attrs & FB_REVERSE)
+        curses_attrs |= A_REVERSE;
+    mvaddch(row, col, (chtype)(unsigned char)ch | curses_attrs);
+}
+
+static void put_text(int row, int col, int colour, const char *format, ...)
+{
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    for (int i = 0; text[i] != '\0' && col + i < screen_cols(); i++)
+        put_cell(row, col + i, text[i], colour, 0);
+}
+
 int terminal_init()
 {
+    if (backend == DISPLAY_ANSI)
+        return fb_init();
+
+    // What ncurses allocates from here on counts as the display's (see alloc.h)
+    alloc_subsystem_t charged = alloc_charge(ALLOC_DISPLAY);
+
     // Initialize ncurses mode
     initscr();
 
@@ -41,120 +101,266 @@ int terminal_init()
     // Clear the screen
     clear();
 
+    // The first refresh after a clear redraws everything, the ones after it allocate what ncurses keeps to
+    // compare frames: both happen here, before any play
+    refresh();
+    refresh();
+
+    alloc_charge(charged);
     return 0;
 }
 
-void draw_board(board_t *board, int mode)
+// Viewport state, kept between frames so the view only scrolls when pacman gets near an edge
+static int view_x = 0, view_y = 0;
+static int margin_x = VIEW_MARGIN, margin_y = VIEW_MARGIN;
+static int minimap_enabled = 0;
+
+void set_view_margins(int horizontal, int vertical)
 {
-    // Clear the screen before redrawing
-    clear();
+    margin_x = horizontal > 0 ? horizontal : 0;
+    margin_y = vertical > 0 ? vertical : 0;
+}
 
-    // Draw the border/title
-    attron(COLOR_PAIR(5));
-    mvprintw(0, 0, "=== PACMAN GAME ===");
-    switch (mode)
+void set_minimap(int enabled)
+{
+    minimap_enabled = enabled;
+}
+
+// Heatmap overlay, with the largest counts the digits are scaled to
+static const heatmap_t *heat_overlay = NULL;
+static uint64_t heat_max_pacman = 0, heat_max_ghosts = 0;
+
+void set_heatmap(const heatmap_t *heat)
+{
+    heat_overlay = heat;
+    heat_max_pacman = heat_max_ghosts = 0;
+    for (long i = 0; heat && i < (long)heat->width * heat->height; i++)
     {
-    case DRAW_GAME_OVER:
-        mvprintw(1, 0, " GAME OVER ");
+        if (heat->pacman[i] > heat_max_pacman)
+            heat_max_pacman = heat->pacman[i];
+        if (heat->ghosts[i] > heat_max_ghosts)
+            heat_max_ghosts = heat->ghosts[i];
+    }
+}
+
+// Helper private function: the digit of 'count' out of 'max', by their number of bits
+static char heat_digit(uint64_t count, uint64_t max)
+{
+    int bits = 64 - __builtin_clzll(count);
+    int max_bits = 64 - __builtin_clzll(max);
+    return (char)('1' + 8 * (bits - 1) / (max_bits > 1 ? max_bits - 1 : 1));
+}
+
+// Helper private function: draws the heatmap on the free cell (x, y), if it has any count
+// Returns whether it drew something
+static int draw_heat(const board_t *board, int x, int y, int row, int col)
+{
+    if (!heat_overlay || heat_overlay->width != board->width || heat_overlay->height != board->height)
+        return 0;
+    long cell = (long)y * board->width + x;
+    if (heat_overlay->deaths[cell])
+        put_cell(row, col, 'x', 2, FB_BOLD);
+    else if (heat_overlay->pacman[cell])
+        put_cell(row, col, heat_digit(heat_overlay->pacman[cell], heat_max_pacman), 1, 0);
+    else if (heat_overlay->ghosts[cell])
+        put_cell(row, col, heat_digit(heat_overlay->ghosts[cell], heat_max_ghosts), 7, FB_DIM);
+    else
+        return 0;
+    return 1;
+}
+
+// Moves the view origin along one axis so that 'pos' stays at least 'margin' cells from both edges
+static void follow(int pos, int size, int view, int margin, int *origin)
+{
+    if (margin > (view - 1) / 2)
+        margin = (view - 1) / 2;
+
+    if (pos < *origin + margin)
+        *origin = pos - margin;
+    if (pos > *origin + view - 1 - margin)
+        *origin = pos - (view - 1 - margin);
+
+    if (*origin > size - view)
+        *origin = size - view;
+    if (*origin < 0)
+        *origin = 0;
+}
+
+// Draws the cell (x, y) of the board at (row, col) of the screen
+static void draw_cell(const board_t *board, int x, int y, int row, int col)
+{
+    const board_pos_t *cell = board_cell(board, x, y);
+    char ch = cell->content;
+
+    // Draw with appropriate color
+    switch (ch)
+    {
+    case 'W': // Wall
+        put_cell(row, col, '#', 3, 0);
         break;
 
-    case DRAW_WIN:
-        mvprintw(1, 0, " VICTORY ");
+    case 'P': // Pacman
+        put_cell(row, col, 'C', 1, FB_BOLD);
         break;
 
-    case DRAW_MENU:
-        mvprintw(1, 0, "Level: %s | Use W/A/S/D to move | Q to quit | G to quicksave ", board->level_name);
+    case 'M': // Monster/Ghost
+    {
+        int ghost_charged = 0;
+        for (int g = 0; g < board->n_ghosts; g++)
+        {
+            const ghost_t *ghost = &board->ghosts[g];
+            if (ghost->pos_x == x && ghost->pos_y == y)
+            {
+                if (ghost->charged)
+                    ghost_charged = 1;
+                break;
+            }
+        }
+        put_cell(row, col, 'M', 2, FB_BOLD | (ghost_charged ? FB_DIM : 0));
         break;
     }
 
-    // Starting row for the game board (leave space for UI)
-    int start_row = 3;
+    case ' ': // Empty space
+        if (cell->has_portal)
+            put_cell(row, col, '@', 6, 0);
+        else if (draw_heat(board, x, y, row, col))
+            break;
+        else if (cell->has_dot)
+            put_cell(row, col, '.', 4, 0);
+        else
+            put_cell(row, col, ' ', 0, 0);
+        break;
+
+    default:
+        put_cell(row, col, ch, 0, 0);
+        break;
+    }
+}
 
-    // Draw the board
-    for (int y = 0; y < board->height; y++)
+// Draws a map_w x map_h downsampled copy of the whole board at (row, col), with the view highlighted
+// Each character samples the centre cell of its block, so the cost depends only on the minimap size
+static void draw_minimap(const board_t *board, int row, int col, int map_w, int map_h, int view_w, int view_h)
+{
+    for (int my = 0; my < map_h; my++)
     {
-        for (int x = 0; x < board->width; x++)
+        int y0 = my * board->height / map_h;
+        int y1 = (my + 1) * board->height / map_h;
+        for (int mx = 0; mx < map_w; mx++)
         {
-            int index = y * board->width + x;
-            char ch = board->board[index].content;
-            int ghost_charged = 0;
+            int x0 = mx * board->width / map_w;
+            int x1 = (mx + 1) * board->width / map_w;
+            const board_pos_t *pos = board_cell(board, (x0 + x1) / 2, (y0 + y1) / 2);
 
-            for (int g = 0; g < board->n_ghosts; g++)
-            {
-                ghost_t *ghost = &board->ghosts[g];
-                if (ghost->pos_x == x && ghost->pos_y == y)
-                {
-                    if (ghost->charged)
-                        ghost_charged = 1;
-                    break;
-                }
-            }
+            int in_view = x1 > view_x && x0 < view_x + view_w && y1 > view_y && y0 < view_y + view_h;
+            int colour = pos->content == 'W' ? 3 : 4;
+            char ch = pos->content == 'W' ? '#' : (pos->has_dot ? '.' : ' ');
 
-            // Move cursor to position
-            move(start_row + y, x);
+            put_cell(row + my, col + mx, ch, colour, in_view ? FB_REVERSE : 0);
+        }
+    }
 
-            // Draw with appropriate color
-            switch (ch)
-            {
-            case 'W': // Wall
-                attron(COLOR_PAIR(3));
-                addch('#');
-                attroff(COLOR_PAIR(3));
-                break;
+    // Entities are placed from their positions, not from the sampled cells
+    for (int g = 0; g < board->n_ghosts; g++)
+    {
+        const ghost_t *ghost = &board->ghosts[g];
+        draw('M', 2, col + ghost->pos_x * map_w / board->width, row + ghost->pos_y * map_h / board->height);
+    }
+    for (int p = 0; p < board->n_pacmans; p++)
+    {
+        const pacman_t *pac = &board->pacmans[p];
+        if (pac->alive)
+            draw('C', 1, col + pac->pos_x * map_w / board->width, row + pac->pos_y * map_h / board->height);
+    }
+}
 
-            case 'P': // Pacman
-                attron(COLOR_PAIR(1) | A_BOLD);
-                addch('C');
-                attroff(COLOR_PAIR(1) | A_BOLD);
-                break;
+void draw_board(const board_t *board, int mode)
+{
+    // Blank the screen before redrawing, only the cells that changed are sent on refresh
+    if (backend == DISPLAY_ANSI)
+        fb_clear();
+    else
+        erase();
 
-            case 'M': // Monster/Ghost
-                attron((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
-                addch('M');
-                attroff((COLOR_PAIR(2) | A_BOLD) | ((ghost_charged) ? (A_DIM) : (0)));
-                break;
+    // Draw the border/title
+    put_text(0, 0, 5, "=== PACMAN GAME ===");
+    switch (mode)
+    {
+    case DRAW_GAME_OVER:
+        put_text(1, 0, 5, " GAME OVER ");
+        break;
 
-            case ' ': // Empty space
-                if (board->board[index].has_portal)
-                {
-                    attron(COLOR_PAIR(6));
-                    addch('@');
-                    attroff(COLOR_PAIR(6));
-                }
-                else if (board->board[index].has_dot)
-                {
-                    attron(COLOR_PAIR(4));
-                    addch('.');
-                    attroff(COLOR_PAIR(4));
-                }
-                else
-                    addch(' ');
-                break;
+    case DRAW_WIN:
+        put_text(1, 0, 5, " VICTORY ");
+        break;
 
-            default:
-                addch(ch);
-                break;
-            }
+    case DRAW_MENU:
+        put_text(1, 0, 5, "Level: %s | Use W/A/S/D to move | Q to quit | G to quicksave ", board->level_name);
+        break;
+    }
+
+    // Starting row for the game board (leave space for UI)
+    int start_row = 3;
+
+    // The view gets what the terminal has left after the UI lines (and the minimap, when shown)
+    int view_w = screen_cols();
+    int view_h = screen_rows() - start_row - 2;
+    int map_w = 0, map_h = 0;
+    if (minimap_enabled && (board->width > view_w || board->height > view_h))
+    {
+        map_w = board->width < MINIMAP_MAX_W ? board->width : MINIMAP_MAX_W;
+        map_h = board->height < MINIMAP_MAX_H ? board->height : MINIMAP_MAX_H;
+        if (map_h > view_h)
+            map_h = view_h;
+        view_w -= map_w + 1;
+    }
+    if (view_w > board->width)
+        view_w = board->width;
+    if (view_h > board->height)
+        view_h = board->height;
+    if (view_w < 1 || view_h < 1)
+        return; // terminal too small to show anything
+
+    // The view follows the player's pacman, or the first one still alive
+    const pacman_t *pac = &board->pacmans[0];
+    for (int p = 0; p < board->n_pacmans && !pac->alive; p++)
+        if (board->pacmans[p].alive)
+            pac = &board->pacmans[p];
+    follow(pac->pos_x, board->width, view_w, margin_x, &view_x);
+    follow(pac->pos_y, board->height, view_h, margin_y, &view_y);
+
+    // Draw only the cells inside the view
+    for (int y = 0; y < view_h; y++)
+    {
+        for (int x = 0; x < view_w; x++)
+        {
+            draw_cell(board, view_x + x, view_y + y, start_row + y, x);
         }
     }
 
+    if (map_w > 0 && map_h > 0)
+        draw_minimap(board, start_row, view_w + 1, map_w, map_h, view_w, view_h);
+
     // Draw score/status at the bottom
-    attron(COLOR_PAIR(5));
-    mvprintw(start_row + board->height + 1, 0, "Points: %d",
-             board->pacmans[0].points); // Assuming first pacman for now
-    attroff(COLOR_PAIR(5));
+    if (view_w < board->width || view_h < board->height)
+        put_text(start_row + view_h + 1, 0, 5, "Points: %d | Dots: %d/%d | View %d,%d of %dx%d", total_points(board),
+                 board->dots_left, board->dots_total, view_x, view_y, board->width, board->height);
+    else
+        put_text(start_row + view_h + 1, 0, 5, "Points: %d | Dots: %d/%d",
+                 total_points(board), board->dots_left, board->dots_total);
 }
 
 void draw(char c, int colour_i, int pos_x, int pos_y)
 {
-    move(pos_y, pos_x);
-    attron(COLOR_PAIR(colour_i) | A_BOLD);
-    addch(c);
-    attroff(COLOR_PAIR(colour_i) | A_BOLD);
+    put_cell(pos_y, pos_x, c, colour_i, FB_BOLD);
 }
 
 void refresh_screen()
 {
+    if (backend == DISPLAY_ANSI)
+    {
+        fb_flush();
+        return;
+    }
     // Update the physical screen with the virtual screen
     refresh();
 }
@@ -162,10 +368,10 @@ void refresh_screen()
 char get_input()
 {
     // Get a character from the keyboard
-    int ch = getch();
+    int ch = backend == DISPLAY_ANSI ? fb_read_key(input_delay) : getch();
 
     // getch() returns ERR if no input is available
-    if (ch == ERR)
+    if (ch == ERR || ch < 0)
     {
         return '\0'; // No input
     }
@@ -180,6 +386,7 @@ char get_input()
     case 'D':
     case 'Q':
     case 'G':
+    case 'Z':
 
         return (char)ch;
 
@@ -188,8 +395,23 @@ char get_input()
     }
 }
 
+void set_input_delay(int milliseconds)
+{
+    input_delay = milliseconds;
+    if (backend == DISPLAY_ANSI)
+        return;
+    // getch() returns ERR when the delay expires without input
+    timeout(milliseconds);
+}
+
 void terminal_cleanup()
 {
+    if (backend == DISPLAY_ANSI)
+    {
+        fb_cleanup();
+        return;
+    }
+
     // Restore terminal settings and clean up ncurses
     endwin();
 }
@@ -0,0 +1,285 @@
+#include "evolve.h"
+#include "behavior.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Score of one game, from the ghosts' side
+#define EVOLVE_KILL_BONUS 2     // times the plays of a game, for killing pacman (minus the plays it took)
+#define EVOLVE_PORTAL_PENALTY 1 // times the plays of a game, for letting pacman reach the portal
+
+static const char evolve_commands[] = "WASDWASDRCT"; // moves are drawn more often than R, C and T
+#define EVOLVE_MAX_WAIT 4   // longest T of an evolved script
+
+typedef struct {
+    ghost_script_t scripts[MAX_GHOSTS];
+    long fitness;
+    int order;  // position in the generation, breaks ties so the ranking does not depend on qsort
+} candidate_t;
+
+typedef struct {
+    const board_t* level;
+    const pacman_t* opponents;
+    int n_opponents;
+    const evolve_opts_t* opts;
+    candidate_t* population;
+    atomic_int next;
+    atomic_long simulations;
+} generation_job_t;
+
+void evolve_default_opts(evolve_opts_t* opts) {
+    opts->generations = EVOLVE_GENERATIONS;
+    opts->population = EVOLVE_POPULATION;
+    opts->plays = EVOLVE_PLAYS;
+    opts->n_threads = 0;
+    opts->seed = 1;
+}
+
+// Helper private function to compile a script into the bytecode a ghost runs
+static program_t* compile_script(const ghost_script_t* script) {
+    char text[EVOLVE_MAX_COMMANDS * 8 + 1];
+    int len = 0;
+    for (int i = 0; i < script->n_commands; i++) {
+        const command_t* command = &script->commands[i];
+        if (command->command == 'T') {
+            len += snprintf(text + len, sizeof(text) - len, "T %d\n", command->turns);
+        }
+        else {
+            len += snprintf(text + len, sizeof(text) - len, "%c\n", command->command);
+        }
+    }
+    return behavior_compile(text);
+}
+
+// Helper private function: plays one game of the level with the given ghost programs (NULL keeps the level's)
+// against 'opponent' and scores it
+static long play_game(const board_t* level, program_t* const* programs, const ghost_script_t* scripts,
+                      const pacman_t* opponent, const evolve_opts_t* opts) {
+    board_t board;
+    if (clone_board(&board, level) != 0) return LONG_MIN;
+    if (programs) {
+        for (int g = 0; g < board.n_ghosts; g++) {
+            ghost_t* ghost = &board.ghosts[g];
+            behavior_release(ghost->program);
+            ghost->program = behavior_retain(programs[g]);
+            ghost->passo = scripts[g].passo;
+            ghost->wake = 0;
+            ghost->charged = 0;
+            memset(&ghost->behavior, 0, sizeof(ghost->behavior));
+        }
+    }
+    pacman_t* pac = &board.pacmans[0];
+    behavior_release(pac->program);
+    pac->program = behavior_retain(opponent->program);
+    pac->passo = opponent->passo;
+    pac->wake = 0;
+    memset(&pac->behavior, 0, sizeof(pac->behavior));
+    board.seed = opts->seed;
+    schedule_ghosts(&board);
+
+    int result = VALID_MOVE;
+    while (board.tick < opts->plays) {
+        fast_forward(&board, opts->plays);
+        if (board.tick >= opts->plays) break;
+        result = play_turn(&board, NULL);
+        if (result == REACHED_PORTAL || result == DEAD_PACMAN) break;
+    }
+
+    long score = -total_points(&board);
+    if (result == DEAD_PACMAN) score += (long) EVOLVE_KILL_BONUS * opts->plays - board.tick;
+    if (result == REACHED_PORTAL) score -= (long) EVOLVE_PORTAL_PENALTY * opts->plays;
+    unload_level(&board);
+    return score;
+}
+
+// Helper private function: fitness of a candidate, the sum of its games against every opponent
+static long score_candidate(generation_job_t* job, const ghost_script_t* scripts) {
+    int n_ghosts = job->level->n_ghosts;
+    program_t* programs[MAX_GHOSTS];
+    for (int g = 0; g < n_ghosts; g++) programs[g] = scripts ? compile_script(&scripts[g]) : NULL;
+
+    long fitness = 0;
+    for (int o = 0; o < job->n_opponents && fitness != LONG_MIN; o++) {
+        long score = play_game(job->level, scripts ? programs : NULL, scripts, &job->opponents[o], job->opts);
+        fitness = score == LONG_MIN ? LONG_MIN : fitness + score;
+    }
+    atomic_fetch_add(&job->simulations, job->n_opponents);
+    for (int g = 0; g < n_ghosts; g++) behavior_release(programs[g]);
+    return fitness;
+}
+
+// Helper private function run by every thread: scores the candidates of the generation, one at a time
+static void* score_worker(void* arg) {
+    generation_job_t* job = arg;
+    mute_debug(1);
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->opts->population) {
+        job->population[i].fitness = score_candidate(job, job->population[i].scripts);
+    }
+    mute_debug(0);
+    return NULL;
+}
+
+// Helper private function to score a whole generation on 'n_threads' threads
+static void score_generation(generation_job_t* job, int n_threads) {
+    atomic_store(&job->next, 0);
+    pthread_t threads[n_threads];
+    int started[n_threads];
+    for (int t = 1; t < n_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, score_worker, job) == 0;
+    }
+    score_worker(job); // the calling thread scores too
+    for (int t = 1; t < n_threads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+// Helper private function to order candidates from the best, ties by their position
+static int compare_candidates(const void* a, const void* b) {
+    const candidate_t* x = a;
+    const candidate_t* y = b;
+    if (x->fitness != y->fitness) return x->fitness > y->fitness ? -1 : 1;
+    return x->order - y->order;
+}
+
+// Helper private function for a random command of an evolved script
+static command_t random_command(unsigned int* seed) {
+    command_t command;
+    command.command = evolve_commands[rand_r(seed) % (sizeof(evolve_commands) - 1)];
+    command.turns = command.command == 'T' ? 1 + rand_r(seed) % EVOLVE_MAX_WAIT : 1;
+    return command;
+}
+
+// Helper private function for a random script, as the first generation has
+static void random_script(ghost_script_t* script, unsigned int* seed) {
+    script->passo = rand_r(seed) % (EVOLVE_MAX_PASSO + 1);
+    script->n_commands = 4 + rand_r(seed) % (EVOLVE_MAX_COMMANDS / 2 - 3);
+    for (int i = 0; i < script->n_commands; i++) script->commands[i] = random_command(seed);
+}
+
+// Helper private function to change one thing in the script of one ghost
+static void mutate(ghost_script_t* scripts, int n_ghosts, unsigned int* seed) {
+    ghost_script_t* script = &scripts[rand_r(seed) % n_ghosts];
+    int at = rand_r(seed) % script->n_commands;
+    switch (rand_r(seed) % 5) {
+        case 0: // replace a command
+            script->commands[at] = random_command(seed);
+            break;
+        case 1: // insert a command
+            if (script->n_commands < EVOLVE_MAX_COMMANDS) {
+                memmove(&script->commands[at + 1], &script->commands[at], (script->n_commands - at) * sizeof(command_t));
+                script->commands[at] = random_command(seed);
+                script->n_commands++;
+            }
+            break;
+        case 2: // delete a command
+            if (script->n_commands > 1) {
+                memmove(&script->commands[at], &script->commands[at + 1], (script->n_commands - at - 1) * sizeof(command_t));
+                script->n_commands--;
+            }
+            break;
+        case 3: // another PASSO
+            script->passo = rand_r(seed) % (EVOLVE_MAX_PASSO + 1);
+            break;
+        default: { // swap two commands
+            int other = rand_r(seed) % script->n_commands;
+            command_t tmp = script->commands[at];
+            script->commands[at] = script->commands[other];
+            script->commands[other] = tmp;
+            break;
+        }
+    }
+}
+
+// Helper private function: the best of a few candidates drawn at random from the ranked generation
+static const candidate_t* tournament(const candidate_t* ranked, int n, unsigned int* seed) {
+    int best = rand_r(seed) % n;
+    for (int i = 1; i < EVOLVE_TOURNAMENT; i++) {
+        int other = rand_r(seed) % n;
+        if (other < best) best = other; // ranked from the best, a lower index is a fitter candidate
+    }
+    return &ranked[best];
+}
+
+int evolve_ghosts(const board_t* level, const pacman_t* opponents, int n_opponents, const evolve_opts_t* opts,
+                  evolve_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    int n = opts->population > EVOLVE_ELITE ? opts->population : EVOLVE_ELITE + 1;
+    int n_ghosts = level->n_ghosts;
+    evolve_opts_t run = *opts;
+    run.population = n;
+
+    generation_job_t job = {.level = level, .opponents = opponents, .n_opponents = n_opponents, .opts = &run};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.simulations, 0);
+    candidate_t* population = malloc(n * sizeof(candidate_t));
+    candidate_t* next = malloc(n * sizeof(candidate_t));
+    if (!population || !next) {
+        free(population);
+        free(next);
+        return -1;
+    }
+    job.population = population;
+
+    int n_threads = opts->n_threads;
+    if (n_threads <= 0) n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > n) n_threads = n;
+    if (n_threads < 1) n_threads = 1;
+
+    result->original = score_candidate(&job, NULL);
+    if (n_ghosts == 0 || n_opponents == 0) {
+        result->fitness = result->original;
+        result->simulations = atomic_load(&job.simulations);
+        free(population);
+        free(next);
+        return 0;
+    }
+
+    unsigned int seed = opts->seed;
+    for (int i = 0; i < n; i++) {
+        for (int g = 0; g < n_ghosts; g++) random_script(&population[i].scripts[g], &seed);
+    }
+
+    for (int generation = 0;; generation++) {
+        score_generation(&job, n_threads);
+        for (int i = 0; i < n; i++) population[i].order = i;
+        qsort(population, n, sizeof(candidate_t), compare_candidates);
+        if (generation + 1 >= opts->generations) break;
+
+        // The best go on as they are, the rest are children of tournament winners
+        memcpy(next, population, EVOLVE_ELITE * sizeof(candidate_t));
+        for (int i = EVOLVE_ELITE; i < n; i++) {
+            const candidate_t* a = tournament(population, n, &seed);
+            const candidate_t* b = tournament(population, n, &seed);
+            for (int g = 0; g < n_ghosts; g++) next[i].scripts[g] = (rand_r(&seed) & 1) ? a->scripts[g] : b->scripts[g];
+            int mutations = 1 + rand_r(&seed) % 3;
+            for (int m = 0; m < mutations; m++) mutate(next[i].scripts, n_ghosts, &seed);
+        }
+        candidate_t* swap = population;
+        population = job.population = next;
+        next = swap;
+    }
+
+    memcpy(result->scripts, population[0].scripts, n_ghosts * sizeof(ghost_script_t));
+    result->fitness = population[0].fitness;
+    result->simulations = atomic_load(&job.simulations);
+    free(population);
+    free(next);
+    return 0;
+}
+
+int write_ghost_script(FILE* file, const ghost_script_t* script, const ghost_t* ghost) {
+    fprintf(file, "PASSO %d\nPOS %d %d\n", script->passo, ghost->pos_y, ghost->pos_x);
+    for (int i = 0; i < script->n_commands; i++) {
+        if (script->commands[i].command == 'T') {
+            fprintf(file, "T %d\n", script->commands[i].turns);
+        }
+        else {
+            fprintf(file, "%c\n", script->commands[i].command);
+        }
+    }
+    return ferror(file) ? -1 : 0;
+}
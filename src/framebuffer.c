@@ -0,0 +1,180 @@
+#include "framebuffer.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+static struct termios saved_termios;
+static int rows = 0, cols = 0;
+static fb_cell_t* back = NULL;  // frame being composed
+static fb_cell_t* front = NULL; // what the terminal shows
+static char* out = NULL;        // escape stream of one frame
+static size_t out_len = 0, out_cap = 0;
+
+// Foreground colour of each pair, as in terminal_init: none, yellow, red, blue, white, green, magenta, cyan
+static const int pair_foreground[8] = {39, 33, 31, 34, 37, 32, 35, 36};
+
+// Helper private function to (re)size the buffers to the terminal, forcing a full redraw
+static int fb_resize() {
+    struct winsize ws;
+    int new_rows = 24, new_cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        new_rows = ws.ws_row;
+        new_cols = ws.ws_col;
+    }
+    if (new_rows == rows && new_cols == cols && back) return 0;
+
+    fb_cell_t* new_back = alloc_calloc(ALLOC_DISPLAY, (size_t) new_rows * new_cols, sizeof(fb_cell_t));
+    fb_cell_t* new_front = alloc_calloc(ALLOC_DISPLAY, (size_t) new_rows * new_cols, sizeof(fb_cell_t));
+    if (!new_back || !new_front) {
+        alloc_free(new_back);
+        alloc_free(new_front);
+        return -1;
+    }
+    alloc_free(back);
+    alloc_free(front);
+    back = new_back;
+    front = new_front;
+    rows = new_rows;
+    cols = new_cols;
+
+    // The terminal is cleared below, front holds '\0' cells so that every cell is sent again
+    fb_clear();
+    const char* clear = "\x1b[0m\x1b[2J";
+    if (write(STDOUT_FILENO, clear, strlen(clear)) < 0) return -1;
+    return 0;
+}
+
+int fb_init() {
+    if (tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+        struct termios raw = saved_termios;
+        raw.c_lflag &= ~(ECHO | ICANON); // keys arrive one at a time, ctrl-c still works
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+
+    // Alternate screen and hidden cursor, as ncurses does
+    const char* enter = "\x1b[?1049h\x1b[?25l";
+    if (write(STDOUT_FILENO, enter, strlen(enter)) < 0) return -1;
+    return fb_resize();
+}
+
+void fb_cleanup() {
+    const char* leave = "\x1b[0m\x1b[?25h\x1b[?1049l";
+    if (write(STDOUT_FILENO, leave, strlen(leave)) < 0) {
+        // nothing left to do about it
+    }
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    alloc_free(back);
+    alloc_free(front);
+    alloc_free(out);
+    back = front = NULL;
+    out = NULL;
+    out_len = out_cap = 0;
+    rows = cols = 0;
+}
+
+void fb_clear() {
+    for (int i = 0; i < rows * cols; i++) {
+        back[i].ch = ' ';
+        back[i].colour = 0;
+        back[i].attrs = 0;
+    }
+}
+
+void fb_put(int row, int col, char ch, int colour, int attrs) {
+    if (row < 0 || row >= rows || col < 0 || col >= cols) return;
+    fb_cell_t* cell = &back[row * cols + col];
+    cell->ch = ch;
+    cell->colour = (unsigned char) colour;
+    cell->attrs = (unsigned char) attrs;
+}
+
+int fb_rows() {
+    return rows;
+}
+
+int fb_cols() {
+    return cols;
+}
+
+// Helper private function to append to the escape stream
+static int out_put(const char* data, size_t len) {
+    if (out_len + len > out_cap) {
+        size_t cap = out_cap ? out_cap * 2 : 4096;
+        while (cap < out_len + len) cap *= 2;
+        char* grown = alloc_realloc(ALLOC_DISPLAY, out, cap);
+        if (!grown) return -1;
+        out = grown;
+        out_cap = cap;
+    }
+    memcpy(out + out_len, data, len);
+    out_len += len;
+    return 0;
+}
+
+long fb_flush() {
+    int cursor_row = -1, cursor_col = -1;
+    int sgr_colour = -1, sgr_attrs = -1; // unknown until the first cell of the frame
+    char seq[64];
+    out_len = 0;
+
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            fb_cell_t* b = &back[row * cols + col];
+            fb_cell_t* f = &front[row * cols + col];
+            if (b->ch == f->ch && b->colour == f->colour && b->attrs == f->attrs) continue;
+
+            if (row != cursor_row || col != cursor_col) {
+                int n = snprintf(seq, sizeof(seq), "\x1b[%d;%dH", row + 1, col + 1);
+                if (out_put(seq, n) != 0) return -1;
+            }
+            if (b->colour != sgr_colour || b->attrs != sgr_attrs) {
+                int n = snprintf(seq, sizeof(seq), "\x1b[0%s%s%s;%d;40m",
+                                 (b->attrs & FB_BOLD) ? ";1" : "", (b->attrs & FB_DIM) ? ";2" : "",
+                                 (b->attrs & FB_REVERSE) ? ";7" : "", pair_foreground[b->colour & 7]);
+                if (out_put(seq, n) != 0) return -1;
+                sgr_colour = b->colour;
+                sgr_attrs = b->attrs;
+            }
+            if (out_put(&b->ch, 1) != 0) return -1;
+            *f = *b;
+            cursor_row = row;
+            cursor_col = col + 1;
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out + sent, out_len - sent);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        sent += n;
+    }
+
+    // Pick up terminal resizes for the next frame
+    if (fb_resize() != 0) return -1;
+    return (long) out_len;
+}
+
+int fb_read_key(int milliseconds) {
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    if (poll(&pfd, 1, milliseconds) <= 0) return -1;
+
+    unsigned char c;
+    if (read(STDIN_FILENO, &c, 1) != 1) return -1;
+    if (c == 0x1b) {
+        // Escape sequence (arrows, function keys): drop the rest of it, these keys are not used
+        unsigned char rest[16];
+        while (poll(&pfd, 1, 0) > 0 && read(STDIN_FILENO, rest, sizeof(rest)) > 0) {
+        }
+        return -1;
+    }
+    return c;
+}
@@ -1,5 +1,20 @@
 #include "board.h"
 #include "display.h"
+#include "solver.h"
+#include "server.h"
+#include "shared.h"
+#include "watch.h"
+#include "pack.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "journal.h"
+#include "evolve.h"
+#include "behavior.h"
+#include "lockstep.h"
+#include "placement.h"
+#include "heatmap.h"
+#include "cycle.h"
+#include "alloc.h"
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
@@ -7,9 +22,13 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
-#include "parser.c"
+#include <ctype.h>
+#include "parser.h"
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define CONTINUE_PLAY 0
 #define NEXT_LEVEL 1
@@ -17,25 +36,164 @@
 #define LOAD_BACKUP 3
 #define CREATE_BACKUP 4
 
+#define CHECKPOINT_PLAYS 50 // jogadas entre dois checkpoints, com -K
+#define JOURNAL_BYTES (4 << 20) // memória do jornal de -J, o máximo guardado seja qual for o nível
+
 static int backup_exists = 0; // 0 -> não há backup; 1 -> já há backup
 
+// Plano calculado pelo solver quando o pacman joga sozinho (-a)
+static char *autoplay_moves = NULL;
+static int autoplay_next = 0;
+
+// Modo -S: o tabuleiro é publicado em memória partilhada e as teclas chegam por um FIFO
+static shared_board_t *shared_board = NULL;
+static int input_fifo = -1;
+
+// Modo -R: inotify sobre a diretoria dos níveis, -1 se desligado
+static int watch_fd = -1;
+
+// Modo -K: ficheiro onde o jogo é guardado, NULL se desligado
+static const char *checkpoint_path = NULL;
+
+// Modo -W: com -G, o ficheiro de referência é escrito com esta corrida em vez de comparado com ela
+static bool golden_record = false;
+#define GOLDEN_LINE 320 // de cada nível no ficheiro de referência
+
+// Modo -Y: ficheiro dos mapas de calor, escrito por -F e mostrado por cima do jogo, NULL se desligado
+static const char *heatmap_path = NULL;
+#define WATCH_INPUT_MS 10 // espera máxima por uma tecla, para as alterações serem vistas logo
+
+#define SIMULATE_SEED 1 // semente dos níveis jogados com -F, para que cada corrida dê o mesmo resultado
+
+// O ecrã e o observador (-O) leem cópias publicadas do tabuleiro, nunca o que a simulação está a alterar
+static snapshot_board_t snapshots;
+static int screen_reader = -1;
+
+// Modo -O: thread que regista num ficheiro cada cópia publicada, sem nunca atrasar o jogo
+static FILE *observer_file = NULL;
+static pthread_t observer_thread;
+static atomic_bool observer_stop;
+#define OBSERVER_POLL_MS 5 // espera entre olhadelas quando não há cópia nova
+
+void show_board(board_t *game_board, int mode)
+{
+    int published = snapshot_publish(&snapshots, game_board, mode) == 0;
+    if (shared_board)
+    {
+        if (shared_publish(shared_board, game_board, mode) != 0)
+            debug("Board %dx%d does not fit in shared memory\n", game_board->width, game_board->height);
+        return;
+    }
+
+    // O que o ncurses aloca ao desenhar conta como do ecrã (ver alloc.h)
+    alloc_subsystem_t charged = alloc_charge(ALLOC_DISPLAY);
+    const snapshot_t *frame = published && screen_reader >= 0 ? snapshot_acquire(&snapshots, screen_reader) : NULL;
+    if (frame)
+        draw_board(&frame->board, frame->mode);
+    else
+        draw_board(game_board, mode);
+    refresh_screen();
+    alloc_charge(charged);
+    if (frame)
+        snapshot_release(&snapshots, screen_reader);
+}
+
+// Helper private function: a linha do observador para uma cópia
+static void observe_frame(const snapshot_t *frame)
+{
+    const board_t *board = &frame->board;
+    fprintf(observer_file, "%lu %s tick %ld points %d dots %d/%d pacmans", frame->number, board->level_name,
+            board->tick, total_points(board), board->dots_left, board->dots_total);
+    for (int p = 0; p < board->n_pacmans; p++)
+        fprintf(observer_file, " %d,%d%s", board->pacmans[p].pos_y, board->pacmans[p].pos_x,
+                board->pacmans[p].alive ? "" : "x");
+    fputc('\n', observer_file);
+}
+
+// Helper private function corrida pela thread do observador
+static void *observe_game(void *arg)
+{
+    (void)arg;
+    int reader = snapshot_join(&snapshots);
+    if (reader < 0)
+        return NULL;
+
+    bool seen = false;
+    unsigned long last = 0;
+    bool stopping = false;
+    while (!stopping)
+    {
+        stopping = atomic_load(&observer_stop); // depois do pedido para parar ainda se lê a última cópia
+        const snapshot_t *frame = snapshot_acquire(&snapshots, reader);
+        bool fresh = frame && (!seen || frame->number != last);
+        if (fresh)
+        {
+            observe_frame(frame);
+            last = frame->number;
+            seen = true;
+        }
+        snapshot_release(&snapshots, reader);
+        if (!fresh && !stopping)
+            sleep_ms(OBSERVER_POLL_MS);
+    }
+    fflush(observer_file);
+    snapshot_leave(&snapshots, reader);
+    return NULL;
+}
+
 void screen_refresh(board_t *game_board, int mode)
 {
     debug("REFRESH\n");
-    draw_board(game_board, mode);
-    refresh_screen();
+    show_board(game_board, mode);
     if (game_board->tempo != 0)
-        sleep_ms(game_board->tempo);
+    {
+        // Com -R a espera acaba mais cedo se algum ficheiro mudar
+        if (watch_fd >= 0)
+            watch_wait(watch_fd, game_board->tempo);
+        else
+            sleep_ms(game_board->tempo);
+    }
+}
+
+char read_key()
+{
+    if (input_fifo < 0)
+        return get_input();
+
+    // Espera pela próxima tecla de um cliente, tal como o getch() bloqueante
+    char c;
+    ssize_t n;
+    while ((n = read(input_fifo, &c, 1)) < 0 && errno == EINTR)
+        ;
+    if (n != 1)
+        return 'Q';
+
+    c = (char)toupper(c);
+    return strchr("WSADQGZ", c) ? c : '\0';
+}
+
+// Modo -K: guarda o nível a ser jogado; uma falha só fica no debug, o jogo continua
+void save_checkpoint(const board_t *game_board, int level_idx)
+{
+    if (checkpoint_path && checkpoint_save(checkpoint_path, game_board, level_idx) != 0)
+        debug("CHECKPOINT %s: %s\n", checkpoint_path, strerror(errno));
 }
 
 int play_board(board_t *game_board)
 {
     pacman_t *pacman = &game_board->pacmans[0];
     command_t *play;
-    if (pacman->n_moves == 0)
+    if (!pacman->program && autoplay_moves && autoplay_moves[autoplay_next] != '\0')
+    { // jogada planeada pelo solver
+        static command_t c;
+        c.command = autoplay_moves[autoplay_next++];
+        c.turns = 1;
+        play = &c;
+    }
+    else if (!pacman->program)
     { // if is user input
         command_t c;
-        c.command = get_input();
+        c.command = read_key();
 
         // debug("RAW INPUT: %d ('%c')\n", (int)c.command, c.command); para debug
 
@@ -51,27 +209,34 @@ int play_board(board_t *game_board)
                 return CONTINUE_PLAY; // ignora se já houver backup
         }
 
+        if (c.command == 'Z')
+        {
+            // Volta uma jogada atrás, se o jornal (-J) ainda a tiver
+            if (rewind_plays(game_board, 1) > 0)
+                debug("REWIND tick %ld\n", game_board->tick);
+            return CONTINUE_PLAY;
+        }
+
         c.turns = 1;
         play = &c;
     }
     else
     {
-        // avoid buffer overflow wrapping around with modulo of n_moves
-        // this ensures that we always access a valid move for the pacman
-        play = &pacman->moves[pacman->current_move % pacman->n_moves];
-
-        // debug("PRE-DEFINED MOVE: %c (move %d/%d)\n",
-        //       play->command, pacman->current_move, pacman->n_moves);
+        // jogada pré-definida: move_pacman corre o programa do ficheiro .p
+        play = NULL;
     }
 
-    debug("KEY %c\n", play->command);
-
-    if (play->command == 'Q')
+    if (play)
     {
-        return QUIT_GAME;
+        debug("KEY %c\n", play->command);
+
+        if (play->command == 'Q')
+        {
+            return QUIT_GAME;
+        }
     }
 
-    int result = move_pacman(game_board, 0, play);
+    int result = play_turn(game_board, play);
     if (result == REACHED_PORTAL)
     {
         // Next level
@@ -83,84 +248,1277 @@ int play_board(board_t *game_board)
         return QUIT_GAME;
     }
 
-    for (int i = 0; i < game_board->n_ghosts; i++)
+    return CONTINUE_PLAY;
+}
+
+void print_usage(const char *program)
+{
+    printf("Usage: %s [options] <level_directory|level_pack|level.lvl>\n"
+           "  -a          pacman plays by itself, following the solver's plan\n"
+           "  -s          check every level with the solver and report, without the game\n"
+           "  -j threads  threads used by the solver and by -F (default: one per core)\n"
+           "  -w width    states kept by the solver on each play (default: %d)\n"
+           "  -H socket   host game sessions of the levels on a Unix-domain socket\n"
+           "  -L sessions with -H, run the stand-in client against that socket instead\n"
+           "  -k workers  threads playing the hosted sessions (default: %d)\n"
+           "  -S name     run the game without a screen, publishing it in shared memory as 'name'\n"
+           "  -C name     draw the game published as 'name' and send it the keys pressed\n"
+           "  -V name     only watch the game published as 'name'\n"
+           "  -m margin   cells kept between pacman and the edges of the view on large boards (default: %d)\n"
+           "  -M          show a minimap next to the view on large boards\n"
+           "  -b backend  draw with 'ncurses' (default) or 'ansi' (own frame buffer, one write per frame)\n"
+           "  -B frames   draw the first level 'frames' times with each backend and compare them\n"
+           "  -F plays    play every level headless for at most 'plays' plays, skipping those where nobody moves\n"
+           "  -x seed     with -F, the random seed every level starts from (default: %d)\n"
+           "  -G golden   with -F (and -N), compare the end of every level with the file 'golden' (fails if it is missing)\n"
+           "  -W          with -G, write the file 'golden' from this run instead of comparing with it\n"
+           "  -N runs     with -F, play every level 'runs' times from seeds -x, -x + 1, ... and sum up how they ended\n"
+           "  -D          with -N, play every run on a board of its own, also where the lockstep engine could\n"
+           "  -X          with -F, play every lap of a game that repeats itself instead of skipping them\n"
+           "  -Y file     with -F, write where pacman and the ghosts went and died to 'file'; else, show it over the game\n"
+           "  -U          with -F, pin each thread to a core and keep its boards on 2MB pages of its NUMA node\n"
+           "  -A          report what the parser, the board and the display allocated; fail if a play of the game did\n"
+           "  -R          reload level and behaviour files of the level being played when they change\n"
+           "  -P pack     write the levels of the directory, with their behaviour files, into a level pack\n"
+           "  -O file     log the boards shown to 'file' from a separate observer thread (the newest each time)\n"
+           "  -K file     keep a checkpoint of the game in 'file' and resume from it when started again\n"
+           "  -J plays    keep what the last 'plays' plays changed, so that Z steps back one play at a time\n"
+           "  -E dir      evolve the ghost scripts of every level against the .p scripts, best ones written to 'dir'/<level>\n"
+           "  -g gens     with -E, generations evolved (default: %d); -j and -x apply as with -F\n",
+           program, SOLVER_BEAM_WIDTH, SERVER_WORKERS, VIEW_MARGIN, SIMULATE_SEED, EVOLVE_GENERATIONS);
+}
+
+// Modo -A: mostra a memória alocada por cada subsistema e falha se alguma jogada alocou
+static int report_allocations(int status)
+{
+    alloc_report(stdout);
+    unsigned long long violations = alloc_violations();
+    if (violations > 0)
     {
-        ghost_t *ghost = &game_board->ghosts[i];
-        // avoid buffer overflow wrapping around with modulo of n_moves
-        // this ensures that we always access a valid move for the ghost
-        if (ghost->n_moves > 0)
+        fprintf(stderr, "Erro: %llu alocações de memória durante as jogadas\n", violations);
+        return 1;
+    }
+    return status;
+}
+
+// Modo -s: corre o solver em todos os níveis da diretoria e reporta se têm solução
+int solve_levels(const char *levels_path, const solver_opts_t *opts)
+{
+    level_set_t levels;
+    if (open_levels(levels_path, &levels) != 0)
+    {
+        fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
+        return 1;
+    }
+
+    int unsolved = 0;
+    for (int i = 0; i < levels.n_levels; i++)
+    {
+        board_t board;
+        if (load_level_at(&levels, i, &board) != 0)
         {
-            move_ghost(game_board, i, &ghost->moves[ghost->current_move % ghost->n_moves]);
+            unsolved++;
+            continue;
         }
+
+        struct timespec start, end;
+        solver_result_t result;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int status = solve_board(&board, opts, &result);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+        if (status != 0)
+        {
+            printf("%s: solver ran out of memory\n", board.level_name);
+            unsolved++;
+        }
+        else if (result.solved)
+        {
+            printf("%s: solvable in %d plays, %d points (%ld states, %ld ms)\n  plan: %s\n",
+                   board.level_name, result.ticks, result.points, result.explored, elapsed_ms, result.moves);
+        }
+        else if (result.ticks == 0)
+        {
+            printf("%s: NOT solvable, the portal cannot be reached\n", board.level_name);
+            unsolved++;
+        }
+        else
+        {
+            printf("%s: NOT solvable within %d plays (%ld states, %ld ms)\n",
+                   board.level_name, result.ticks, result.explored, elapsed_ms);
+            unsolved++;
+        }
+
+        solver_free_result(&result);
+        unload_level(&board);
     }
 
-    if (!game_board->pacmans[0].alive)
+    close_levels(&levels);
+    return unsolved > 0 ? 1 : 0;
+}
+
+// Modo -B: desenha o mesmo jogo com os dois backends e compara o tempo por frame
+int benchmark_display(const char *levels_path, int frames)
+{
+    level_set_t levels;
+    board_t level;
+
+    if (open_levels(levels_path, &levels) != 0)
     {
-        return QUIT_GAME;
+        fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
+        return 1;
     }
+    int loaded = load_level_at(&levels, 0, &level);
+    close_levels(&levels);
+    if (loaded != 0)
+        return 1;
 
-    return CONTINUE_PLAY;
+    const char *names[] = {"ncurses", "ansi"};
+    double us_per_frame[2];
+    for (int backend = DISPLAY_NCURSES; backend <= DISPLAY_ANSI; backend++)
+    {
+        // Os dois backends desenham exatamente a mesma sequência de tabuleiros
+        board_t board;
+        if (clone_board(&board, &level) != 0)
+            return 1;
+        set_display_backend(backend);
+        terminal_init();
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < frames; i++)
+        {
+            command_t idle = {.command = '\0', .turns = 1}; // só os monstros se mexem
+            int result = play_turn(&board, &idle);
+            if (result == DEAD_PACMAN || result == REACHED_PORTAL)
+            {
+                unload_level(&board);
+                clone_board(&board, &level);
+            }
+            draw_board(&board, DRAW_MENU);
+            refresh_screen();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        terminal_cleanup();
+        unload_level(&board);
+        us_per_frame[backend] = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / frames;
+    }
+    unload_level(&level);
+
+    for (int backend = DISPLAY_NCURSES; backend <= DISPLAY_ANSI; backend++)
+        printf("%-8s %10.1f us/frame\n", names[backend], us_per_frame[backend]);
+    return 0;
+}
+
+// Ciclo em que caiu um jogo sem ecrã, ver play_headless
+typedef struct
+{
+    long length;  // jogadas por volta, 0 se não caiu em nenhum
+    long from;    // jogada em que começou
+    long skipped; // jogadas saltadas por isso
+} headless_cycle_t;
+
+// Helper private function: joga 'board' até ao fim ou até à jogada max_plays, saltando as jogadas em que ninguém
+// se mexe. Se o jogo se repetir (ver cycle.h) salta as voltas inteiras que cabem até max_plays e joga só o resto,
+// pelo que acaba como se as tivesse jogado todas; com mapa de calor (ou -X) joga-as, para as contagens ficarem certas
+// Devolve o resultado da última jogada
+static int play_headless(board_t *board, long max_plays, long *played, headless_cycle_t *found)
+{
+    // Sem ficheiro .p o Pacman fica parado e só os monstros jogam
+    command_t idle = {.command = '\0', .turns = 1};
+    command_t *play = board->pacmans[0].program ? NULL : &idle;
+
+    cycle_t cycle;
+    cycle_init(&cycle);
+    memset(found, 0, sizeof(*found));
+    int result = VALID_MOVE;
+    while (board->tick < max_plays)
+    {
+        fast_forward(board, max_plays);
+        if (board->tick >= max_plays)
+            break;
+        result = play_turn(board, play);
+        if (played)
+            (*played)++;
+        if (result == REACHED_PORTAL || result == DEAD_PACMAN)
+            break;
+        if (!found->length && (found->length = cycle_check(&cycle, board)) > 0)
+        {
+            found->from = board->tick - found->length;
+            if (!board->heat && cycle_skipping())
+            {
+                found->skipped = (max_plays - board->tick) / found->length * found->length;
+                skip_plays(board, found->skipped);
+            }
+            cycle_release(&cycle);
+        }
+    }
+    cycle_release(&cycle);
+    return result;
+}
+
+// Resultado de um nível jogado sem ecrã (-F)
+typedef struct
+{
+    int loaded;
+    char level_name[256];
+    int result;
+    int cleared;
+    long tick, played, elapsed_us;
+    int points;
+    level_stats_t stats;
+    unsigned long digest;
+    heatmap_t *heat; // com -Y, onde os agentes andaram e o Pacman morreu
+    headless_cycle_t cycle;
+} simulation_t;
+
+// Níveis a jogar pelas threads de -F, cada uma tira o próximo da lista
+typedef struct
+{
+    level_set_t *levels;
+    long max_plays;
+    unsigned int seed;
+    simulation_t *results;
+    atomic_int next;
+    bool placed;                 // -U: threads pinned to cores, boards on huge pages local to each thread
+    atomic_int workers;          // threads started so far, each one's number in the placement
+    atomic_int pinned;           // of them, those pinned to a core
+    atomic_int counted;          // of them, those whose dTLB misses could be counted
+    atomic_ullong tlb_misses;
+} simulation_job_t;
+
+// Helper private function: joga um nível até ao fim ou até max_plays, saltando as jogadas em que ninguém se mexe
+static void simulate_level(simulation_job_t *job, int index, simulation_t *out)
+{
+    board_t board;
+    memset(out, 0, sizeof(*out));
+    if (load_level_at(job->levels, index, &board) != 0)
+        return;
+    board.seed = job->seed; // a mesma semente em todas as corridas, o resultado é sempre o mesmo
+    if (heatmap_path && (board.heat = heatmap_create(board.width, board.height)))
+        board.heat->runs = 1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = play_headless(&board, job->max_plays, &out->played, &out->cycle);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    out->loaded = 1;
+    snprintf(out->level_name, sizeof(out->level_name), "%s", board.level_name);
+    out->result = result;
+    level_stats(&board, &out->stats);
+    out->cleared = result == REACHED_PORTAL && board.clear_to_win && out->stats.dots_left == 0;
+    out->tick = board.tick;
+    out->points = total_points(&board);
+    out->digest = board_digest(&board);
+    out->heat = board.heat; // cada nível é jogado por uma só thread, que conta só no seu
+    out->elapsed_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    unload_level(&board);
+}
+
+// Helper private function corrida por cada thread de -F
+static void *simulate_worker(void *arg)
+{
+    simulation_job_t *job = arg;
+    mute_debug(1);
+    int worker = atomic_fetch_add(&job->workers, 1);
+    if (job->placed && placement_join(worker) >= 0)
+        atomic_fetch_add(&job->pinned, 1);
+    int counter = tlb_counter_open();
+    int index;
+    while ((index = atomic_fetch_add(&job->next, 1)) < job->levels->n_levels)
+    {
+        simulate_level(job, index, &job->results[index]);
+        placement_reset(); // o tabuleiro do nível já foi libertado
+    }
+    if (counter >= 0)
+    {
+        atomic_fetch_add(&job->tlb_misses, tlb_counter_close(counter));
+        atomic_fetch_add(&job->counted, 1);
+    }
+    return NULL;
+}
+
+// Helper private function: escreve no ficheiro de -Y o mapa de calor de cada nível jogado, somado ao que o ficheiro
+// já tinha para esse nível (de corridas anteriores). Os registos de níveis que não foram jogados passam tal e qual,
+// pela ordem em que estavam, e os de níveis novos vão para o fim. O ficheiro antigo é lido uma só vez e o novo
+// substitui-o de uma vez, por rename
+static int save_heatmaps(heatmap_t *const *heats, const char *const *names, int n)
+{
+    char temporary[512];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", heatmap_path);
+    FILE *file = fopen(temporary, "w");
+    bool *written = calloc(n > 0 ? n : 1, sizeof(bool));
+    if (!file || !written)
+    {
+        perror("Erro ao escrever o mapa de calor");
+        if (file)
+            fclose(file);
+        unlink(temporary);
+        free(written);
+        return -1;
+    }
+    int status = 0;
+    FILE *old = fopen(heatmap_path, "r");
+    if (old)
+    {
+        char name[HEATMAP_NAME];
+        heatmap_t *before;
+        while ((before = heatmap_read(old, name)) != NULL)
+        {
+            int i = 0;
+            while (i < n && (written[i] || !heats[i] || strcmp(names[i], name) != 0))
+                i++;
+            if (i == n)
+            {
+                if (heatmap_write(file, name, before) != 0)
+                    status = -1;
+            }
+            else
+            {
+                // Com outro tamanho o nível mudou, e as contagens antigas já não dizem respeito a estas células
+                if (before->width == heats[i]->width && before->height == heats[i]->height)
+                    heatmap_merge(heats[i], before);
+                if (heatmap_write(file, names[i], heats[i]) != 0)
+                    status = -1;
+                written[i] = true;
+            }
+            heatmap_free(before);
+        }
+        // Um registo que não se consegue ler (ou falta de memória) perderia os que vêm depois dele: fica o antigo
+        bool unreadable = !feof(old);
+        fclose(old);
+        if (unreadable)
+        {
+            fprintf(stderr, "Erro: não foi possível ler o mapa de calor %s até ao fim, não foi alterado\n", heatmap_path);
+            fclose(file);
+            unlink(temporary);
+            free(written);
+            return -1;
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (heats[i] && !written[i] && heatmap_write(file, names[i], heats[i]) != 0)
+            status = -1;
+    }
+    free(written);
+    if (fclose(file) != 0 || status != 0 || rename(temporary, heatmap_path) != 0)
+    {
+        perror("Erro ao escrever o mapa de calor");
+        unlink(temporary);
+        return -1;
+    }
+    printf("heatmap written to %s\n", heatmap_path);
+    return 0;
+}
+
+// Helper private function: como terminou um nível, numa palavra (a usada nos ficheiros de referência)
+static const char *simulation_outcome(const simulation_t *sim)
+{
+    return sim->cleared                     ? "cleared"
+           : sim->result == REACHED_PORTAL ? "portal"
+           : sim->result == DEAD_PACMAN    ? "dead"
+                                           : "playing";
+}
+
+// Helper private function: compara as linhas desta corrida (uma por nível, 'names') com o ficheiro de referência
+// ou, com -W, escreve-o com elas. Sem -W, um ficheiro que não existe é um erro: não há com que comparar a corrida
+// Devolve o número de linhas que não batem certo
+static int check_golden(const char *golden_path, const char (*lines)[GOLDEN_LINE], const char *const *names, int n)
+{
+    if (golden_record)
+    {
+        FILE *golden = fopen(golden_path, "w");
+        if (!golden)
+        {
+            perror("Erro ao escrever o ficheiro de referência");
+            return 1;
+        }
+        for (int i = 0; i < n; i++)
+            fputs(lines[i], golden);
+        if (fclose(golden) != 0)
+        {
+            perror("Erro ao escrever o ficheiro de referência");
+            return 1;
+        }
+        printf("golden results written to %s\n", golden_path);
+        return 0;
+    }
+
+    FILE *golden = fopen(golden_path, "r");
+    if (!golden)
+    {
+        if (errno == ENOENT)
+            fprintf(stderr, "Erro: o ficheiro de referência %s não existe (é escrito com -W)\n", golden_path);
+        else
+            perror("Erro ao abrir o ficheiro de referência");
+        return 1;
+    }
+
+    int mismatches = 0;
+    char expected[GOLDEN_LINE];
+    for (int i = 0; i < n; i++)
+    {
+        if (!fgets(expected, sizeof(expected), golden))
+            expected[0] = '\0';
+        if (strcmp(expected, lines[i]) != 0)
+        {
+            printf("MISMATCH %s\n  expected: %s  got:      %s", names[i], expected[0] ? expected : "(nothing)\n",
+                   lines[i]);
+            mismatches++;
+        }
+    }
+    if (fgets(expected, sizeof(expected), golden))
+    {
+        printf("MISMATCH the golden file has more levels than were played\n");
+        mismatches++;
+    }
+    fclose(golden);
+    printf("%d of %d levels match %s\n", n - mismatches, n, golden_path);
+    return mismatches;
+}
+
+// Modo -F: joga todos os níveis sem ecrã, em paralelo, e reporta (ou compara com -G) como terminaram
+// Com 'placed' (-U) cada thread fica presa a um core e os tabuleiros que joga vêm de páginas de 2MB do seu nó NUMA
+int simulate_levels(const char *levels_path, long max_plays, int n_threads, unsigned int seed, const char *golden_path,
+                    bool placed)
+{
+    level_set_t levels;
+    if (open_levels(levels_path, &levels) != 0)
+    {
+        fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
+        return 1;
+    }
+
+    simulation_job_t job = {.levels = &levels, .max_plays = max_plays, .seed = seed, .placed = placed};
+    job.results = calloc(levels.n_levels > 0 ? levels.n_levels : 1, sizeof(simulation_t));
+    if (!job.results)
+    {
+        close_levels(&levels);
+        return 1;
+    }
+    atomic_init(&job.next, 0);
+    atomic_init(&job.workers, 0);
+    atomic_init(&job.pinned, 0);
+    atomic_init(&job.counted, 0);
+    atomic_init(&job.tlb_misses, 0);
+
+    if (n_threads <= 0)
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > levels.n_levels)
+        n_threads = levels.n_levels;
+    if (n_threads < 1)
+        n_threads = 1;
+    placement_pages_t pages = placed ? placement_init(n_threads) : PAGES_NONE;
+    pthread_t threads[n_threads];
+    int started = 0;
+    for (int t = 1; t < n_threads; t++)
+        if (pthread_create(&threads[started], NULL, simulate_worker, &job) == 0)
+            started++;
+    simulate_worker(&job); // a thread principal também joga
+    for (int t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    mute_debug(0);
+    size_t placed_bytes = placement_used();
+    if (placed)
+        placement_end();
+
+    // Os resultados saem pela ordem dos níveis, seja qual for a thread que os jogou
+    for (int i = 0; i < levels.n_levels; i++)
+    {
+        const simulation_t *sim = &job.results[i];
+        if (!sim->loaded)
+            continue;
+        const char *outcome = sim->cleared                     ? "cleared every dot"
+                              : sim->result == REACHED_PORTAL ? "reached the portal"
+                              : sim->result == DEAD_PACMAN    ? "pacman died"
+                                                              : "still playing";
+        printf("%s: %s at play %ld, %d points (%ld plays simulated, %ld us)\n",
+               sim->level_name, outcome, sim->tick, sim->points, sim->played, sim->elapsed_us);
+        printf("  %d of %d dots left (%.0f%% cleared), %ld of %ld cells visited (%.0f%%), state %016lx\n",
+               sim->stats.dots_left, sim->stats.dots_total, sim->stats.cleared * 100, sim->stats.cells_visited,
+               sim->stats.open_cells, sim->stats.coverage * 100, sim->digest);
+        if (sim->cycle.length > 0)
+            printf("  repeats every %ld plays from play %ld, %ld plays skipped\n", sim->cycle.length,
+                   sim->cycle.from, sim->cycle.skipped);
+    }
+
+    // Com -U diz onde correu; as falhas de TLB (quando o kernel as deixa contar) comparam-se com uma corrida sem -U
+    long played = 0;
+    for (int i = 0; i < levels.n_levels; i++)
+        played += job.results[i].played;
+    if (placed)
+    {
+        const char *page_names[] = {"malloc'd memory", "4KB pages (huge pages refused)", "2MB hugetlbfs pages",
+                                    "2MB transparent huge pages"};
+        printf("placement: %d of %d threads pinned over %d NUMA node(s), boards on %s, %.1f MB used\n",
+               atomic_load(&job.pinned), atomic_load(&job.workers), placement_nodes(), page_names[pages],
+               placed_bytes / 1048576.0);
+    }
+    if (atomic_load(&job.counted) > 0)
+        printf("dTLB load misses: %llu (%.2f per play, %d of %d threads counted)\n", atomic_load(&job.tlb_misses),
+               played > 0 ? (double)atomic_load(&job.tlb_misses) / played : 0.0, atomic_load(&job.counted),
+               atomic_load(&job.workers));
+    else if (placed)
+        printf("dTLB load misses: not counted (perf events unavailable)\n");
+
+    int status = 0;
+    if (heatmap_path)
+    {
+        heatmap_t *heats[levels.n_levels > 0 ? levels.n_levels : 1];
+        const char *names[levels.n_levels > 0 ? levels.n_levels : 1];
+        for (int i = 0; i < levels.n_levels; i++)
+        {
+            heats[i] = job.results[i].heat;
+            names[i] = job.results[i].level_name;
+        }
+        if (save_heatmaps(heats, names, levels.n_levels) != 0)
+            status = 1;
+        for (int i = 0; i < levels.n_levels; i++)
+            heatmap_free(heats[i]);
+    }
+    if (golden_path)
+    {
+        // Uma linha por nível carregado: como terminou, jogada, pontos, pontos por comer e impressão digital
+        char(*lines)[GOLDEN_LINE] = malloc((levels.n_levels > 0 ? levels.n_levels : 1) * sizeof(*lines));
+        const char *names[levels.n_levels > 0 ? levels.n_levels : 1];
+        int n = 0;
+        for (int i = 0; lines && i < levels.n_levels; i++)
+        {
+            const simulation_t *sim = &job.results[i];
+            if (!sim->loaded)
+                continue;
+            snprintf(lines[n], GOLDEN_LINE, "%s %s %ld %d %d %016lx\n", sim->level_name, simulation_outcome(sim),
+                     sim->tick, sim->points, sim->stats.dots_left, sim->digest);
+            names[n++] = sim->level_name;
+        }
+        if (!lines || check_golden(golden_path, (const char(*)[GOLDEN_LINE])lines, names, n) != 0)
+            status = 1;
+        free(lines);
+    }
+    free(job.results);
+    close_levels(&levels);
+    return status;
+}
+
+// Helper private function: joga uma cópia de 'level' com a semente 'seed', como simulate_level, para os níveis
+// que o motor em lockstep não suporta
+static void sweep_board(const board_t *level, unsigned int seed, long max_plays, lockstep_outcome_t *out)
+{
+    board_t board;
+    memset(out, 0, sizeof(*out));
+    if (clone_board(&board, level) != 0)
+    {
+        out->result = INVALID_MOVE;
+        return;
+    }
+    board.seed = seed;
+    board.heat = level->heat; // as corridas de um nível são jogadas uma a uma, todas contam no mesmo
+    headless_cycle_t cycle;
+    out->result = play_headless(&board, max_plays, NULL, &cycle);
+    out->cycle = cycle.length;
+    out->tick = board.tick;
+    out->points = total_points(&board);
+    out->dots_left = board.dots_left;
+    out->pac_x = board.pacmans[0].pos_x;
+    out->pac_y = board.pacmans[0].pos_y;
+    out->ghosts = lockstep_ghosts_digest(&board);
+    unload_level(&board);
+}
+
+// Helper private function: impressão digital de como terminaram as corridas de um nível, a comparar com -G
+static unsigned long sweep_digest(const lockstep_outcome_t *outcomes, int runs)
+{
+    unsigned long h = 1469598103934665603UL;
+    for (int i = 0; i < runs; i++)
+    {
+        const lockstep_outcome_t *o = &outcomes[i];
+        unsigned long fields[] = {(unsigned long)o->result, (unsigned long)o->tick, (unsigned long)o->points,
+                                  (unsigned long)o->dots_left, (unsigned long)o->pac_x, (unsigned long)o->pac_y,
+                                  o->ghosts};
+        for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+            h = (h ^ fields[f]) * 1099511628211UL;
+    }
+    return h;
+}
+
+// Modo -F com -N: joga cada nível 'runs' vezes, com as sementes seed, seed + 1, ..., e resume como terminaram
+// Os níveis que o permitem são jogados todos de uma vez pelo motor em lockstep, a não ser com 'one_board' (-D)
+// Com -G compara o resumo e a impressão digital das corridas de cada nível com o ficheiro de referência
+int sweep_levels(const char *levels_path, long max_plays, unsigned int seed, int runs, bool one_board,
+                 const char *golden_path)
+{
+    level_set_t levels;
+    if (open_levels(levels_path, &levels) != 0)
+    {
+        fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
+        return 1;
+    }
+    unsigned int *seeds = malloc(runs * sizeof(unsigned int));
+    lockstep_outcome_t *outcomes = malloc(runs * sizeof(lockstep_outcome_t));
+    if (!seeds || !outcomes)
+    {
+        free(seeds);
+        free(outcomes);
+        close_levels(&levels);
+        return 1;
+    }
+    for (int i = 0; i < runs; i++)
+        seeds[i] = seed + (unsigned int)i;
+
+    // Com -Y, o mapa de calor e o nome de cada nível, escritos no fim
+    int n_heats = heatmap_path ? levels.n_levels : 0;
+    heatmap_t **heats = calloc(n_heats > 0 ? n_heats : 1, sizeof(heatmap_t *));
+    char(*heat_names)[256] = calloc(n_heats > 0 ? n_heats : 1, sizeof(*heat_names));
+    if (!heats || !heat_names)
+        n_heats = 0;
+
+    // Com -G, a linha e o nome de cada nível
+    char(*lines)[GOLDEN_LINE] = calloc(levels.n_levels > 0 ? levels.n_levels : 1, sizeof(*lines));
+    char(*line_names)[256] = calloc(levels.n_levels > 0 ? levels.n_levels : 1, sizeof(*line_names));
+    int n_lines = 0;
+
+    int failed = golden_path && (!lines || !line_names);
+    for (int l = 0; l < levels.n_levels; l++)
+    {
+        board_t level;
+        if (load_level_at(&levels, l, &level) != 0)
+        {
+            failed++;
+            continue;
+        }
+        if (l < n_heats && (level.heat = heats[l] = heatmap_create(level.width, level.height)))
+        {
+            level.heat->runs = runs;
+            snprintf(heat_names[l], sizeof(heat_names[l]), "%s", level.level_name);
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool lockstep = !one_board && lockstep_run(&level, seeds, runs, max_plays, outcomes) == 0;
+        if (!lockstep)
+        {
+            mute_debug(1);
+            for (int i = 0; i < runs; i++)
+                sweep_board(&level, seeds[i], max_plays, &outcomes[i]);
+            mute_debug(0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long elapsed_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+
+        int dead = 0, portal = 0, cleared = 0, looping = 0;
+        double points = 0, plays = 0;
+        for (int i = 0; i < runs; i++)
+        {
+            if (outcomes[i].result == DEAD_PACMAN)
+                dead++;
+            else if (outcomes[i].result == REACHED_PORTAL && level.clear_to_win && outcomes[i].dots_left == 0)
+                cleared++;
+            else if (outcomes[i].result == REACHED_PORTAL)
+                portal++;
+            looping += outcomes[i].cycle > 0;
+            points += outcomes[i].points;
+            plays += outcomes[i].tick;
+        }
+        printf("%s: %d runs (%s, %ld us): %d pacman died, %d reached the portal, %d cleared every dot, %d still playing\n",
+               level.level_name, runs, lockstep ? "lockstep" : "one board per run", elapsed_us, dead, portal, cleared,
+               runs - dead - portal - cleared);
+        printf("  %.1f points and %.1f plays on average\n", points / runs, plays / runs);
+        if (looping > 0)
+            printf("  %d runs fell into a loop\n", looping);
+        if (golden_path && lines && line_names)
+        {
+            snprintf(line_names[n_lines], sizeof(line_names[n_lines]), "%s", level.level_name);
+            snprintf(lines[n_lines++], GOLDEN_LINE, "%s %d runs %d %d %d %d %016lx\n", level.level_name, runs, dead,
+                     portal, cleared, runs - dead - portal - cleared, sweep_digest(outcomes, runs));
+        }
+        unload_level(&level);
+    }
+
+    if (n_heats > 0)
+    {
+        const char *names[n_heats];
+        for (int l = 0; l < n_heats; l++)
+            names[l] = heat_names[l];
+        if (save_heatmaps(heats, names, n_heats) != 0)
+            failed++;
+        for (int l = 0; l < n_heats; l++)
+            heatmap_free(heats[l]);
+    }
+    if (golden_path && lines && line_names)
+    {
+        const char *names[n_lines > 0 ? n_lines : 1];
+        for (int l = 0; l < n_lines; l++)
+            names[l] = line_names[l];
+        if (check_golden(golden_path, (const char(*)[GOLDEN_LINE])lines, names, n_lines) != 0)
+            failed++;
+    }
+    free(lines);
+    free(line_names);
+    free(heats);
+    free(heat_names);
+    free(seeds);
+    free(outcomes);
+    close_levels(&levels);
+    return failed > 0 ? 1 : 0;
+}
+
+// Helper private function: os Pacmans contra quem os monstros de -E são avaliados, os .p da diretoria
+// (por ordem alfabética) ou, num pack, os Pacmans com programa do próprio nível. Devolve quantos são
+static int evolve_opponents(const char *directory, const board_t *level, pacman_t **opponents)
+{
+    int n = 0;
+    *opponents = NULL;
+    struct dirent **names;
+    int n_names = directory ? scandir(directory, &names, NULL, alphasort) : -1;
+    for (int i = 0; i < n_names; i++)
+    {
+        size_t len = strlen(names[i]->d_name);
+        if (len > 2 && strcmp(names[i]->d_name + len - 2, ".p") == 0)
+        {
+            // Só o programa e o PASSO interessam, como em reload_entity_files
+            char path[512];
+            pacman_t pacman;
+            board_t scratch;
+            memset(&pacman, 0, sizeof(pacman));
+            memset(&scratch, 0, sizeof(scratch));
+            scratch.pacmans = &pacman;
+            snprintf(path, sizeof(path), "%s/%s", directory, names[i]->d_name);
+            load_entity_behavior(path, &scratch, 'P', 0);
+            pacman_t *grown = pacman.program ? realloc(*opponents, (n + 1) * sizeof(pacman_t)) : NULL;
+            if (grown)
+            {
+                *opponents = grown;
+                (*opponents)[n++] = pacman;
+            }
+            else
+                behavior_release(pacman.program);
+        }
+        free(names[i]);
+    }
+    if (n_names >= 0)
+        free(names);
+
+    // Num pack, ou sem .p na diretoria, servem os Pacmans com programa do próprio nível
+    if (n == 0 && (*opponents = malloc((level->n_pacmans > 0 ? level->n_pacmans : 1) * sizeof(pacman_t))))
+    {
+        for (int p = 0; p < level->n_pacmans; p++)
+            if (level->pacmans[p].program)
+            {
+                (*opponents)[n] = level->pacmans[p];
+                behavior_retain((*opponents)[n++].program);
+            }
+    }
+    return n;
+}
+
+// Modo -E: evolui os scripts dos monstros de cada nível e escreve os melhores em out_dir, como ficheiros .m
+int evolve_levels(const char *levels_path, const char *out_dir, const evolve_opts_t *opts)
+{
+    level_set_t levels;
+    if (open_levels(levels_path, &levels) != 0)
+    {
+        fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < levels.n_levels; i++)
+    {
+        board_t board;
+        if (load_level_at(&levels, i, &board) != 0)
+        {
+            failed++;
+            continue;
+        }
+
+        pacman_t *opponents;
+        int n_opponents = evolve_opponents(levels.directory, &board, &opponents);
+        evolve_result_t result;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int status = (board.n_ghosts > 0 && n_opponents > 0) ? evolve_ghosts(&board, opponents, n_opponents, opts, &result) : -1;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+        if (board.n_ghosts == 0 || n_opponents == 0)
+            printf("%s: skipped, %s\n", board.level_name, board.n_ghosts == 0 ? "no ghosts" : "no pacman scripts to play against");
+        else if (status != 0)
+        {
+            printf("%s: out of memory\n", board.level_name);
+            failed++;
+        }
+        else
+        {
+            printf("%s: fitness %ld, the level's own ghosts %ld (%d pacman scripts, %ld games, %ld ms)\n",
+                   board.level_name, result.fitness, result.original, n_opponents, result.simulations, elapsed_ms);
+
+            // Os ficheiros .m podem ser partilhados entre níveis: cada nível tem a sua subdiretoria, onde
+            // cada monstro fica com o nome do seu ficheiro, ou com um nome próprio se o partilha ou não tem
+            char stem[MAX_FILENAME], level_dir[512];
+            snprintf(stem, sizeof(stem), "%s", board.level_name);
+            char *dot = strrchr(stem, '.');
+            if (dot)
+                *dot = '\0';
+            snprintf(level_dir, sizeof(level_dir), "%s/%s", out_dir, stem);
+            if (mkdir(level_dir, 0755) != 0 && errno != EEXIST)
+                perror(level_dir);
+            for (int g = 0; g < board.n_ghosts; g++)
+            {
+                bool shared = board.ghosts_files[g][0] == '\0';
+                for (int other = 0; other < g && !shared; other++)
+                    shared = strcmp(board.ghosts_files[other], board.ghosts_files[g]) == 0;
+                char path[1024];
+                if (shared)
+                    snprintf(path, sizeof(path), "%s/ghost-%d.m", level_dir, g);
+                else
+                    snprintf(path, sizeof(path), "%s/%s", level_dir, board.ghosts_files[g]);
+
+                FILE *file = fopen(path, "w");
+                if (!file)
+                {
+                    perror(path);
+                    failed++;
+                    continue;
+                }
+                fprintf(file, "# %s, ghost %d: evolved over %d generations, fitness %ld\n", board.level_name, g,
+                        opts->generations, result.fitness);
+                if (write_ghost_script(file, &result.scripts[g], &board.ghosts[g]) != 0)
+                    failed++;
+                fclose(file);
+                printf("  ghost %d -> %s\n", g, path);
+            }
+        }
+
+        for (int o = 0; o < n_opponents; o++)
+            behavior_release(opponents[o].program);
+        free(opponents);
+        unload_level(&board);
+    }
+
+    close_levels(&levels);
+    return failed > 0 ? 1 : 0;
+}
+
+// Modo -a: calcula o plano do solver a partir do estado atual do tabuleiro
+void plan_autoplay(board_t *game_board, const solver_opts_t *opts)
+{
+    // O solver joga cópias deste tabuleiro, incluindo a semente aleatória,
+    // logo o jogo real segue exatamente o plano
+    solver_result_t plan;
+    free(autoplay_moves);
+    autoplay_moves = NULL;
+    autoplay_next = 0;
+    if (solve_board(game_board, opts, &plan) == 0 && plan.solved)
+        autoplay_moves = plan.moves;
+    else
+        solver_free_result(&plan);
+}
+
+// Modo -R: aplica as alterações aos ficheiros do nível em jogo
+// Devolve true se foi o próprio .lvl que mudou, e o nível tem de ser recomeçado
+bool reload_changes(board_t *game_board, const char *levels_directory, const char *level_file,
+                    bool autoplay, const solver_opts_t *opts)
+{
+    char changed[MAX_WATCH_CHANGES][MAX_FILENAME];
+    int n = watch_changes(watch_fd, changed, MAX_WATCH_CHANGES);
+    bool patched = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (strcmp(changed[i], level_file) == 0)
+        {
+            debug("RELOAD %s\n", changed[i]);
+            return true;
+        }
+        if (reload_entity_files(game_board, levels_directory, changed[i]) > 0)
+        {
+            debug("RELOAD %s\n", changed[i]);
+            patched = true;
+        }
+    }
+
+    // As jogadas guardadas no jornal referem os programas antigos, já libertados
+    if (patched && game_board->journal)
+        journal_clear(game_board->journal);
+
+    // Os monstros mudaram, o plano antigo já não serve
+    if (patched && autoplay && !game_board->pacmans[0].program)
+        plan_autoplay(game_board, opts);
+    return false;
 }
 
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+    bool solve_only = false;
+    bool autoplay = false;
+    solver_opts_t solver_opts;
+    solver_default_opts(&solver_opts);
+    char *server_socket = NULL;
+    int load_sessions = 0;
+    int server_workers = SERVER_WORKERS;
+    char *shared_name = NULL;
+    char *view_name = NULL;
+    bool view_control = false;
+    int benchmark_frames = 0;
+    long simulate_plays = 0;
+    unsigned int simulate_seed = SIMULATE_SEED;
+    char *golden_path = NULL;
+    bool hot_reload = false;
+    char *pack_path = NULL;
+    char *observer_path = NULL;
+    int journal_plays = 0;
+    char *evolve_dir = NULL;
+    int sweep_runs = 0;
+    bool placed_runs = false;
+    bool alloc_check = false;
+    bool one_board = false;
+    evolve_opts_t evolve_opts;
+    evolve_default_opts(&evolve_opts);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "asj:w:H:L:k:S:C:V:m:Mb:B:F:x:G:WRP:O:K:J:E:g:N:DXUY:A")) != -1)
     {
-        printf("Usage: %s <level_directory>\n", argv[0]);
-        // TODO receive inputs
+        switch (opt)
+        {
+        case 'a':
+            autoplay = true;
+            break;
+        case 's':
+            solve_only = true;
+            break;
+        case 'j':
+            solver_opts.n_threads = atoi(optarg);
+            break;
+        case 'w':
+            solver_opts.beam_width = atoi(optarg);
+            break;
+        case 'H':
+            server_socket = optarg;
+            break;
+        case 'L':
+            load_sessions = atoi(optarg);
+            break;
+        case 'k':
+            server_workers = atoi(optarg);
+            break;
+        case 'S':
+            shared_name = optarg;
+            break;
+        case 'C':
+        case 'V':
+            view_name = optarg;
+            view_control = (opt == 'C');
+            break;
+        case 'm':
+            set_view_margins(atoi(optarg), atoi(optarg));
+            break;
+        case 'M':
+            set_minimap(1);
+            break;
+        case 'b':
+            if (strcmp(optarg, "ansi") == 0)
+                set_display_backend(DISPLAY_ANSI);
+            else if (strcmp(optarg, "ncurses") == 0)
+                set_display_backend(DISPLAY_NCURSES);
+            else
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'B':
+            benchmark_frames = atoi(optarg);
+            break;
+        case 'F':
+            simulate_plays = atol(optarg);
+            break;
+        case 'x':
+            simulate_seed = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'G':
+            golden_path = optarg;
+            break;
+        case 'R':
+            hot_reload = true;
+            break;
+        case 'P':
+            pack_path = optarg;
+            break;
+        case 'O':
+            observer_path = optarg;
+            break;
+        case 'K':
+            checkpoint_path = optarg;
+            break;
+        case 'J':
+            journal_plays = atoi(optarg);
+            break;
+        case 'E':
+            evolve_dir = optarg;
+            break;
+        case 'g':
+            evolve_opts.generations = atoi(optarg);
+            break;
+        case 'N':
+            sweep_runs = atoi(optarg);
+            break;
+        case 'A':
+            alloc_check = true;
+            break;
+        case 'W':
+            golden_record = true;
+            break;
+        case 'D':
+            one_board = true;
+            break;
+        case 'X':
+            cycle_set_skipping(0);
+            break;
+        case 'U':
+            placed_runs = true;
+            break;
+        case 'Y':
+            heatmap_path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
     }
-    char *levels_directory = argv[1];
+
+    if (view_name)
+    {
+        return shared_view(view_name, view_control);
+    }
+
+    if (optind != argc - 1)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    char *levels_path = argv[optind]; // diretoria ou pack de níveis
 
     // Random seed for any random movements
     srand((unsigned int)time(NULL));
 
+    if (pack_path)
+    {
+        return pack_directory(levels_path, pack_path) == 0 ? 0 : 1;
+    }
+
+    if (solve_only)
+    {
+        return solve_levels(levels_path, &solver_opts);
+    }
+
+    if (simulate_plays > 0 && sweep_runs > 0)
+    {
+        int status = sweep_levels(levels_path, simulate_plays, simulate_seed, sweep_runs, one_board, golden_path);
+        return alloc_check ? report_allocations(status) : status;
+    }
+
+    if (simulate_plays > 0)
+    {
+        int status = simulate_levels(levels_path, simulate_plays, solver_opts.n_threads, simulate_seed, golden_path,
+                                     placed_runs);
+        return alloc_check ? report_allocations(status) : status;
+    }
+
+    if (evolve_dir)
+    {
+        evolve_opts.n_threads = solver_opts.n_threads;
+        evolve_opts.seed = simulate_seed;
+        return evolve_levels(levels_path, evolve_dir, &evolve_opts);
+    }
+
+    if (benchmark_frames > 0)
+    {
+        return benchmark_display(levels_path, benchmark_frames);
+    }
+
+    if (server_socket && load_sessions > 0)
+    {
+        level_set_t levels;
+        if (open_levels(levels_path, &levels) != 0)
+        {
+            fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
+            return 1;
+        }
+        close_levels(&levels);
+        return run_load_client(server_socket, levels.n_levels, load_sessions);
+    }
+
+    if (server_socket)
+    {
+        return run_server(server_socket, levels_path, server_workers > 0 ? server_workers : 1);
+    }
+
     open_debug_file("debug.log");
 
-    terminal_init();
+    if (shared_name)
+    {
+        shared_board = shared_create(shared_name);
+        char fifo_path[256];
+        snprintf(fifo_path, sizeof(fifo_path), SHARED_FIFO_FORMAT, shared_name);
+        // O_RDWR: o read() espera por teclas em vez de devolver EOF quando não há clientes
+        if (!shared_board || (input_fifo = open(fifo_path, O_RDWR)) < 0)
+        {
+            if (shared_board)
+                shared_close(shared_board, shared_name, 1);
+            close_debug_file();
+            return 1;
+        }
+        printf("Game published as '%s', attach with -C %s or -V %s\n", shared_name, shared_name, shared_name);
+    }
+    else
+        terminal_init();
 
-    char level_files[MAX_LEVELS][MAX_FILENAME];
-    int num_levels = 0;
+    level_set_t levels;
 
-    if (load_levels_from_dir(levels_directory, level_files, &num_levels) != 0)
+    if (open_levels(levels_path, &levels) != 0)
     {
-        terminal_cleanup();
+        if (shared_board)
+            shared_close(shared_board, shared_name, 1);
+        else
+            terminal_cleanup();
         close_debug_file();
         fprintf(stderr, "Erro: Nenhum nível encontrado ou diretoria inválida.\n");
         return 1;
     }
 
+    snapshot_init(&snapshots);
+    screen_reader = snapshot_join(&snapshots);
+    if (observer_path)
+    {
+        observer_file = fopen(observer_path, "w");
+        if (!observer_file)
+            perror("Erro ao abrir o ficheiro do observador");
+        else if (pthread_create(&observer_thread, NULL, observe_game, NULL) != 0)
+        {
+            fclose(observer_file);
+            observer_file = NULL;
+        }
+    }
+
+    // Um pack é um só ficheiro, só a diretoria pode ser vigiada
+    if (hot_reload && levels.directory)
+    {
+        watch_fd = watch_open(levels.directory);
+        // Sem teclas o ciclo do jogo também tem de correr, para aplicar as alterações
+        if (watch_fd >= 0 && !shared_board)
+            set_input_delay(WATCH_INPUT_MS);
+    }
+
     int accumulated_points = 0;
     int current_level_idx = 0;
     bool quit_game = false;
+
+    // Com -J cada tabuleiro jogado regista as alterações das últimas jogadas, para as desfazer com 'Z'
+    journal_t *journal = journal_plays > 0 ? journal_create(journal_plays, JOURNAL_BYTES) : NULL;
+
+    // Com -K retoma o nível guardado, se o checkpoint for deste conjunto de níveis
+    board_t resumed_board;
+    bool resumed = false;
+    if (checkpoint_path && checkpoint_load(checkpoint_path, &resumed_board, &current_level_idx) == 0)
+    {
+        char name[MAX_FILENAME];
+        if (current_level_idx >= 0 && current_level_idx < levels.n_levels &&
+            level_name(&levels, current_level_idx, name, sizeof(name)) == 0 &&
+            strcmp(name, resumed_board.level_name) == 0)
+        {
+            resumed = true;
+            accumulated_points = total_points(&resumed_board);
+            debug("RESUME %s tick %ld\n", resumed_board.level_name, resumed_board.tick);
+        }
+        else
+        {
+            unload_level(&resumed_board);
+            current_level_idx = 0;
+        }
+    }
+    else
+        current_level_idx = 0;
     // bool end_game = false;
     // board_t game_board;
 
-    while (current_level_idx < num_levels && !quit_game)
+    while (current_level_idx < levels.n_levels && !quit_game)
     {
         board_t game_board;
-        char full_path[512];
-
-        // Constrói o caminho completo: "alumaDiretoria/1.lvl"
-        snprintf(full_path, sizeof(full_path), "%s/%s", levels_directory, level_files[current_level_idx]);
 
-        if (load_level_from_file(full_path, &game_board, levels_directory) != 0)
+        if (resumed)
+        {
+            // O checkpoint já traz os pontos acumulados
+            game_board = resumed_board;
+            resumed = false;
+        }
+        // Só o nível a jogar é lido (da diretoria: "alumaDiretoria/1.lvl", ou do pack)
+        else if (load_level_at(&levels, current_level_idx, &game_board) != 0)
         {
             break; // Erro ao carregar nível
         }
-        if (game_board.n_pacmans > 0)
+        else if (game_board.n_pacmans > 0)
         {
             game_board.pacmans[0].points = accumulated_points;
         }
 
-        draw_board(&game_board, DRAW_MENU);
-        refresh_screen();
+        // As células por onde se pode passar ficam já só deste tabuleiro, para as jogadas não terem de alocar
+        if (own_tiles(&game_board) != 0)
+        {
+            unload_level(&game_board);
+            break;
+        }
+        save_checkpoint(&game_board, current_level_idx);
+        int plays_since_checkpoint = 0;
+
+        // Não se volta para trás do início do nível
+        if (journal)
+            journal_clear(journal);
+        game_board.journal = journal;
+
+        // O plano é calculado uma vez por nível (e de novo se os ficheiros mudarem, com -R)
+        if (autoplay && !game_board.pacmans[0].program)
+            plan_autoplay(&game_board, &solver_opts);
+
+        // Com -Y, o mapa de calor deste nível (de corridas de -F) fica por cima do tabuleiro
+        heatmap_t *heat = heatmap_path ? heatmap_load(heatmap_path, game_board.level_name) : NULL;
+        set_heatmap(heat);
+
+        show_board(&game_board, DRAW_MENU);
+        // As cópias que o ecrã lê já ficam com o tamanho deste nível, também para o ciclo não ter de alocar
+        // E os checkpoints (-K) já têm onde ser escritos, para os que se gravam durante as jogadas
+        if (snapshot_reserve(&snapshots, &game_board) != 0 ||
+            (checkpoint_path && checkpoint_reserve(&game_board) != 0))
+        {
+            unload_level(&game_board);
+            set_heatmap(NULL);
+            heatmap_free(heat);
+            break;
+        }
+        int level_start_points = accumulated_points;
 
         while (true)
         {
+            // Com -A, dentro do ciclo só o que é recarregado (-R) pode alocar memória, as jogadas não
+            alloc_forbid(false);
+            if (watch_fd >= 0 && reload_changes(&game_board, levels.directory, game_board.level_name,
+                                                autoplay, &solver_opts))
+            {
+                // O .lvl mudou: volta a carregar o mesmo nível, com os pontos que tinha no início
+                accumulated_points = level_start_points;
+                break;
+            }
+            alloc_forbid(alloc_check);
+
             int result = play_board(&game_board);
 
             if (result == CREATE_BACKUP)
             {
+                // O backup do fork perde-se com o processo, o checkpoint não
+                save_checkpoint(&game_board, current_level_idx);
                 // Só cria backup se ainda não existir nenhum
                 if (!backup_exists)
                 {
@@ -214,7 +1572,7 @@ int main(int argc, char **argv)
                 screen_refresh(&game_board, DRAW_WIN);
                 sleep_ms(game_board.tempo);
 
-                accumulated_points = game_board.pacmans[0].points;
+                accumulated_points = total_points(&game_board);
 
                 // Passa para o próximo nível na lista
                 current_level_idx++;
@@ -232,6 +1590,12 @@ int main(int argc, char **argv)
                     _exit(1); // código 1 = Pacman morto com backup
                 }
 
+                // Saiu com 'Q': fica guardado para continuar; morreu: não há nada a retomar
+                if (game_board.pacmans[0].alive)
+                    save_checkpoint(&game_board, current_level_idx);
+                else if (checkpoint_path)
+                    unlink(checkpoint_path);
+
                 quit_game = true; // Marca para sair de tudo
                 break;
             }
@@ -239,17 +1603,50 @@ int main(int argc, char **argv)
             screen_refresh(&game_board, DRAW_MENU);
 
             // Atualiza pontos locais para visualização
-            accumulated_points = game_board.pacmans[0].points;
+            accumulated_points = total_points(&game_board);
+
+            if (++plays_since_checkpoint >= CHECKPOINT_PLAYS)
+            {
+                save_checkpoint(&game_board, current_level_idx);
+                plays_since_checkpoint = 0;
+            }
         }
 
         // Limpa a memória do nível que acabou de ser jogado antes de carregar o próximo
         // print_board(&game_board);
+        alloc_forbid(false);
         unload_level(&game_board);
+        set_heatmap(NULL);
+        heatmap_free(heat);
+    }
+
+    // Jogo terminado, o checkpoint já não serve
+    if (checkpoint_path && current_level_idx >= levels.n_levels)
+        unlink(checkpoint_path);
+
+    journal_destroy(journal);
+    free(autoplay_moves);
+    watch_close(watch_fd);
+    close_levels(&levels);
+
+    if (observer_file)
+    {
+        atomic_store(&observer_stop, true);
+        pthread_join(observer_thread, NULL);
+        fclose(observer_file);
     }
+    snapshot_leave(&snapshots, screen_reader);
+    snapshot_destroy(&snapshots);
 
-    terminal_cleanup();
+    if (shared_board)
+    {
+        close(input_fifo);
+        shared_close(shared_board, shared_name, 1);
+    }
+    else
+        terminal_cleanup();
 
     close_debug_file();
 
-    return 0;
+    return alloc_check ? report_allocations(0) : 0;
 }
@@ -0,0 +1,99 @@
+#include "heatmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+heatmap_t* heatmap_create(int width, int height) {
+    heatmap_t* heat = calloc(1, sizeof(heatmap_t));
+    if (!heat) return NULL;
+    heat->width = width;
+    heat->height = height;
+    size_t cells = width > 0 && height > 0 ? (size_t) width * height : 1;
+    heat->pacman = calloc(cells, sizeof(uint64_t));
+    heat->ghosts = calloc(cells, sizeof(uint64_t));
+    heat->deaths = calloc(cells, sizeof(uint64_t));
+    if (!heat->pacman || !heat->ghosts || !heat->deaths) {
+        heatmap_free(heat);
+        return NULL;
+    }
+    return heat;
+}
+
+void heatmap_merge(heatmap_t* into, const heatmap_t* from) {
+    size_t cells = (size_t) into->width * into->height;
+    for (size_t i = 0; i < cells; i++) {
+        into->pacman[i] += from->pacman[i];
+        into->ghosts[i] += from->ghosts[i];
+        into->deaths[i] += from->deaths[i];
+    }
+    into->runs += from->runs;
+}
+
+void heatmap_free(heatmap_t* heat) {
+    if (!heat) return;
+    free(heat->pacman);
+    free(heat->ghosts);
+    free(heat->deaths);
+    free(heat);
+}
+
+// Helper private function to write one grid of counts, a line per row
+static void write_counts(FILE* file, const char* title, const heatmap_t* heat, const uint64_t* counts) {
+    fprintf(file, "%s\n", title);
+    for (int y = 0; y < heat->height; y++) {
+        for (int x = 0; x < heat->width; x++) {
+            fprintf(file, x ? " %llu" : "%llu", (unsigned long long) counts[(size_t) y * heat->width + x]);
+        }
+        fputc('\n', file);
+    }
+}
+
+int heatmap_write(FILE* file, const char* level, const heatmap_t* heat) {
+    fprintf(file, "HEATMAP %s %d %d %ld\n", level, heat->width, heat->height, heat->runs);
+    write_counts(file, "pacman", heat, heat->pacman);
+    write_counts(file, "ghosts", heat, heat->ghosts);
+    write_counts(file, "deaths", heat, heat->deaths);
+    return ferror(file) ? -1 : 0;
+}
+
+// Helper private function to read one grid of counts, after its title
+static int read_counts(FILE* file, const char* title, heatmap_t* heat, uint64_t* counts) {
+    char word[16];
+    if (fscanf(file, "%15s", word) != 1 || strcmp(word, title) != 0) return -1;
+    size_t cells = (size_t) heat->width * heat->height;
+    for (size_t i = 0; i < cells; i++) {
+        unsigned long long count;
+        if (fscanf(file, "%llu", &count) != 1) return -1;
+        counts[i] = count;
+    }
+    return 0;
+}
+
+heatmap_t* heatmap_read(FILE* file, char* level) {
+    int width, height;
+    long runs;
+    if (fscanf(file, " HEATMAP %255s %d %d %ld", level, &width, &height, &runs) != 4) return NULL;
+    if (width <= 0 || height <= 0) return NULL;
+    heatmap_t* heat = heatmap_create(width, height);
+    if (!heat) return NULL;
+    heat->runs = runs;
+    if (read_counts(file, "pacman", heat, heat->pacman) != 0 || read_counts(file, "ghosts", heat, heat->ghosts) != 0 ||
+        read_counts(file, "deaths", heat, heat->deaths) != 0) {
+        heatmap_free(heat);
+        return NULL;
+    }
+    return heat;
+}
+
+heatmap_t* heatmap_load(const char* path, const char* level) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+
+    char name[HEATMAP_NAME];
+    heatmap_t* heat;
+    while ((heat = heatmap_read(file, name)) != NULL) {
+        if (strcmp(name, level) == 0) break;
+        heatmap_free(heat); // another level's, read only to get past it
+    }
+    fclose(file);
+    return heat;
+}
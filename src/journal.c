@@ -0,0 +1,95 @@
+#include "journal.h"
+#include <stdlib.h>
+#include <string.h>
+
+journal_t* journal_create(int max_plays, size_t capacity) {
+    journal_t* journal = calloc(1, sizeof(journal_t));
+    if (!journal) return NULL;
+    journal->capacity = capacity;
+    journal->max_plays = max_plays > 0 ? max_plays : 1;
+    journal->data = malloc(capacity);
+    journal->marks = malloc(journal->max_plays * sizeof(uint64_t));
+    if (!journal->data || !journal->marks) {
+        journal_destroy(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+void journal_destroy(journal_t* journal) {
+    if (!journal) return;
+    free(journal->data);
+    free(journal->marks);
+    free(journal);
+}
+
+// Helper private function to copy 'size' bytes into the ring at offset 'offset', wrapping around its end
+static void ring_write(journal_t* journal, uint64_t offset, const void* src, size_t size) {
+    size_t at = offset % journal->capacity;
+    size_t first = size < journal->capacity - at ? size : journal->capacity - at;
+    memcpy(journal->data + at, src, first);
+    memcpy(journal->data, (const unsigned char*) src + first, size - first);
+}
+
+// Helper private function to copy 'size' bytes out of the ring from offset 'offset'
+static void ring_read(const journal_t* journal, uint64_t offset, void* dst, size_t size) {
+    size_t at = offset % journal->capacity;
+    size_t first = size < journal->capacity - at ? size : journal->capacity - at;
+    memcpy(dst, journal->data + at, first);
+    memcpy((unsigned char*) dst + first, journal->data, size - first);
+}
+
+// Helper private function to drop the oldest play kept
+static void drop_oldest(journal_t* journal) {
+    journal->first = (journal->first + 1) % journal->max_plays;
+    journal->n_plays--;
+    journal->tail = journal->n_plays > 0 ? journal->marks[journal->first] : journal->head;
+}
+
+void journal_begin(journal_t* journal) {
+    if (journal->n_plays == journal->max_plays) drop_oldest(journal);
+    journal->marks[(journal->first + journal->n_plays) % journal->max_plays] = journal->head;
+    journal->n_plays++;
+    journal->broken = 0;
+}
+
+void journal_record(journal_t* journal, void* at, size_t size) {
+    if (journal->broken || journal->n_plays == 0) return;
+    size_t need = size + sizeof(journal_entry_t);
+    while (journal->head + need - journal->tail > journal->capacity && journal->n_plays > 1) {
+        drop_oldest(journal);
+    }
+    if (journal->head + need - journal->tail > journal->capacity) {
+        // The current play alone is larger than the ring
+        journal_clear(journal);
+        journal->broken = 1;
+        return;
+    }
+    journal_entry_t entry = {.at = at, .size = size};
+    ring_write(journal, journal->head, at, size);
+    ring_write(journal, journal->head + size, &entry, sizeof(entry));
+    journal->head += need;
+}
+
+int journal_rewind(journal_t* journal, int plays) {
+    int undone = 0;
+    for (; undone < plays && journal->n_plays > 0; undone++) {
+        uint64_t mark = journal->marks[(journal->first + journal->n_plays - 1) % journal->max_plays];
+        while (journal->head > mark) {
+            journal_entry_t entry;
+            ring_read(journal, journal->head - sizeof(entry), &entry, sizeof(entry));
+            journal->head -= sizeof(entry) + entry.size;
+            ring_read(journal, journal->head, entry.at, entry.size);
+        }
+        journal->n_plays--;
+    }
+    if (journal->n_plays == 0) journal->tail = journal->head;
+    journal->broken = 0;
+    return undone;
+}
+
+void journal_clear(journal_t* journal) {
+    journal->first = 0;
+    journal->n_plays = 0;
+    journal->tail = journal->head;
+}
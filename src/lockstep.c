@@ -0,0 +1,486 @@
+#include "lockstep.h"
+#include "behavior.h"
+#include "heatmap.h"
+#include "cycle.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define BIT(x) ((uint64_t) 1 << (x))
+
+/*What every copy of the level shares*/
+typedef struct {
+    int width, height;
+    int n_ghosts;
+    int clear_to_win;
+    const uint64_t* walls;      // bits past the last column are set too, so slides stop at the edge
+    const uint64_t* portals;
+    const program_t* pac_program;
+    int pac_passo;
+    const ghost_t* ghosts;      // programs and PASSO of the ghosts
+    heatmap_t* heat;            // the level's, every copy counts into it (NULL if off)
+} level_rows_t;
+
+typedef struct {
+    int x, y;
+    int charged;
+    long wake;
+    behavior_state_t behavior;
+} copy_ghost_t;
+
+/*One copy of the level being played*/
+typedef struct {
+    unsigned int seed;
+    long tick;
+    int result;
+    int done;
+    int pac_x, pac_y, alive, points, dots_left;
+    long pac_wake;
+    behavior_state_t pac_behavior;
+    uint64_t* dots;         // one word per row
+    uint64_t* ghost_rows;   // one word per row, the cells whose content is 'M'
+    uint64_t* pac_rows;     // the same for 'P'
+    copy_ghost_t* ghosts;
+    long cycle;
+} copy_t;
+
+/*Brent's cycle detection on a copy, as cycle_check does on a board*/
+typedef struct {
+    copy_t saved;           // the copy at the start of the window, its rows and ghosts kept apart
+    unsigned long digest;
+    long window, plays;
+} copy_cycle_t;
+
+int lockstep_supported(const board_t* level) {
+    if (level->width <= 0 || level->width > LOCKSTEP_MAX_WIDTH || level->height <= 0) return 0;
+    if (level->n_pacmans != 1 || !level->pacmans[0].alive || level->simultaneous) {
+        return 0;
+    }
+    // Walls are shared by every copy, nobody may stand on one and clear it when leaving
+    const pacman_t* pac = &level->pacmans[0];
+    if (behavior_reads_board(pac->program) || pac->pos_x < 0 || pac->pos_x >= level->width || pac->pos_y < 0 ||
+        pac->pos_y >= level->height || board_cell(level, pac->pos_x, pac->pos_y)->content == 'W') {
+        return 0;
+    }
+    for (int g = 0; g < level->n_ghosts; g++) {
+        const ghost_t* ghost = &level->ghosts[g];
+        if (behavior_reads_board(ghost->program) || ghost->pos_x < 0 || ghost->pos_x >= level->width ||
+            ghost->pos_y < 0 || ghost->pos_y >= level->height ||
+            board_cell(level, ghost->pos_x, ghost->pos_y)->content == 'W') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Helper private function: the content of cell (x, y) becomes 'content' (' ', 'P' or 'M')
+static inline void set_content(copy_t* copy, int x, int y, char content) {
+    copy->ghost_rows[y] &= ~BIT(x);
+    copy->pac_rows[y] &= ~BIT(x);
+    if (content == 'M') copy->ghost_rows[y] |= BIT(x);
+    if (content == 'P') copy->pac_rows[y] |= BIT(x);
+}
+
+// Helper private function for find_and_kill_pacman: the pacman dies if it is (still) on that cell
+static inline void kill_at(const level_rows_t* level, copy_t* copy, int x, int y) {
+    if (copy->alive && copy->pac_x == x && copy->pac_y == y) {
+        set_content(copy, x, y, ' ');
+        copy->alive = 0;
+        if (level->heat) level->heat->deaths[y * level->width + x]++;
+    }
+}
+
+// Helper private function for move_pacman on a copy
+static int copy_move_pacman(const level_rows_t* level, copy_t* copy) {
+    if (!copy->alive) return DEAD_PACMAN;
+    if (copy->tick < copy->pac_wake) return VALID_MOVE;
+    copy->pac_wake = copy->tick + level->pac_passo + 1;
+
+    command_t command = {.command = '\0', .turns = 1}; // without a program pacman stands still
+    if (level->pac_program) {
+        behavior_next(level->pac_program, &copy->pac_behavior, NULL, copy->pac_x, copy->pac_y, 'P', &command);
+    }
+    char direction = command.command;
+    if (direction == 'R') {
+        char directions[] = {'W', 'S', 'A', 'D'};
+        direction = directions[rand_r(&copy->seed) % 4];
+    }
+
+    int x = copy->pac_x, y = copy->pac_y;
+    switch (direction) {
+        case 'W': y--; break;
+        case 'S': y++; break;
+        case 'A': x--; break;
+        case 'D': x++; break;
+        case 'T':
+            copy->pac_wake += (long) (command.turns - 1) * (level->pac_passo + 1);
+            return VALID_MOVE;
+        default:
+            return INVALID_MOVE;
+    }
+    if (x < 0 || x >= level->width || y < 0 || y >= level->height) return INVALID_MOVE;
+
+    uint64_t bit = BIT(x);
+    if (level->portals[y] & bit) {
+        if (level->heat) level->heat->pacman[y * level->width + x]++;
+        return REACHED_PORTAL;
+    }
+    if ((level->walls[y] | copy->pac_rows[y]) & bit) return INVALID_MOVE;
+    if (copy->ghost_rows[y] & bit) {
+        kill_at(level, copy, copy->pac_x, copy->pac_y);
+        return DEAD_PACMAN;
+    }
+    if (copy->dots[y] & bit) {
+        copy->dots[y] &= ~bit;
+        copy->points++;
+        copy->dots_left--;
+    }
+    set_content(copy, copy->pac_x, copy->pac_y, ' ');
+    copy->pac_x = x;
+    copy->pac_y = y;
+    set_content(copy, x, y, 'P');
+    if (level->heat) level->heat->pacman[y * level->width + x]++;
+    if (level->clear_to_win && copy->dots_left == 0) return REACHED_PORTAL;
+    return VALID_MOVE;
+}
+
+// Helper private function for the slide of a charged ghost along a row: the first wall or ghost stops it
+// the cell before, the first pacman is run over. Returns the column it ends in
+static int slide_row(const level_rows_t* level, copy_t* copy, int x, int y, int step) {
+    uint64_t pac = copy->pac_rows[y];
+    uint64_t stops = level->walls[y] | copy->ghost_rows[y];
+    if (step > 0) {
+        uint64_t ahead = (stops | pac) & ~(BIT(x + 1) - 1);
+        if (!ahead) return level->width - 1;
+        int hit = __builtin_ctzll(ahead);
+        if (pac & BIT(hit)) {
+            kill_at(level, copy, hit, y);
+            return hit;
+        }
+        return hit >= level->width ? level->width - 1 : hit - 1;
+    }
+    uint64_t behind = (stops | pac) & (BIT(x) - 1);
+    if (!behind) return 0;
+    int hit = 63 - __builtin_clzll(behind);
+    if (pac & BIT(hit)) {
+        kill_at(level, copy, hit, y);
+        return hit;
+    }
+    return hit + 1;
+}
+
+// Helper private function for the same along a column
+static int slide_column(const level_rows_t* level, copy_t* copy, int x, int y, int step) {
+    uint64_t bit = BIT(x);
+    for (int i = y + step; i >= 0 && i < level->height; i += step) {
+        if ((level->walls[i] | copy->ghost_rows[i]) & bit) return i - step;
+        if (copy->pac_rows[i] & bit) {
+            kill_at(level, copy, x, i);
+            return i;
+        }
+    }
+    return step > 0 ? level->height - 1 : 0;
+}
+
+// Helper private function for move_ghost (and move_ghost_charged) on a copy
+static void copy_move_ghost(const level_rows_t* level, copy_t* copy, int index) {
+    copy_ghost_t* ghost = &copy->ghosts[index];
+    const ghost_t* shared = &level->ghosts[index];
+    if (copy->tick < ghost->wake) return;
+    ghost->wake = copy->tick + shared->passo + 1;
+
+    command_t command;
+    behavior_next(shared->program, &ghost->behavior, NULL, ghost->x, ghost->y, 'M', &command);
+    char direction = command.command;
+    if (direction == 'R') {
+        char directions[] = {'W', 'S', 'A', 'D'};
+        direction = directions[rand_r(&copy->seed) % 4];
+    }
+
+    int x = ghost->x, y = ghost->y;
+    int dx = 0, dy = 0;
+    switch (direction) {
+        case 'W': dy = -1; break;
+        case 'S': dy = 1; break;
+        case 'A': dx = -1; break;
+        case 'D': dx = 1; break;
+        case 'C':
+            ghost->charged = 1;
+            return;
+        case 'T':
+            ghost->wake += (long) (command.turns - 1) * (shared->passo + 1);
+            return;
+        default:
+            return;
+    }
+
+    if (ghost->charged) {
+        ghost->charged = 0;
+        if (x + dx < 0 || x + dx >= level->width || y + dy < 0 || y + dy >= level->height) return;
+        if (dx) x = slide_row(level, copy, x, y, dx);
+        else y = slide_column(level, copy, x, y, dy);
+    }
+    else {
+        x += dx;
+        y += dy;
+        if (x < 0 || x >= level->width || y < 0 || y >= level->height) return;
+        if ((level->walls[y] | copy->ghost_rows[y]) & BIT(x)) return;
+        if (copy->pac_rows[y] & BIT(x)) kill_at(level, copy, x, y);
+    }
+
+    set_content(copy, ghost->x, ghost->y, ' ');
+    set_content(copy, x, y, 'M');
+    ghost->x = x;
+    ghost->y = y;
+    if (level->heat) level->heat->ghosts[y * level->width + x]++;
+}
+
+// Helper private function for play_turn on a copy
+static int copy_play(const level_rows_t* level, copy_t* copy) {
+    int result = copy_move_pacman(level, copy);
+    if (result == REACHED_PORTAL || !copy->alive) {
+        copy->tick++;
+        return result == REACHED_PORTAL ? result : DEAD_PACMAN;
+    }
+    // Due ghosts in index order, as the agenda hands them out
+    for (int g = 0; g < level->n_ghosts; g++) {
+        if (level->ghosts[g].program) copy_move_ghost(level, copy, g);
+    }
+    copy->tick++;
+    return copy->alive ? result : DEAD_PACMAN;
+}
+
+// Helper private function for course_digest on a copy
+static unsigned long copy_digest(const level_rows_t* level, const copy_t* copy) {
+    unsigned long h = 1469598103934665603UL;
+    long words[] = {copy->seed, copy->dots_left, copy->points, copy->alive, copy->pac_y * level->width + copy->pac_x,
+                    copy->alive ? copy->pac_wake - copy->tick : 0, copy->pac_behavior.pc};
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) h = (h ^ (unsigned long) words[i]) * 1099511628211UL;
+    for (int g = 0; g < level->n_ghosts; g++) {
+        const copy_ghost_t* ghost = &copy->ghosts[g];
+        h = (h ^ (unsigned long) (ghost->y * level->width + ghost->x)) * 1099511628211UL;
+        h = (h ^ (unsigned long) ghost->charged) * 1099511628211UL;
+        if (level->ghosts[g].program) {
+            h = (h ^ (unsigned long) (ghost->wake - copy->tick)) * 1099511628211UL;
+            h = (h ^ (unsigned long) ghost->behavior.pc) * 1099511628211UL;
+        }
+    }
+    return h;
+}
+
+// Helper private function: the part of a behaviour state that is in use
+static int same_behavior(const behavior_state_t* a, const behavior_state_t* b) {
+    if (a->pc != b->pc || a->depth != b->depth) return 0;
+    for (int i = 0; i < a->depth; i++) {
+        if (a->loops[i] != b->loops[i]) return 0;
+    }
+    return 1;
+}
+
+// Helper private function for same_course on a copy
+static int same_copy(const level_rows_t* level, const copy_t* a, const copy_t* b) {
+    if (a->seed != b->seed || a->dots_left != b->dots_left || a->points != b->points || a->alive != b->alive ||
+        a->pac_x != b->pac_x || a->pac_y != b->pac_y) {
+        return 0;
+    }
+    if (a->alive && (a->pac_wake - a->tick != b->pac_wake - b->tick || !same_behavior(&a->pac_behavior, &b->pac_behavior))) {
+        return 0;
+    }
+    for (int g = 0; g < level->n_ghosts; g++) {
+        const copy_ghost_t* ga = &a->ghosts[g];
+        const copy_ghost_t* gb = &b->ghosts[g];
+        if (ga->x != gb->x || ga->y != gb->y || ga->charged != gb->charged) return 0;
+        if (level->ghosts[g].program &&
+            (ga->wake - a->tick != gb->wake - b->tick || !same_behavior(&ga->behavior, &gb->behavior))) {
+            return 0;
+        }
+    }
+    return memcmp(a->dots, b->dots, 3 * level->height * sizeof(uint64_t)) == 0;
+}
+
+// Helper private function: the window of 'cycle' starts over at 'copy'
+static void save_copy(const level_rows_t* level, copy_cycle_t* cycle, const copy_t* copy) {
+    uint64_t* rows = cycle->saved.dots;
+    copy_ghost_t* ghosts = cycle->saved.ghosts;
+    cycle->saved = *copy;
+    cycle->saved.dots = rows;
+    cycle->saved.ghost_rows = rows + level->height;
+    cycle->saved.pac_rows = rows + 2 * level->height;
+    cycle->saved.ghosts = ghosts;
+    memcpy(rows, copy->dots, 3 * level->height * sizeof(uint64_t));
+    memcpy(ghosts, copy->ghosts, level->n_ghosts * sizeof(copy_ghost_t));
+    cycle->digest = copy_digest(level, copy);
+    cycle->window = cycle->window > 0 ? cycle->window * 2 : 1;
+    cycle->plays = 0;
+}
+
+// Helper private function for cycle_check and skip_plays on a copy, after each of its plays
+static void check_copy(const level_rows_t* level, copy_cycle_t* cycle, copy_t* copy, long max_plays) {
+    if (copy->cycle) return;
+    if (cycle->window == 0) {
+        save_copy(level, cycle, copy);
+        return;
+    }
+    cycle->plays++;
+    if (copy_digest(level, copy) == cycle->digest && same_copy(level, &cycle->saved, copy)) {
+        copy->cycle = copy->tick - cycle->saved.tick;
+        if (level->heat || !cycle_skipping()) return; // every play is counted
+        long plays = (max_plays - copy->tick) / copy->cycle * copy->cycle;
+        copy->tick += plays;
+        if (copy->alive) copy->pac_wake += plays;
+        for (int g = 0; g < level->n_ghosts; g++) {
+            if (level->ghosts[g].program) copy->ghosts[g].wake += plays;
+        }
+        return;
+    }
+    if (cycle->plays == cycle->window) save_copy(level, cycle, copy);
+}
+
+// Helper private function for next_event on a copy: the next play in which someone moves
+static long copy_next_event(const level_rows_t* level, const copy_t* copy) {
+    long next = LONG_MAX;
+    if (level->pac_program && copy->alive) next = copy->pac_wake;
+    for (int g = 0; g < level->n_ghosts; g++) {
+        if (level->ghosts[g].program && copy->ghosts[g].wake < next) next = copy->ghosts[g].wake;
+    }
+    return next > copy->tick ? next : copy->tick;
+}
+
+unsigned long lockstep_ghosts_digest(const board_t* board) {
+    unsigned long h = 1469598103934665603UL;
+    for (int g = 0; g < board->n_ghosts; g++) {
+        h = (h ^ (unsigned long) (board->ghosts[g].pos_y * board->width + board->ghosts[g].pos_x)) * 1099511628211UL;
+        h = (h ^ (unsigned long) board->ghosts[g].charged) * 1099511628211UL;
+    }
+    return h;
+}
+
+int lockstep_run(const board_t* level, const unsigned int* seeds, int n, long max_plays, lockstep_outcome_t* out) {
+    if (!lockstep_supported(level)) return -1;
+    int width = level->width, height = level->height, n_ghosts = level->n_ghosts;
+
+    // Shared rows, then three rows per copy, then the ghosts of every copy
+    uint64_t* shared_rows = calloc(2 * height, sizeof(uint64_t));
+    copy_t* copies = malloc((n > 0 ? n : 1) * sizeof(copy_t));
+    uint64_t* rows = malloc((size_t) (n > 0 ? n : 1) * 3 * height * sizeof(uint64_t));
+    copy_ghost_t* ghosts = malloc((size_t) (n > 0 ? n : 1) * (n_ghosts > 0 ? n_ghosts : 1) * sizeof(copy_ghost_t));
+    if (!shared_rows || !copies || !rows || !ghosts) {
+        free(shared_rows);
+        free(copies);
+        free(rows);
+        free(ghosts);
+        return -1;
+    }
+
+    uint64_t* walls = shared_rows;
+    uint64_t* portals = shared_rows + height;
+    uint64_t past_edge = width < 64 ? ~(BIT(width) - 1) : 0;
+    copy_t start;
+    memset(&start, 0, sizeof(start));
+    uint64_t* start_rows = rows; // copy 0 is filled first and the others copied from it
+    start.dots = start_rows;
+    start.ghost_rows = start_rows + height;
+    start.pac_rows = start_rows + 2 * height;
+    memset(start_rows, 0, 3 * height * sizeof(uint64_t));
+    for (int y = 0; y < height; y++) {
+        walls[y] = past_edge;
+        for (int x = 0; x < width; x++) {
+            const tile_t* tile = board_tile(level, x >> TILE_SHIFT, y >> TILE_SHIFT);
+            int cell = tile_cell(x, y);
+            const board_pos_t* pos = board_cell(level, x, y);
+            if (pos->content == 'W') walls[y] |= BIT(x);
+            if (pos->content == 'M') start.ghost_rows[y] |= BIT(x);
+            if (pos->content == 'P') start.pac_rows[y] |= BIT(x);
+            if (pos->has_portal) portals[y] |= BIT(x);
+            if (tile && (tile->dots[cell >> 6] >> (cell & 63)) & 1) start.dots[y] |= BIT(x);
+        }
+    }
+    const pacman_t* pac = &level->pacmans[0];
+    level_rows_t shared = {
+        .width = width, .height = height, .n_ghosts = n_ghosts, .clear_to_win = level->clear_to_win,
+        .walls = walls, .portals = portals, .pac_program = pac->program, .pac_passo = pac->passo,
+        .ghosts = level->ghosts, .heat = level->heat,
+    };
+    start.tick = level->tick;
+    start.result = VALID_MOVE;
+    start.pac_x = pac->pos_x;
+    start.pac_y = pac->pos_y;
+    start.alive = 1;
+    start.points = pac->points;
+    start.dots_left = level->dots_left;
+    start.pac_wake = pac->wake;
+    start.pac_behavior = pac->behavior;
+
+    // The saved copies of the cycle detection, which is left out if they do not fit
+    copy_cycle_t* cycles = calloc(n > 0 ? n : 1, sizeof(copy_cycle_t));
+    uint64_t* saved_rows = malloc((size_t) (n > 0 ? n : 1) * 3 * height * sizeof(uint64_t));
+    copy_ghost_t* saved_ghosts = malloc((size_t) (n > 0 ? n : 1) * (n_ghosts > 0 ? n_ghosts : 1) * sizeof(copy_ghost_t));
+    if (!cycles || !saved_rows || !saved_ghosts) {
+        free(cycles);
+        cycles = NULL;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (cycles) {
+            cycles[i].saved.dots = saved_rows + (size_t) i * 3 * height;
+            cycles[i].saved.ghosts = saved_ghosts + (size_t) i * n_ghosts;
+        }
+        copies[i] = start;
+        copies[i].seed = seeds[i];
+        copies[i].dots = rows + (size_t) i * 3 * height;
+        copies[i].ghost_rows = copies[i].dots + height;
+        copies[i].pac_rows = copies[i].dots + 2 * height;
+        if (i > 0) memcpy(copies[i].dots, start_rows, 3 * height * sizeof(uint64_t));
+        copies[i].ghosts = ghosts + (size_t) i * n_ghosts;
+        for (int g = 0; g < n_ghosts; g++) {
+            const ghost_t* ghost = &level->ghosts[g];
+            copies[i].ghosts[g] = (copy_ghost_t){.x = ghost->pos_x, .y = ghost->pos_y, .charged = ghost->charged,
+                                                 .wake = ghost->wake, .behavior = ghost->behavior};
+        }
+    }
+
+    // One play of every copy still going, then the next
+    for (int playing = n; playing > 0;) {
+        for (int i = 0; i < n; i++) {
+            copy_t* copy = &copies[i];
+            if (copy->done) continue;
+            // Plays in which nobody moves are skipped, as fast_forward does
+            long next = copy_next_event(&shared, copy);
+            copy->tick = next < max_plays ? next : max_plays;
+            if (copy->tick >= max_plays) {
+                copy->done = 1;
+                playing--;
+                continue;
+            }
+            copy->result = copy_play(&shared, copy);
+            if (copy->result == REACHED_PORTAL || copy->result == DEAD_PACMAN) {
+                copy->done = 1;
+                playing--;
+            }
+            else if (cycles) {
+                check_copy(&shared, &cycles[i], copy, max_plays);
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        const copy_t* copy = &copies[i];
+        unsigned long h = 1469598103934665603UL;
+        for (int g = 0; g < n_ghosts; g++) {
+            h = (h ^ (unsigned long) (copy->ghosts[g].y * width + copy->ghosts[g].x)) * 1099511628211UL;
+            h = (h ^ (unsigned long) copy->ghosts[g].charged) * 1099511628211UL;
+        }
+        out[i] = (lockstep_outcome_t){.result = copy->result, .tick = copy->tick, .points = copy->points,
+                                      .dots_left = copy->dots_left, .pac_x = copy->pac_x, .pac_y = copy->pac_y,
+                                      .ghosts = h, .cycle = copy->cycle};
+    }
+
+    free(shared_rows);
+    free(copies);
+    free(rows);
+    free(ghosts);
+    free(cycles);
+    free(saved_rows);
+    free(saved_ghosts);
+    return 0;
+}
@@ -0,0 +1,322 @@
+#define _DEFAULT_SOURCE
+#include "pack.h"
+#include "parser.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <endian.h>
+
+/*A level record loaded in memory*/
+typedef struct {
+    const char* data;
+    size_t size;
+    uint32_t n_files;
+} record_t;
+
+// Helper private function to write all of 'len' bytes at 'offset'
+static int pwrite_all(int fd, const void* data, size_t len, off_t offset) {
+    const char* at = data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, at, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        at += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Helper private function to read all of 'len' bytes at 'offset'
+static int pread_all(int fd, void* data, size_t len, off_t offset) {
+    char* at = data;
+    while (len > 0) {
+        ssize_t n = pread(fd, at, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        at += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Helper private function to append one file to the record being written at '*offset'
+static int put_file(int fd, const char* name, const char* data, size_t len, off_t* offset) {
+    uint32_t name_len = (uint32_t) strlen(name);
+    uint32_t sizes[2] = {htole32(name_len), htole32((uint32_t) len)};
+    if (pwrite_all(fd, sizes, sizeof(sizes), *offset) != 0 ||
+        pwrite_all(fd, name, name_len, *offset + sizeof(sizes)) != 0 ||
+        pwrite_all(fd, data, len, *offset + sizeof(sizes) + name_len) != 0) {
+        return -1;
+    }
+    *offset += sizeof(sizes) + name_len + len;
+    return 0;
+}
+
+// Helper private function that lists the behaviour files a .lvl names, the same way the parser finds them
+static int named_files(const char* data, size_t len, char names[][MAX_FILENAME], int max) {
+    token_reader_t reader = {.data = data, .len = len, .pos = 0};
+    char token[MAX_FILENAME];
+    int n = 0;
+    while (get_next_token(&reader, token, sizeof(token))) {
+        if (strcmp(token, "PAC") == 0) {
+            // The first name is always taken, as the parser does, the next ones while they are .p files
+            size_t mark = reader.pos;
+            for (int first = 1; get_next_token(&reader, token, sizeof(token)); first = 0, mark = reader.pos) {
+                if (!first && strstr(token, ".p") == NULL) {
+                    reader.pos = mark;
+                    break;
+                }
+                int seen = 0;
+                for (int i = 0; i < n && !seen; i++) seen = strcmp(names[i], token) == 0;
+                if (!seen && n < max) snprintf(names[n++], MAX_FILENAME, "%s", token);
+            }
+        }
+        else if (strcmp(token, "MON") == 0) {
+            while (get_next_token(&reader, token, sizeof(token)) && strstr(token, ".m") != NULL) {
+                int seen = 0;
+                for (int i = 0; i < n && !seen; i++) seen = strcmp(names[i], token) == 0;
+                if (!seen && n < max) snprintf(names[n++], MAX_FILENAME, "%s", token);
+            }
+            break; // the map follows
+        }
+    }
+    return n;
+}
+
+// Helper private function for scandir, only level files
+static int is_level_entry(const struct dirent* entry) {
+    return has_lvl_extension(entry->d_name);
+}
+
+int pack_directory(const char* directory, const char* pack_path) {
+    // Unlike load_levels_from_dir there is no MAX_LEVELS here, a pack holds as many as there are
+    struct dirent** files;
+    int n_levels = scandir(directory, &files, is_level_entry, alphasort);
+    if (n_levels <= 0) {
+        fprintf(stderr, "No levels found in %s\n", directory);
+        if (n_levels == 0) free(files);
+        return -1;
+    }
+
+    int fd = open(pack_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    pack_entry_t* index = calloc(n_levels, sizeof(pack_entry_t));
+    if (fd < 0 || !index) {
+        perror(pack_path);
+        if (fd >= 0) close(fd);
+        free(index);
+        for (int i = 0; i < n_levels; i++) free(files[i]);
+        free(files);
+        return -1;
+    }
+
+    // Records go after the index, which is written last
+    off_t offset = sizeof(pack_header_t) + n_levels * sizeof(pack_entry_t);
+    int status = 0;
+    for (int i = 0; i < n_levels && status == 0; i++) {
+        char path[512];
+        size_t len;
+        snprintf(path, sizeof(path), "%s/%s", directory, files[i]->d_name);
+        char* level = read_file(path, &len);
+        if (!level) {
+            perror(path);
+            status = -1;
+            break;
+        }
+
+        index[i].offset = offset;
+        strncpy(index[i].name, files[i]->d_name, PACK_NAME_SIZE - 1); // longer names are cut, index is zeroed
+        status = put_file(fd, files[i]->d_name, level, len, &offset);
+        index[i].n_files = 1;
+
+        char names[MAX_GHOSTS + MAX_PACMANS][MAX_FILENAME];
+        int n_names = named_files(level, len, names, MAX_GHOSTS + MAX_PACMANS);
+        for (int f = 0; f < n_names && status == 0; f++) {
+            size_t file_len;
+            snprintf(path, sizeof(path), "%s/%s", directory, names[f]);
+            char* data = read_file(path, &file_len);
+            if (!data) {
+                perror(path); // left out, the level loads as it would from the directory
+                continue;
+            }
+            status = put_file(fd, names[f], data, file_len, &offset);
+            index[i].n_files++;
+            alloc_free(data);
+        }
+        index[i].size = (uint32_t) (offset - index[i].offset);
+        alloc_free(level);
+    }
+
+    pack_header_t header;
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.n_levels = htole32((uint32_t) n_levels);
+    header.reserved = 0;
+    for (int i = 0; i < n_levels; i++) {
+        index[i].offset = htole64(index[i].offset);
+        index[i].size = htole32(index[i].size);
+        index[i].n_files = htole32(index[i].n_files);
+    }
+    if (status == 0 && (pwrite_all(fd, &header, sizeof(header), 0) != 0 ||
+                        pwrite_all(fd, index, n_levels * sizeof(pack_entry_t), sizeof(header)) != 0)) {
+        status = -1;
+    }
+    if (close(fd) != 0) status = -1;
+    if (status != 0) {
+        fprintf(stderr, "Could not write %s\n", pack_path);
+        unlink(pack_path);
+    }
+    free(index);
+    for (int i = 0; i < n_levels; i++) free(files[i]);
+    free(files);
+    return status;
+}
+
+int open_levels(const char* path, level_set_t* levels) {
+    memset(levels, 0, sizeof(*levels));
+    levels->pack_fd = -1;
+
+    struct stat st;
+    int found = stat(path, &st) == 0;
+    if (found && S_ISDIR(st.st_mode)) {
+        levels->directory = path;
+        levels->files = malloc(MAX_LEVELS * sizeof(*levels->files));
+        if (!levels->files || load_levels_from_dir(path, levels->files, &levels->n_levels) != 0 ||
+            levels->n_levels == 0) {
+            close_levels(levels);
+            return -1;
+        }
+        return 0;
+    }
+
+    // A lone level file is a directory of one level, its .p/.m files next to it
+    if (found && S_ISREG(st.st_mode) && has_lvl_extension(path)) {
+        const char* slash = strrchr(path, '/');
+        levels->level_dir = slash ? strndup(path, slash - path + (slash == path)) : strdup(".");
+        levels->directory = levels->level_dir;
+        levels->files = malloc(sizeof(*levels->files));
+        if (!levels->level_dir || !levels->files) {
+            close_levels(levels);
+            return -1;
+        }
+        snprintf(levels->files[0], sizeof(levels->files[0]), "%s", slash ? slash + 1 : path);
+        levels->n_levels = 1;
+        return 0;
+    }
+
+    pack_header_t header;
+    levels->pack_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (levels->pack_fd < 0 || pread_all(levels->pack_fd, &header, sizeof(header), 0) != 0 ||
+        memcmp(header.magic, PACK_MAGIC, sizeof(header.magic)) != 0 || le32toh(header.n_levels) == 0) {
+        if (levels->pack_fd < 0) perror(path);
+        else fprintf(stderr, "%s is not a level directory nor a level pack\n", path);
+        close_levels(levels);
+        return -1;
+    }
+    levels->n_levels = (int) le32toh(header.n_levels);
+    return 0;
+}
+
+// Helper private function to read the index entry of a level
+static int read_entry(level_set_t* levels, int index, pack_entry_t* entry) {
+    if (index < 0 || index >= levels->n_levels) return -1;
+    off_t at = sizeof(pack_header_t) + (off_t) index * sizeof(pack_entry_t);
+    if (pread_all(levels->pack_fd, entry, sizeof(*entry), at) != 0) return -1;
+    entry->offset = le64toh(entry->offset);
+    entry->size = le32toh(entry->size);
+    entry->n_files = le32toh(entry->n_files);
+    entry->name[PACK_NAME_SIZE - 1] = '\0';
+    return 0;
+}
+
+int level_name(level_set_t* levels, int index, char* name, size_t size) {
+    if (levels->directory) {
+        if (index < 0 || index >= levels->n_levels) return -1;
+        snprintf(name, size, "%s", levels->files[index]);
+        return 0;
+    }
+    pack_entry_t entry;
+    if (read_entry(levels, index, &entry) != 0) return -1;
+    snprintf(name, size, "%s", entry.name);
+    return 0;
+}
+
+// Helper private function to find the next file of a record, '*at' walks over them
+static int next_file(const record_t* record, size_t* at, const char** name, uint32_t* name_len,
+                     const char** data, uint32_t* len) {
+    uint32_t sizes[2];
+    if (*at + sizeof(sizes) > record->size) return -1;
+    memcpy(sizes, record->data + *at, sizeof(sizes));
+    sizes[0] = le32toh(sizes[0]);
+    sizes[1] = le32toh(sizes[1]);
+    if (sizes[0] > record->size - *at - sizeof(sizes) ||
+        sizes[1] > record->size - *at - sizeof(sizes) - sizes[0]) {
+        return -1;
+    }
+    *name = record->data + *at + sizeof(sizes);
+    *name_len = sizes[0];
+    *data = *name + sizes[0];
+    *len = sizes[1];
+    *at += sizeof(sizes) + sizes[0] + sizes[1];
+    return 0;
+}
+
+// Helper private function: the .p/.m files named by a level of a pack are in its record
+static void load_entity_from_record(void* context, const char* name, board_t* board, char type, int index) {
+    const record_t* record = context;
+    size_t at = 0;
+    const char *file_name, *data;
+    uint32_t name_len, len;
+    for (uint32_t f = 0; f < record->n_files && next_file(record, &at, &file_name, &name_len, &data, &len) == 0; f++) {
+        if (f > 0 && name_len == strlen(name) && memcmp(file_name, name, name_len) == 0) {
+            load_entity_from_buffer(data, len, board, type, index);
+            return;
+        }
+    }
+    fprintf(stderr, "%s is not in the level pack\n", name);
+}
+
+int load_level_at(level_set_t* levels, int index, board_t* board) {
+    if (levels->directory) {
+        char full_path[512];
+        if (index < 0 || index >= levels->n_levels) return -1;
+        snprintf(full_path, sizeof(full_path), "%s/%s", levels->directory, levels->files[index]);
+        return load_level_from_file(full_path, board, levels->directory);
+    }
+
+    pack_entry_t entry;
+    if (read_entry(levels, index, &entry) != 0) return -1;
+    char* data = alloc_malloc(ALLOC_PARSER, entry.size ? entry.size : 1);
+    if (!data || pread_all(levels->pack_fd, data, entry.size, entry.offset) != 0) {
+        fprintf(stderr, "Could not read level %s of the pack\n", entry.name);
+        alloc_free(data);
+        return -1;
+    }
+
+    record_t record = {.data = data, .size = entry.size, .n_files = entry.n_files};
+    size_t at = 0;
+    const char *name, *level;
+    uint32_t name_len, len;
+    int result = -1;
+    if (entry.n_files > 0 && next_file(&record, &at, &name, &name_len, &level, &len) == 0) {
+        snprintf(board->level_name, sizeof(board->level_name), "%s", entry.name);
+        result = load_level_from_buffer(level, len, board, load_entity_from_record, &record);
+    }
+    alloc_free(data);
+    return result;
+}
+
+void close_levels(level_set_t* levels) {
+    free(levels->files);
+    free(levels->level_dir);
+    levels->level_dir = NULL;
+    levels->files = NULL;
+    if (levels->pack_fd >= 0) close(levels->pack_fd);
+    levels->pack_fd = -1;
+}
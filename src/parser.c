@@ -1,7 +1,10 @@
 #define _DEFAULT_SOURCE
-#include "../include/board.h" // Adjust the path to the correct location of board.h
-#include "../include/display.h"
+#include "parser.h"
+#include "behavior.h"
+#include "batchread.h"
+#include "alloc.h"
 #include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
@@ -9,16 +12,25 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-int get_next_token(int fd, char *buffer, int max_len)
+#define MAP_PARALLEL_CELLS (1 << 20) // abaixo disto o mapa é lido por uma só thread
+#define MAP_MIN_ROWS_PER_THREAD 64
+#define MAX_MAP_THREADS 16
+
+int get_next_token(token_reader_t *reader, char *buffer, int max_len)
 {
-    char c;
     int idx = 0;
     int in_comment = 0;
-    int bytes_read;
 
-    while ((bytes_read = read(fd, &c, 1)) > 0)
+    while (reader->pos < reader->len)
     {
+        char c = reader->data[reader->pos++];
+
         // Tratamento de comentários
         if (c == '#')
         {
@@ -33,7 +45,7 @@ int get_next_token(int fd, char *buffer, int max_len)
         }
 
         // Se for espaço (space, tab, newline)
-        if (isspace(c))
+        if (isspace((unsigned char)c))
         {
             if (idx > 0)
             {
@@ -60,44 +72,50 @@ int get_next_token(int fd, char *buffer, int max_len)
     return 0; // EOF
 }
 
-void load_entity_behavior(const char *path, board_t *board, char type, int index)
+char *read_file(const char *path, size_t *len)
 {
     int fd = open(path, O_RDONLY);
     if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && (data = alloc_malloc(ALLOC_PARSER, st.st_size + 1)) != NULL)
     {
-        char err_msg[256];
-        snprintf(err_msg, sizeof(err_msg), "Erro ao abrir ficheiro de entidade %s", path);
-        perror(err_msg);
-        return;
+        size_t got = 0;
+        ssize_t n;
+        while (got < (size_t)st.st_size && ((n = read(fd, data + got, st.st_size - got)) > 0 || (n < 0 && errno == EINTR)))
+        {
+            if (n > 0)
+                got += n;
+        }
+        data[got] = '\0';
+        *len = got;
     }
+    close(fd);
+    return data;
+}
 
+void load_entity_from_buffer(const char *data, size_t len, board_t *board, char type, int index)
+{
+    token_reader_t reader = {.data = data, .len = len, .pos = 0};
     char token[128];
     pacman_t *p = NULL;
     ghost_t *g = NULL;
-    command_t *moves_array = NULL;
-    int *n_moves_ptr = NULL;
+    behavior_compiler_t compiler;
+    behavior_compiler_init(&compiler);
 
     if (type == 'P')
-    {
         p = &board->pacmans[index];
-        moves_array = p->moves;
-        n_moves_ptr = &p->n_moves;
-        p->n_moves = 0; // Reset
-    }
     else
-    {
         g = &board->ghosts[index];
-        moves_array = g->moves;
-        n_moves_ptr = &g->n_moves;
-        g->n_moves = 0; // Reset
-    }
 
-    while (get_next_token(fd, token, sizeof(token)))
+    while (get_next_token(&reader, token, sizeof(token)))
     {
         if (strcmp(token, "PASSO") == 0)
         {
             char val[16];
-            get_next_token(fd, val, sizeof(val));
+            get_next_token(&reader, val, sizeof(val));
             if (type == 'P')
                 p->passo = atoi(val);
             else
@@ -106,8 +124,8 @@ void load_entity_behavior(const char *path, board_t *board, char type, int index
         else if (strcmp(token, "POS") == 0)
         {
             char row[16], col[16];
-            get_next_token(fd, row, sizeof(row));
-            get_next_token(fd, col, sizeof(col));
+            get_next_token(&reader, row, sizeof(row));
+            get_next_token(&reader, col, sizeof(col));
             if (type == 'P')
             {
                 p->pos_y = atoi(row);
@@ -122,83 +140,468 @@ void load_entity_behavior(const char *path, board_t *board, char type, int index
         }
         else
         {
+            // Os comandos (e contagens, REP, IF...) são compilados para bytecode à medida que são lidos
+            behavior_compile_token(&compiler, token);
+        }
+    }
 
-            if (*n_moves_ptr < MAX_MOVES)
-            {
-                char cmd = token[0];
-                int turns = 1;
-                if (cmd == 'T')
-                {
-                    if (strlen(token) > 1)
-                    {
-                        // Exemplo: T2
-                        turns = atoi(token + 1);
-                    }
-                    else
-                    {
-                        char duration_token[16];
-                        if (get_next_token(fd, duration_token, sizeof(duration_token)))
-                        {
-                            turns = atoi(duration_token);
-                        }
-                    }
-                }
+    // Sem comandos o programa é NULL: Pacman manual, monstro parado
+    program_t *program = behavior_compile_finish(&compiler);
+    if (type == 'P')
+    {
+        behavior_release(p->program);
+        p->program = program;
+        memset(&p->behavior, 0, sizeof(p->behavior));
+    }
+    else
+    {
+        behavior_release(g->program);
+        g->program = program;
+        memset(&g->behavior, 0, sizeof(g->behavior));
+    }
+}
 
-                moves_array[*n_moves_ptr].command = cmd;
-                moves_array[*n_moves_ptr].turns = turns;
-                moves_array[*n_moves_ptr].turns_left = turns;
-                (*n_moves_ptr)++;
-            }
+void load_entity_behavior(const char *path, board_t *board, char type, int index)
+{
+    size_t len;
+    char *data = read_file(path, &len);
+    if (!data)
+    {
+        char err_msg[256];
+        snprintf(err_msg, sizeof(err_msg), "Erro ao abrir ficheiro de entidade %s", path);
+        perror(err_msg);
+        return;
+    }
+    load_entity_from_buffer(data, len, board, type, index);
+    alloc_free(data);
+}
+
+int reload_entity_files(board_t *board, const char *base_dir, const char *filename)
+{
+    char full_path[512];
+    snprintf(full_path, sizeof(full_path), "%s/%s", base_dir, filename);
+
+    // O ficheiro é lido para entidades auxiliares: só o programa e o PASSO passam para o jogo,
+    // a posição e o resto do estado ficam como estão
+    pacman_t new_pacman;
+    ghost_t new_ghost;
+    board_t scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    scratch.pacmans = &new_pacman;
+    scratch.ghosts = &new_ghost;
+
+    int patched = 0;
+    for (int i = -board->n_pacmans; i < board->n_ghosts; i++)
+    {
+        // Índices negativos são os Pacmans, -1 é o Pacman 0
+        const char *name = (i < 0) ? board->pacman_files[-i - 1] : board->ghosts_files[i];
+        if (strcmp(name, filename) != 0)
+            continue;
+
+        memset(&new_pacman, 0, sizeof(new_pacman));
+        memset(&new_ghost, 0, sizeof(new_ghost));
+        if (i < 0)
+        {
+            load_entity_behavior(full_path, &scratch, 'P', 0);
+            pacman_t *p = &board->pacmans[-i - 1];
+            behavior_release(p->program);
+            p->program = new_pacman.program;
+            p->passo = new_pacman.passo;
+            memset(&p->behavior, 0, sizeof(p->behavior));
         }
+        else
+        {
+            load_entity_behavior(full_path, &scratch, 'M', 0);
+            ghost_t *g = &board->ghosts[i];
+            behavior_release(g->program);
+            g->program = new_ghost.program;
+            g->passo = new_ghost.passo;
+            memset(&g->behavior, 0, sizeof(g->behavior));
+            if (g->wake < board->tick)
+                g->wake = board->tick; // um monstro que estava parado volta a entrar na agenda já
+        }
+        patched++;
     }
-    close(fd);
+
+    if (patched > 0)
+        schedule_ghosts(board);
+    return patched;
+}
+
+// Helper private function: espaços que o parser ignora dentro de uma linha do mapa
+static inline int is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\v' || c == '\f';
+}
+
+// Helper private function: primeiro '\n' ou '\r' a partir de p, ou end
+static const char *find_line_end(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, nl), _mm_cmpeq_epi8(bytes, cr)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    while (p < end && *p != '\n' && *p != '\r')
+        p++;
+    return p;
+}
+
+// Helper private function: escreve uma célula, tal como o parser sempre fez
+static inline void set_map_cell(board_pos_t *cell, char c)
+{
+    cell->content = (c == 'X') ? 'W' : ' ';
+    cell->has_portal = (c == '@');
+    cell->has_dot = (c == 'o') ? 1 : 0;
+}
+
+// Helper private function: descodifica uma linha do mapa (sem mudanças de linha) para as células da linha y
+static void decode_map_row(board_t *board, int y, const char *p, const char *end)
+{
+    int width = board->width;
+    int col = 0;
+#ifdef __SSE2__
+    // Blocos de 16 bytes sem espaços são classificados de uma vez ('X', 'o' e '@')
+    _Static_assert(TILE_SIZE >= 16 && TILE_SIZE % 16 == 0, "um bloco de 16 células tem de caber num só tile");
+    const __m128i wall = _mm_set1_epi8('X'), dot = _mm_set1_epi8('o'), portal = _mm_set1_epi8('@');
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i vt = _mm_set1_epi8('\v'), ff = _mm_set1_epi8('\f');
+    while (end - p >= 16 && width - col >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(bytes, vt), _mm_cmpeq_epi8(bytes, ff)));
+        if (_mm_movemask_epi8(blank))
+            break; // daqui para a frente, um carácter de cada vez
+        int walls = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, wall));
+        int dots = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, dot));
+        int portals = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, portal));
+        // col é múltiplo de 16, as 16 células ficam seguidas dentro do mesmo tile
+        board_pos_t *cells = touch_cell(board, col, y);
+        if (!cells)
+            return;
+        for (int i = 0; i < 16; i++)
+        {
+            board_pos_t *cell = &cells[i];
+            cell->content = ((walls >> i) & 1) ? 'W' : ' ';
+            cell->has_portal = (portals >> i) & 1;
+            cell->has_dot = (dots >> i) & 1;
+        }
+        p += 16;
+        col += 16;
+    }
+#endif
+    for (; p < end && col < width; p++)
+    {
+        if (is_blank(*p))
+            continue;
+        board_pos_t *cell = touch_cell(board, col++, y);
+        if (!cell)
+            return;
+        set_map_cell(cell, *p);
+    }
+}
+
+/*Linhas do mapa a descodificar por uma thread*/
+typedef struct
+{
+    board_t *board;
+    const char **starts; // início de cada linha, starts[i] é a linha first_row + i
+    const char **ends;
+    int first_row;
+    int from, to;
+} map_job_t;
+
+// Helper private function corrida por cada thread de parse_map_rows
+static void *decode_map_rows(void *arg)
+{
+    map_job_t *job = arg;
+    for (int i = job->from; i < job->to; i++)
+        decode_map_row(job->board, job->first_row + i, job->starts[i], job->ends[i]);
+    return NULL;
+}
+
+// Helper private function: primeira linha (índice em starts) da thread t, acertada a um múltiplo de
+// TILE_SIZE * CHUNK_SIZE no tabuleiro para que nenhum bloco da tabela (nem tile) seja escrito por duas threads
+static int band_start(int found, int first_row, int t, int n_threads)
+{
+    if (t == 0)
+        return 0;
+    if (t == n_threads)
+        return found;
+    const int band = TILE_SIZE * CHUNK_SIZE;
+    int row = (first_row + (int)((long)found * t / n_threads) + band - 1) & ~(band - 1);
+    return row - first_row < found ? row - first_row : found;
+}
+
+void parse_map_rows(board_t *board, int first_row, const char *p, const char *end)
+{
+    int n_rows = board->height - first_row;
+    if (board->width <= 0 || n_rows <= 0)
+        return;
+
+    // 1) Índice das linhas: como no parser byte a byte, linhas só com espaços não contam
+    const char **starts = alloc_malloc(ALLOC_PARSER, n_rows * sizeof(char *));
+    const char **ends = alloc_malloc(ALLOC_PARSER, n_rows * sizeof(char *));
+    if (!starts || !ends)
+    {
+        alloc_free(starts);
+        alloc_free(ends);
+        return;
+    }
+    int found = 0;
+    while (p < end && found < n_rows)
+    {
+        const char *line_end = find_line_end(p, end);
+        const char *q = p;
+        while (q < line_end && is_blank(*q))
+            q++;
+        if (q < line_end)
+        {
+            starts[found] = q;
+            ends[found] = line_end;
+            found++;
+        }
+        p = line_end + 1;
+    }
+
+    // 2) Descodificação: as linhas são independentes, cada thread fica com um bloco delas
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_threads = 1;
+    if ((long)found * board->width >= MAP_PARALLEL_CELLS && cores > 1)
+    {
+        n_threads = (int)(cores < MAX_MAP_THREADS ? cores : MAX_MAP_THREADS);
+        if (n_threads > found / MAP_MIN_ROWS_PER_THREAD)
+            n_threads = found / MAP_MIN_ROWS_PER_THREAD > 0 ? found / MAP_MIN_ROWS_PER_THREAD : 1;
+    }
+
+    map_job_t jobs[MAX_MAP_THREADS];
+    pthread_t threads[MAX_MAP_THREADS];
+    int started = 0;
+    for (int t = 0; t < n_threads; t++)
+    {
+        jobs[t] = (map_job_t){.board = board, .starts = starts, .ends = ends, .first_row = first_row,
+                              .from = band_start(found, first_row, t, n_threads),
+                              .to = band_start(found, first_row, t + 1, n_threads)};
+        if (t > 0 && pthread_create(&threads[t], NULL, decode_map_rows, &jobs[t]) == 0)
+            started |= 1 << t;
+    }
+    decode_map_rows(&jobs[0]); // a thread principal também trabalha
+    for (int t = 1; t < n_threads; t++)
+    {
+        if (started & (1 << t))
+            pthread_join(threads[t], NULL);
+        else
+            decode_map_rows(&jobs[t]); // sem thread, faz-se aqui
+    }
+
+    alloc_free(starts);
+    alloc_free(ends);
 }
 
+/*Ficheiro .p/.m pedido por um nível, carregado depois de lido o .lvl todo*/
+typedef struct
+{
+    const char *name;
+    char type;
+    int index;
+} entity_request_t;
+
+typedef void (*entities_loader_t)(void *context, const entity_request_t *requests, int n, board_t *board);
+
+typedef struct
+{
+    entity_loader_t load_entity;
+    void *context;
+} one_by_one_t;
+
+// Helper private function: os ficheiros são entregues um a um ao entity_loader_t de quem carrega o nível
+static void load_entities_one_by_one(void *context, const entity_request_t *requests, int n, board_t *board)
+{
+    one_by_one_t *loader = context;
+    for (int i = 0; i < n; i++)
+        loader->load_entity(loader->context, requests[i].name, board, requests[i].type, requests[i].index);
+}
+
+typedef struct
+{
+    board_t *board;
+    const entity_request_t *requests;
+    int n_requests;
+    batch_file_t *files;
+    const char **names; // nome de cada ficheiro do lote, como aparece no nível
+} entity_batch_t;
+
+// Helper private function: cada ficheiro lido é logo descodificado para as entidades que o usam
+// Com o fallback de threads corre em várias threads, mas cada uma mexe só nas entidades do seu ficheiro
+static void parse_entity_file(void *context, batch_file_t *file)
+{
+    entity_batch_t *batch = context;
+    const char *name = batch->names[file - batch->files];
+    for (int i = 0; i < batch->n_requests; i++)
+    {
+        const entity_request_t *request = &batch->requests[i];
+        if (strcmp(request->name, name) != 0)
+            continue;
+        if (!file->data)
+        {
+            char err_msg[600];
+            snprintf(err_msg, sizeof(err_msg), "Erro ao abrir ficheiro de entidade %s", file->path);
+            errno = file->error;
+            perror(err_msg);
+            continue;
+        }
+        load_entity_from_buffer(file->data, file->len, batch->board, request->type, request->index);
+    }
+    alloc_free(file->data);
+    file->data = NULL;
+}
+
+// Helper private function: os ficheiros .p/.m de um nível lido de uma diretoria estão nessa diretoria,
+// e são lidos todos de uma vez (cada ficheiro uma só vez, mesmo que vários monstros o usem)
+static void load_entities_from_dir(void *context, const entity_request_t *requests, int n, board_t *board)
+{
+    char paths[MAX_PACMANS + MAX_GHOSTS][512];
+    const char *names[MAX_PACMANS + MAX_GHOSTS];
+    batch_file_t files[MAX_PACMANS + MAX_GHOSTS];
+    int n_files = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        int known = 0;
+        for (int f = 0; f < n_files && !known; f++)
+            known = strcmp(names[f], requests[i].name) == 0;
+        if (known)
+            continue;
+        names[n_files] = requests[i].name;
+        snprintf(paths[n_files], sizeof(paths[n_files]), "%s/%s", (const char *)context, requests[i].name);
+        files[n_files].path = paths[n_files];
+        n_files++;
+    }
+
+    entity_batch_t batch = {.board = board, .requests = requests, .n_requests = n, .files = files, .names = names};
+    batch_read(files, n_files, parse_entity_file, &batch);
+}
+
+static int parse_level(const char *data, size_t len, board_t *board, entities_loader_t load_entities, void *context);
+
 int load_level_from_file(const char *filepath, board_t *board, const char *base_dir)
 {
-    int fd = open(filepath, O_RDONLY);
-    if (fd < 0)
+    size_t len;
+    char *data = read_file(filepath, &len);
+    if (!data)
     {
         perror("Erro ao abrir ficheiro de nível");
         return -1;
     }
 
+    // O nome do nível é o do ficheiro, sem a diretoria
+    const char *slash = strrchr(filepath, '/');
+    snprintf(board->level_name, sizeof(board->level_name), "%s", slash ? slash + 1 : filepath);
+
+    int result = parse_level(data, len, board, load_entities_from_dir, (void *)base_dir);
+    alloc_free(data);
+    return result;
+}
+
+int load_level_from_buffer(const char *data, size_t len, board_t *board, entity_loader_t load_entity, void *context)
+{
+    one_by_one_t loader = {.load_entity = load_entity, .context = context};
+    return parse_level(data, len, board, load_entities_one_by_one, &loader);
+}
+
+// Helper private function: lê o .lvl e só depois carrega os ficheiros das entidades, todos juntos
+static int parse_level(const char *data, size_t len, board_t *board, entities_loader_t load_entities, void *context)
+{
+    entity_request_t requests[MAX_PACMANS + MAX_GHOSTS];
+    int n_requests = 0;
+    token_reader_t reader = {.data = data, .len = len, .pos = 0};
     char token[128];
     // Valores default
     board->n_pacmans = 0;
     board->n_ghosts = 0;
-    board->pacman_file[0] = '\0';
-
-    while (get_next_token(fd, token, sizeof(token)))
+    board->pacman_files[0][0] = '\0';
+    board->seed = (unsigned int)rand();
+    board->tick = 0;
+    board->chunks = NULL;
+    board->chunks_x = board->chunks_y = 0;
+    board->tiles_x = board->tiles_y = 0;
+    board->pacmans = NULL;
+    board->ghosts = NULL;
+    board->journal = NULL;
+    board->heat = NULL;
+    board->changes = NULL;
+    board->clear_to_win = 0;
+    board->simultaneous = 0;
+
+    while (get_next_token(&reader, token, sizeof(token)))
     {
         if (strcmp(token, "DIM") == 0)
         {
             char h[16], w[16]; // altura e largura
-            get_next_token(fd, h, sizeof(h));
-            get_next_token(fd, w, sizeof(w));
+            get_next_token(&reader, h, sizeof(h));
+            get_next_token(&reader, w, sizeof(w));
             board->height = atoi(h);
             board->width = atoi(w);
-            // Alocar memória
-            board->board = calloc(board->width * board->height, sizeof(board_pos_t));
-            // max 1 pacman
-            board->pacmans = calloc(1, sizeof(pacman_t));
-            board->ghosts = calloc(MAX_GHOSTS, sizeof(ghost_t));
+            // Alocar memória: a tabela dos tiles tem um ponteiro por bloco de CHUNK_SIZE x CHUNK_SIZE tiles,
+            // as células só ocupam memória quando não estão em branco
+            board->pacmans = alloc_calloc(ALLOC_PARSER, MAX_PACMANS, sizeof(pacman_t));
+            board->ghosts = alloc_calloc(ALLOC_PARSER, MAX_GHOSTS, sizeof(ghost_t));
+            if (init_tiles(board) != 0 || !board->pacmans || !board->ghosts)
+            {
+                fprintf(stderr, "Erro: sem memória para o nível %s de %dx%d células\n", board->level_name,
+                        board->height, board->width);
+                unload_level(board);
+                return -1;
+            }
         }
         else if (strcmp(token, "TEMPO") == 0)
         {
             char t[16];
-            get_next_token(fd, t, sizeof(t));
+            get_next_token(&reader, t, sizeof(t));
             board->tempo = atoi(t);
         }
+        else if (strcmp(token, "LIMPAR") == 0)
+        {
+            // O nível também se ganha comendo todos os pontos
+            board->clear_to_win = 1;
+        }
+        else if (strcmp(token, "SIMULTANEO") == 0)
+        {
+            // Os monstros mexem-se todos ao mesmo tempo, ver resolve_ghosts
+            board->simultaneous = 1;
+        }
         else if (strcmp(token, "PAC") == 0)
         {
-            get_next_token(fd, board->pacman_file, sizeof(board->pacman_file));
-            board->n_pacmans = 1;
+            // Um Pacman por ficheiro .p: o primeiro token é sempre o do Pacman 0, os seguintes só se forem .p
+            while (1)
+            {
+                char temp_token[128];
+                size_t mark = reader.pos;
 
-            // Carregar comportamento do Pacman
-            char full_path[512];
-            snprintf(full_path, sizeof(full_path), "%s/%s", base_dir, board->pacman_file);
-            load_entity_behavior(full_path, board, 'P', 0);
+                if (!get_next_token(&reader, temp_token, sizeof(temp_token)))
+                    break;
+                if (board->n_pacmans > 0 && strstr(temp_token, ".p") == NULL)
+                {
+                    reader.pos = mark; // não é um Pacman, fica para o ciclo principal
+                    break;
+                }
+
+                if (board->n_pacmans < MAX_PACMANS)
+                {
+                    strcpy(board->pacman_files[board->n_pacmans], temp_token);
+
+                    // O comportamento do Pacman é carregado no fim, com os dos monstros
+                    requests[n_requests++] = (entity_request_t){board->pacman_files[board->n_pacmans], 'P', board->n_pacmans};
+
+                    board->n_pacmans++;
+                }
+            }
         }
         else if (strcmp(token, "MON") == 0)
         {
@@ -206,7 +609,7 @@ int load_level_from_file(const char *filepath, board_t *board, const char *base_
             {
                 char temp_token[128];
 
-                if (!get_next_token(fd, temp_token, sizeof(temp_token)))
+                if (!get_next_token(&reader, temp_token, sizeof(temp_token)))
                     break;
 
                 if (strstr(temp_token, ".m") != NULL)
@@ -215,9 +618,7 @@ int load_level_from_file(const char *filepath, board_t *board, const char *base_
                     {
                         strcpy(board->ghosts_files[board->n_ghosts], temp_token);
 
-                        char full_path[512];
-                        snprintf(full_path, sizeof(full_path), "%s/%s", base_dir, temp_token);
-                        load_entity_behavior(full_path, board, 'M', board->n_ghosts);
+                        requests[n_requests++] = (entity_request_t){board->ghosts_files[board->n_ghosts], 'M', board->n_ghosts};
 
                         board->n_ghosts++;
                     }
@@ -231,14 +632,9 @@ int load_level_from_file(const char *filepath, board_t *board, const char *base_
                     // Processar a primeira linha (temp_token)
                     for (size_t i = 0; i < strlen(temp_token) && col < board->width; i++)
                     {
-                        char c = temp_token[i];
-                        int idx = row * board->width + col;
-                        if (idx < board->width * board->height)
-                        {
-                            board->board[idx].content = (c == 'X') ? 'W' : ' ';
-                            board->board[idx].has_portal = (c == '@');
-                            board->board[idx].has_dot = (c == 'o') ? 1 : 0;
-                        }
+                        board_pos_t *cell = row < board->height ? touch_cell(board, col, row) : NULL;
+                        if (cell)
+                            set_map_cell(cell, temp_token[i]);
                         col++;
                     }
 
@@ -246,36 +642,9 @@ int load_level_from_file(const char *filepath, board_t *board, const char *base_
                     row++;
                     col = 0;
 
-                    // Ler o resto do mapa linha por linha
-                    char c;
-                    while (read(fd, &c, 1) > 0 && row < board->height)
-                    {
-                        if (c == '\n' || c == '\r')
-                        {
-                            // Nova linha
-                            if (col > 0)
-                            {
-                                row++;
-                                col = 0;
-                            }
-                            continue;
-                        }
-
-                        if (isspace(c))
-                            continue;
-
-                        if (col < board->width)
-                        {
-                            int idx = row * board->width + col;
-                            if (idx < board->width * board->height)
-                            {
-                                board->board[idx].content = (c == 'X') ? 'W' : ' ';
-                                board->board[idx].has_portal = (c == '@');
-                                board->board[idx].has_dot = (c == 'o') ? 1 : 0;
-                            }
-                            col++;
-                        }
-                    }
+                    // O resto do mapa é descodificado por linhas, em paralelo nos mapas grandes
+                    if (row < board->height)
+                        parse_map_rows(board, row, reader.data + reader.pos, reader.data + reader.len);
                     break; // Sai do loop MON
                 }
             }
@@ -283,18 +652,34 @@ int load_level_from_file(const char *filepath, board_t *board, const char *base_
         }
     }
 
+    // Tiles todos em branco deixam de ser guardados, os uniformes (só parede, só chão) passam a ser partilhados
+    if (board->chunks)
+        compact_tiles(board);
+
+    if (n_requests > 0)
+        load_entities(context, requests, n_requests, board);
+
     // Se não houver ficheiro .p, o Pacman é manual
     if (board->n_pacmans == 0)
     {
         // assumindo pos 1,1 como default caso n seja especificada
         board->n_pacmans = 1;
-        board->pacmans[0].n_moves = 0; // Manual
+        board->pacmans[0].program = NULL; // Manual
         board->pacmans[0].alive = 1;
         board->pacmans[0].pos_x = 1;
         board->pacmans[0].pos_y = 1;
     }
 
-    close(fd);
+    // Agenda dos monstros com comandos, todos começam a mexer-se na primeira jogada
+    schedule_ghosts(board);
+
+    // Pontos e casas visitadas passam a ser contados jogada a jogada, sem voltar a percorrer o mapa
+    if (board->chunks && (place_pacmans(board) != 0 || init_progress(board) != 0))
+    {
+        fprintf(stderr, "Erro: sem memória para as estatísticas do nível %s\n", board->level_name);
+        unload_level(board);
+        return -1;
+    }
     return 0;
 }
 
@@ -310,11 +695,14 @@ int load_levels_from_dir(const char *levels_directory, char level_files[][MAX_FI
     int n;
 
     // Usa scandir com 'alphasort' para garantir q vai ler 1.lvl, 2.lvl por ordem
+    // As entradas são alocadas pelo malloc do scandir, contadas como do parser (ver alloc.h)
+    alloc_subsystem_t charged = alloc_charge(ALLOC_PARSER);
     n = scandir(levels_directory, &namelist, NULL, alphasort);
 
     if (n < 0)
     {
         perror("Erro ao fazer leitura da diretoria");
+        alloc_charge(charged);
         return -1;
     }
 
@@ -335,6 +723,7 @@ int load_levels_from_dir(const char *levels_directory, char level_files[][MAX_FI
         free(namelist[i]); // Liberta a memória alocada pelo scandir para cada entrada
     }
     free(namelist); // Liberta a lista
+    alloc_charge(charged);
 
     return 0;
 }
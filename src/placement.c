@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_perf_event_open)
+#include <linux/perf_event.h>
+#define HAVE_PERF_EVENTS 1
+#endif
+
+#define MAX_NODES 64
+
+// The region, cut into one slice per worker. Set before the workers start and cleared after they are done
+static char* region = NULL;
+static size_t region_size = 0;
+static int n_slices = 0;
+static size_t* peaks = NULL;    // bytes of each slice handed out at most
+
+// Cores in the order the workers get them, one node after the other
+static int* cores = NULL;
+static int n_cores = 0;
+static int n_nodes = 0;
+static cpu_set_t original; // affinity of the process before placement_init
+
+// Slice of the calling worker
+static _Thread_local struct {
+    char *start, *next, *end;
+    char* touched;  // past the last byte ever handed out: the pages from here on are still zero
+    int worker;
+} slice;
+
+// Helper private function: the node of each core of 'cpulist' ("0-3,8,10-11"), as read from sysfs
+static void read_cpulist(const char* cpulist, int node, int* node_of, int max_cpu) {
+    const char* p = cpulist;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < max_cpu; cpu++) {
+            if (cpu >= 0) node_of[cpu] = node;
+        }
+        p = *end == ',' ? end + 1 : end;
+        if (*p == '\n') break;
+    }
+}
+
+// Helper private function: orders the cores this process may run on so that consecutive workers land on
+// different nodes (a host without /sys/devices/system/node is taken as one node)
+static int order_cores(void) {
+    if (sched_getaffinity(0, sizeof(original), &original) != 0) return -1;
+    int node_of[CPU_SETSIZE];
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) node_of[cpu] = 0;
+    n_nodes = 1;
+    for (int node = 0; node < MAX_NODES; node++) {
+        char path[64], cpulist[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* file = fopen(path, "r");
+        if (!file) continue;
+        if (fgets(cpulist, sizeof(cpulist), file)) {
+            read_cpulist(cpulist, node, node_of, CPU_SETSIZE);
+            if (node + 1 > n_nodes) n_nodes = node + 1;
+        }
+        fclose(file);
+    }
+
+    cores = malloc(CPU_SETSIZE * sizeof(int));
+    if (!cores) return -1;
+    n_cores = 0;
+    int used[MAX_NODES] = {0}; // cores of each node given a place so far
+    int placed = 1;
+    while (placed) {
+        placed = 0;
+        for (int node = 0; node < n_nodes; node++) {
+            int seen = 0;
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, &original) || node_of[cpu] != node) continue;
+                if (seen++ == used[node]) {
+                    cores[n_cores++] = cpu;
+                    used[node]++;
+                    placed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Nodes with none of our cores do not count
+    int nodes = 0;
+    for (int node = 0; node < n_nodes; node++) nodes += used[node] > 0;
+    n_nodes = nodes;
+    return n_cores > 0 ? 0 : -1;
+}
+
+// Helper private function: maps 'size' bytes of 2MB pages, from hugetlbfs or else as transparent huge pages
+static placement_pages_t map_region(size_t size) {
+#ifdef MAP_HUGETLB
+    void* pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pages != MAP_FAILED) {
+        region = pages;
+        return PAGES_HUGETLB;
+    }
+#endif
+    // One huge page more than needed, so that the region can start on a huge page boundary
+    size_t mapped = size + PLACEMENT_HUGE_PAGE;
+    char* pages_4k = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pages_4k == MAP_FAILED) return PAGES_NONE;
+    char* start = (char*) (((uintptr_t) pages_4k + PLACEMENT_HUGE_PAGE - 1) & ~(PLACEMENT_HUGE_PAGE - 1));
+    if (start > pages_4k) munmap(pages_4k, start - pages_4k);
+    if (start + size < pages_4k + mapped) munmap(start + size, pages_4k + mapped - (start + size));
+    region = start;
+#ifdef MADV_HUGEPAGE
+    if (madvise(region, size, MADV_HUGEPAGE) == 0) return PAGES_THP;
+#endif
+    return PAGES_PLAIN; // still placed by first touch
+}
+
+placement_pages_t placement_init(int n_workers) {
+    if (n_workers < 1) n_workers = 1;
+    if (order_cores() != 0) n_cores = 0;
+
+    peaks = calloc(n_workers, sizeof(size_t));
+    if (!peaks) return PAGES_NONE;
+    placement_pages_t pages = map_region((size_t) n_workers * PLACEMENT_SLICE);
+    if (!region) {
+        free(peaks);
+        peaks = NULL;
+        return PAGES_NONE;
+    }
+    region_size = (size_t) n_workers * PLACEMENT_SLICE;
+    n_slices = n_workers;
+    return pages;
+}
+
+int placement_join(int worker) {
+    memset(&slice, 0, sizeof(slice));
+    slice.worker = worker;
+    if (region && worker >= 0 && worker < n_slices) {
+        slice.start = slice.next = slice.touched = region + (size_t) worker * PLACEMENT_SLICE;
+        slice.end = slice.start + PLACEMENT_SLICE;
+    }
+    if (n_cores == 0) return -1;
+    int cpu = cores[worker % n_cores];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? cpu : -1;
+}
+
+void placement_reset(void) {
+    slice.next = slice.start;
+}
+
+void placement_end(void) {
+    if (region) munmap(region, region_size);
+    region = NULL;
+    region_size = 0;
+    n_slices = 0;
+    free(peaks);
+    peaks = NULL;
+    memset(&slice, 0, sizeof(slice));
+    if (n_cores > 0) sched_setaffinity(0, sizeof(original), &original);
+    free(cores);
+    cores = NULL;
+    n_cores = 0;
+}
+
+int placement_nodes(void) {
+    return n_nodes;
+}
+
+size_t placement_used(void) {
+    size_t used = 0;
+    for (int s = 0; s < n_slices; s++) used += peaks[s];
+    return used;
+}
+
+// Helper private function: a block of the calling worker's slice, NULL if it has no room for 'size' bytes
+static char* slice_block(size_t size) {
+    size_t rounded = (size + PLACEMENT_ALIGN - 1) & ~(size_t) (PLACEMENT_ALIGN - 1);
+    if (!slice.start || rounded < size || rounded > (size_t) (slice.end - slice.next)) return NULL;
+    char* block = slice.next;
+    slice.next += rounded;
+    if (slice.next > slice.touched) slice.touched = slice.next;
+    size_t used = slice.next - slice.start;
+    if (used > peaks[slice.worker]) peaks[slice.worker] = used;
+    return block;
+}
+
+void* placement_alloc(size_t size) {
+    char* block = slice_block(size);
+    return block ? block : alloc_malloc(ALLOC_BOARD, size);
+}
+
+void* placement_calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) return NULL;
+    char* before = slice.touched;
+    char* block = slice_block(n * size);
+    if (!block) return alloc_calloc(ALLOC_BOARD, n, size); // calloc, which knows when its pages are still zero
+    if (block < before) {
+        // Only what an earlier level used needs clearing, the pages past it were never written
+        size_t dirty = (size_t) (before - block);
+        memset(block, 0, dirty < n * size ? dirty : n * size);
+    }
+    return block;
+}
+
+void placement_free(void* block) {
+    if ((char*) block >= region && (char*) block < region + region_size) return; // goes with placement_reset
+    alloc_free(block);
+}
+
+int tlb_counter_open(void) {
+#ifdef HAVE_PERF_EVENTS
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+unsigned long long tlb_counter_close(int counter) {
+    unsigned long long misses = 0;
+    if (counter < 0) return 0;
+    if (read(counter, &misses, sizeof(misses)) != (ssize_t) sizeof(misses)) misses = 0;
+    close(counter);
+    return misses;
+}
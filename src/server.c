@@ -0,0 +1,802 @@
+#include "server.h"
+#include "pack.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_EVENTS 64
+#define INPUT_BUFFER 4096
+#define MAX_OUTPUT (64 * 1024 * 1024) // clients further behind than this are dropped
+#define MIN_PARALLEL_BATCH 16          // smaller batches are played by the event loop alone
+#define NO_SESSION UINT32_MAX
+
+typedef struct {
+    unsigned char* data;
+    size_t len, cap;
+} buffer_t;
+
+typedef struct session {
+    board_t board;
+    uint32_t id;
+    int fd;               // connection that owns the session, -1 once closed
+    uint32_t tick;        // plays done so far
+    char key;             // key for the next play, '\0' if none arrived
+    char* glyphs;         // what the client shows right now, to compute deltas
+    uint64_t due;         // wheel time (ms) of the next play
+    int outcome;          // VALID_MOVE while the game goes on
+    buffer_t out;         // messages produced by the last play
+    changes_t changes;    // cells the plays wrote since the last message, the only ones a delta looks at
+    struct session* next; // next session in the same wheel slot
+    struct session* conn_prev, * conn_next; // other sessions of the same connection
+} session_t;
+
+typedef struct {
+    int fd;
+    unsigned char in[INPUT_BUFFER];
+    size_t in_len;
+    buffer_t out;
+    int writing;          // whether EPOLLOUT is armed
+    session_t* sessions;  // sessions it owns, linked by conn_prev/conn_next
+} conn_t;
+
+typedef struct {
+    session_t* slots[WHEEL_SLOTS];
+    uint64_t now; // last millisecond processed
+} wheel_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    session_t** batch;
+    int n_batch;
+    atomic_int next;    // next batch entry to play
+    int busy;           // threads still playing the current batch
+    unsigned generation;
+    int stop;
+    int n_threads;
+    pthread_t* threads;
+} pool_t;
+
+typedef struct {
+    board_t* levels;
+    int n_levels;
+    session_t** sessions; // indexed by session id
+    uint32_t* free_ids;
+    int n_free;
+    conn_t* conns[MAX_CONNECTIONS]; // indexed by fd
+    int epoll_fd;
+    wheel_t wheel;
+    pool_t pool;
+} server_t;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void handle_stop(int sig) {
+    (void) sig;
+    server_stop = 1;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Helper private functions to append to growable buffers
+static int buffer_reserve(buffer_t* b, size_t extra) {
+    if (b->len + extra <= b->cap) return 0;
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + extra) cap *= 2;
+    unsigned char* data = realloc(b->data, cap);
+    if (!data) return -1;
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+static int buffer_put(buffer_t* b, const void* data, size_t len) {
+    if (buffer_reserve(b, len) != 0) return -1;
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static inline void put_u16(unsigned char* p, uint16_t v) { memcpy(p, &v, sizeof(v)); }
+static inline void put_u32(unsigned char* p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+static inline uint32_t get_u32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint16_t get_u16(const unsigned char* p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+char cell_glyph(const board_t* board, long index) {
+    const board_pos_t* pos = board_cell_at(board, index);
+    switch (pos->content) {
+        case 'W': return '#';
+        case 'P': return 'C';
+        case 'M': return 'M';
+        case ' ':
+            if (pos->has_portal) return '@';
+            if (pos->has_dot) return '.';
+            return ' ';
+        default:
+            return pos->content;
+    }
+}
+
+// Helper private function to send the whole board, remembering it as what the client shows
+static int write_frame(session_t* s, buffer_t* out) {
+    long size = (long) s->board.width * s->board.height;
+    unsigned char header[MSG_FRAME_HEADER];
+    header[0] = MSG_FRAME;
+    put_u32(header + 1, s->id);
+    put_u16(header + 5, (uint16_t) s->board.width);
+    put_u16(header + 7, (uint16_t) s->board.height);
+    if (buffer_reserve(out, sizeof(header) + size) != 0) return -1;
+    buffer_put(out, header, sizeof(header));
+    for (long i = 0; i < size; i++) {
+        s->glyphs[i] = cell_glyph(&s->board, i);
+    }
+    buffer_put(out, s->glyphs, size);
+    s->changes.n = 0;
+    s->changes.overflow = 0;
+    return 0;
+}
+
+// Helper private function to send only the cells that changed since the last message: those the plays wrote
+static int write_delta(session_t* s, buffer_t* out) {
+    if (s->changes.overflow) return write_frame(s, out); // the list is incomplete, resend everything
+
+    size_t header_at = out->len;
+    if (buffer_reserve(out, MSG_DELTA_HEADER + (size_t) s->changes.n * MSG_DELTA_CELL) != 0) return -1;
+    out->len += MSG_DELTA_HEADER;
+
+    uint32_t n = 0;
+    for (int c = 0; c < s->changes.n; c++) {
+        long i = s->changes.cells[c];
+        char glyph = cell_glyph(&s->board, i);
+        if (glyph == s->glyphs[i]) continue; // written back as it was, or listed twice
+        s->glyphs[i] = glyph;
+
+        unsigned char cell[MSG_DELTA_CELL];
+        put_u32(cell, (uint32_t) i);
+        cell[4] = (unsigned char) glyph;
+        buffer_put(out, cell, sizeof(cell));
+        n++;
+    }
+    s->changes.n = 0;
+
+    unsigned char* header = out->data + header_at;
+    header[0] = MSG_DELTA;
+    put_u32(header + 1, s->id);
+    put_u32(header + 5, s->tick);
+    put_u32(header + 9, (uint32_t) total_points(&s->board));
+    put_u16(header + 13, (uint16_t) n);
+    return 0;
+}
+
+static int write_end(uint32_t id, int outcome, buffer_t* out) {
+    unsigned char msg[MSG_END_SIZE];
+    msg[0] = MSG_END;
+    put_u32(msg + 1, id);
+    msg[5] = (unsigned char) (signed char) outcome;
+    return buffer_put(out, msg, sizeof(msg));
+}
+
+// Helper private function run by the worker threads: one play of one session
+static void play_session(session_t* s) {
+    pacman_t* pac = &s->board.pacmans[0];
+    command_t key = {.command = s->key, .turns = 1};
+    command_t* play = &key; // without a key pacman stays put and the ghosts keep moving
+    if (pac->program) {
+        play = NULL; // scripted, keys are ignored
+    }
+    s->key = '\0';
+
+    int result = play_turn(&s->board, play);
+    s->tick++;
+    if (write_delta(s, &s->out) != 0) {
+        s->out.len = 0; // out of memory, just end the session
+        result = INVALID_MOVE;
+    }
+    else if (result != REACHED_PORTAL && result != DEAD_PACMAN) {
+        return;
+    }
+    s->outcome = result;
+    write_end(s->id, s->outcome, &s->out);
+}
+
+static void play_batch(pool_t* pool) {
+    int i;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->n_batch) {
+        play_session(pool->batch[i]);
+    }
+}
+
+static void* pool_worker(void* arg) {
+    pool_t* pool = (pool_t*) arg;
+    unsigned seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        play_batch(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Helper private function to play a batch of due sessions, the calling thread helps the workers
+static void pool_run(pool_t* pool, session_t** batch, int n) {
+    pool->batch = batch;
+    pool->n_batch = n;
+    atomic_store(&pool->next, 0);
+
+    if (n < MIN_PARALLEL_BATCH || pool->n_threads == 0) {
+        play_batch(pool);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->n_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    play_batch(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void wheel_add(wheel_t* wheel, session_t* s) {
+    session_t** slot = &wheel->slots[s->due % WHEEL_SLOTS];
+    s->next = *slot;
+    *slot = s;
+}
+
+// Helper private function to advance the wheel up to 'target', moving the sessions due by then to 'batch'
+static int wheel_collect(wheel_t* wheel, uint64_t target, session_t** batch) {
+    int n = 0;
+    uint64_t steps = target - wheel->now;
+    if (steps > WHEEL_SLOTS) steps = WHEEL_SLOTS;
+
+    for (uint64_t t = wheel->now + 1; t <= wheel->now + steps; t++) {
+        session_t** link = &wheel->slots[t % WHEEL_SLOTS];
+        while (*link) {
+            session_t* s = *link;
+            if (s->due <= target) { // sessions of later rounds stay in the slot
+                *link = s->next;
+                batch[n++] = s;
+            }
+            else link = &s->next;
+        }
+    }
+    wheel->now = target;
+    return n;
+}
+
+// Helper private function for the epoll timeout: milliseconds until the next non-empty slot
+static int wheel_timeout(const wheel_t* wheel) {
+    for (int d = 1; d <= WHEEL_SLOTS; d++) {
+        if (wheel->slots[(wheel->now + d) % WHEEL_SLOTS]) return d;
+    }
+    return -1;
+}
+
+// Helper private functions for the sessions a connection owns
+static void attach_session(conn_t* conn, session_t* s) {
+    s->fd = conn->fd;
+    s->conn_prev = NULL;
+    s->conn_next = conn->sessions;
+    if (conn->sessions) conn->sessions->conn_prev = s;
+    conn->sessions = s;
+}
+
+// The session stays in the wheel until it comes due, then it is freed instead of played
+static void detach_session(server_t* server, session_t* s) {
+    if (s->fd < 0) return;
+    conn_t* conn = server->conns[s->fd];
+    if (s->conn_prev) s->conn_prev->conn_next = s->conn_next;
+    else conn->sessions = s->conn_next;
+    if (s->conn_next) s->conn_next->conn_prev = s->conn_prev;
+    s->conn_prev = s->conn_next = NULL;
+    s->fd = -1;
+}
+
+static void free_session(server_t* server, session_t* s) {
+    detach_session(server, s);
+    server->sessions[s->id] = NULL;
+    server->free_ids[server->n_free++] = s->id;
+    unload_level(&s->board);
+    free(s->glyphs);
+    free(s->out.data);
+    free(s);
+}
+
+static void open_session(server_t* server, conn_t* conn, uint32_t level) {
+    if (level >= (uint32_t) server->n_levels || server->n_free == 0) {
+        write_end(NO_SESSION, INVALID_MOVE, &conn->out);
+        return;
+    }
+
+    session_t* s = calloc(1, sizeof(session_t));
+    const board_t* template = &server->levels[level];
+    if (!s || !(s->glyphs = malloc((size_t) template->width * template->height)) || clone_board(&s->board, template) != 0) {
+        if (s) free(s->glyphs);
+        free(s);
+        write_end(NO_SESSION, INVALID_MOVE, &conn->out);
+        return;
+    }
+
+    s->id = server->free_ids[--server->n_free];
+    attach_session(conn, s);
+    s->board.changes = &s->changes;
+    s->outcome = VALID_MOVE;
+    s->board.seed = (unsigned int) rand(); // every session gets its own random ghosts
+    server->sessions[s->id] = s;
+
+    write_frame(s, &conn->out);
+    s->due = server->wheel.now + (s->board.tempo > 0 ? s->board.tempo : 1);
+    wheel_add(&server->wheel, s);
+}
+
+// Helper private function to find a session owned by 'conn'
+static session_t* owned_session(server_t* server, conn_t* conn, uint32_t id) {
+    if (id >= MAX_SESSIONS) return NULL;
+    session_t* s = server->sessions[id];
+    return (s && s->fd == conn->fd) ? s : NULL;
+}
+
+static void close_conn(server_t* server, conn_t* conn) {
+    while (conn->sessions) detach_session(server, conn->sessions);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    server->conns[conn->fd] = NULL;
+    free(conn->out.data);
+    free(conn);
+}
+
+// Helper private function to send what is pending, arming EPOLLOUT when the socket is full
+static int flush_conn(server_t* server, conn_t* conn) {
+    size_t sent = 0;
+    while (sent < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.data + sent, conn->out.len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        sent += n;
+    }
+    memmove(conn->out.data, conn->out.data + sent, conn->out.len - sent);
+    conn->out.len -= sent;
+    if (conn->out.len > MAX_OUTPUT) return -1;
+
+    int want_write = conn->out.len > 0;
+    if (want_write != conn->writing) {
+        struct epoll_event ev = {.events = EPOLLIN | (want_write ? EPOLLOUT : 0), .data.fd = conn->fd};
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->writing = want_write;
+    }
+    return 0;
+}
+
+// Helper private function to read and process every complete message of a client
+static int read_conn(server_t* server, conn_t* conn) {
+    ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    if (n <= 0) return -1;
+    conn->in_len += n;
+
+    size_t at = 0;
+    while (at < conn->in_len) {
+        unsigned char* msg = conn->in + at;
+        size_t left = conn->in_len - at;
+        if (msg[0] == MSG_OPEN) {
+            if (left < MSG_OPEN_SIZE) break;
+            open_session(server, conn, get_u32(msg + 1));
+            at += MSG_OPEN_SIZE;
+        }
+        else if (msg[0] == MSG_KEY) {
+            if (left < MSG_KEY_SIZE) break;
+            session_t* s = owned_session(server, conn, get_u32(msg + 1));
+            char key = (char) toupper(msg[5]);
+            if (s && (key == 'W' || key == 'A' || key == 'S' || key == 'D')) s->key = key;
+            at += MSG_KEY_SIZE;
+        }
+        else if (msg[0] == MSG_CLOSE) {
+            if (left < MSG_CLOSE_SIZE) break;
+            session_t* s = owned_session(server, conn, get_u32(msg + 1));
+            if (s) detach_session(server, s);
+            at += MSG_CLOSE_SIZE;
+        }
+        else return -1; // protocol error
+    }
+    memmove(conn->in, conn->in + at, conn->in_len - at);
+    conn->in_len -= at;
+    return 0;
+}
+
+static void accept_conns(server_t* server, int listen_fd) {
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        conn_t* conn = fd < MAX_CONNECTIONS ? calloc(1, sizeof(conn_t)) : NULL;
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        conn->fd = fd;
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        server->conns[fd] = conn;
+    }
+}
+
+// Helper private function to play every session that came due and hand the results to their clients
+static void play_due_sessions(server_t* server, session_t** batch) {
+    int n = wheel_collect(&server->wheel, now_ms(), batch);
+
+    int n_play = 0;
+    for (int i = 0; i < n; i++) {
+        if (batch[i]->fd < 0) free_session(server, batch[i]);
+        else batch[n_play++] = batch[i];
+    }
+
+    pool_run(&server->pool, batch, n_play);
+
+    for (int i = 0; i < n_play; i++) {
+        session_t* s = batch[i];
+        buffer_put(&server->conns[s->fd]->out, s->out.data, s->out.len);
+        s->out.len = 0;
+
+        if (s->outcome != VALID_MOVE) {
+            free_session(server, s);
+            continue;
+        }
+        s->due += s->board.tempo > 0 ? s->board.tempo : 1;
+        if (s->due <= server->wheel.now) s->due = server->wheel.now + 1; // running late, don't pile up
+        wheel_add(&server->wheel, s);
+    }
+}
+
+// Helper private function to load every level once, sessions start from copies
+static int load_templates(server_t* server, const char* levels_path) {
+    level_set_t levels;
+    if (open_levels(levels_path, &levels) != 0) {
+        fprintf(stderr, "No levels found in %s\n", levels_path);
+        return -1;
+    }
+
+    server->levels = calloc(levels.n_levels, sizeof(board_t));
+    int status = server->levels ? 0 : -1;
+    for (int i = 0; i < levels.n_levels && status == 0; i++) {
+        if (load_level_at(&levels, i, &server->levels[i]) != 0) status = -1;
+        else server->n_levels++;
+    }
+    close_levels(&levels);
+    return status;
+}
+
+static int pool_start(pool_t* pool, int n_threads) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->threads = calloc(n_threads > 0 ? n_threads : 1, sizeof(pthread_t));
+    if (!pool->threads) return -1;
+    for (int t = 0; t < n_threads; t++) {
+        if (pthread_create(&pool->threads[t], NULL, pool_worker, pool) != 0) break;
+        pool->n_threads++;
+    }
+    return 0;
+}
+
+static void pool_stop(pool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->n_threads; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+}
+
+int run_server(const char* socket_path, const char* levels_path, int n_workers) {
+    server_t* server = calloc(1, sizeof(server_t));
+    session_t** batch = calloc(MAX_SESSIONS, sizeof(session_t*));
+    int listen_fd = -1;
+    int status = 1;
+
+    if (!server || !batch) goto cleanup;
+    server->epoll_fd = -1;
+    server->sessions = calloc(MAX_SESSIONS, sizeof(session_t*));
+    server->free_ids = malloc(MAX_SESSIONS * sizeof(uint32_t));
+    if (!server->sessions || !server->free_ids || load_templates(server, levels_path) != 0) goto cleanup;
+    for (int id = MAX_SESSIONS - 1; id >= 0; id--) {
+        server->free_ids[server->n_free++] = (uint32_t) id;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, 128) != 0) {
+        perror("socket");
+        goto cleanup;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    server->epoll_fd = epoll_create1(0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = listen_fd};
+    if (server->epoll_fd < 0 || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0) {
+        perror("epoll");
+        goto cleanup;
+    }
+
+    struct sigaction sa = {.sa_handler = handle_stop};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // The event loop plays its share of every batch, so it counts as one of the workers
+    if (pool_start(&server->pool, n_workers - 1) != 0) goto cleanup;
+    server->wheel.now = now_ms();
+    printf("Hosting %d levels on %s with %d workers\n", server->n_levels, socket_path, server->pool.n_threads + 1);
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!server_stop) {
+        int n = epoll_wait(server->epoll_fd, events, MAX_EVENTS, wheel_timeout(&server->wheel));
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_conns(server, listen_fd);
+                continue;
+            }
+            conn_t* conn = server->conns[fd];
+            if (!conn) continue;
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && read_conn(server, conn) != 0) {
+                close_conn(server, conn);
+                continue;
+            }
+            if (flush_conn(server, conn) != 0) close_conn(server, conn);
+        }
+
+        play_due_sessions(server, batch);
+
+        for (int fd = 0; fd < MAX_CONNECTIONS; fd++) {
+            conn_t* conn = server->conns[fd];
+            if (conn && conn->out.len > 0 && !conn->writing && flush_conn(server, conn) != 0) {
+                close_conn(server, conn);
+            }
+        }
+    }
+    pool_stop(&server->pool);
+    status = 0;
+
+cleanup:
+    if (server) {
+        for (int fd = 0; fd < MAX_CONNECTIONS; fd++) {
+            if (server->conns[fd]) close_conn(server, server->conns[fd]);
+        }
+        if (server->sessions) {
+            for (int id = 0; id < MAX_SESSIONS; id++) {
+                if (server->sessions[id]) free_session(server, server->sessions[id]);
+            }
+        }
+        for (int i = 0; i < server->n_levels && server->levels; i++) {
+            unload_level(&server->levels[i]);
+        }
+        if (server->epoll_fd >= 0) close(server->epoll_fd);
+        free(server->levels);
+        free(server->sessions);
+        free(server->free_ids);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    free(server);
+    free(batch);
+    return status;
+}
+
+// Stand-in client
+
+typedef struct {
+    int fd;
+    buffer_t in;
+    uint32_t* live; // sessions this connection is playing
+    int n_live;
+} load_conn_t;
+
+typedef struct {
+    long frames, deltas, cells, ends, refused, bytes;
+} load_stats_t;
+
+static void send_all(int fd, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        data += n;
+        len -= n;
+    }
+}
+
+static void send_open(int fd, uint32_t level) {
+    unsigned char msg[MSG_OPEN_SIZE] = {MSG_OPEN};
+    put_u32(msg + 1, level);
+    send_all(fd, msg, sizeof(msg));
+}
+
+// Helper private function to process every complete message received by the stand-in client
+static void load_client_parse(load_conn_t* conn, load_stats_t* stats, int n_levels) {
+    size_t at = 0;
+    while (at < conn->in.len) {
+        unsigned char* msg = conn->in.data + at;
+        size_t left = conn->in.len - at;
+        size_t size;
+
+        if (msg[0] == MSG_FRAME) {
+            if (left < MSG_FRAME_HEADER) break;
+            size = MSG_FRAME_HEADER + (size_t) get_u16(msg + 5) * get_u16(msg + 7);
+            if (left < size) break;
+            conn->live[conn->n_live++] = get_u32(msg + 1);
+            stats->frames++;
+        }
+        else if (msg[0] == MSG_DELTA) {
+            if (left < MSG_DELTA_HEADER) break;
+            size = MSG_DELTA_HEADER + (size_t) get_u16(msg + 13) * MSG_DELTA_CELL;
+            if (left < size) break;
+            stats->deltas++;
+            stats->cells += get_u16(msg + 13);
+        }
+        else if (msg[0] == MSG_END) {
+            size = MSG_END_SIZE;
+            if (left < size) break;
+            uint32_t id = get_u32(msg + 1);
+            if (id == NO_SESSION) stats->refused++;
+            else {
+                stats->ends++;
+                for (int i = 0; i < conn->n_live; i++) {
+                    if (conn->live[i] == id) {
+                        conn->live[i] = conn->live[--conn->n_live];
+                        break;
+                    }
+                }
+                send_open(conn->fd, (uint32_t) (rand() % n_levels)); // keep the load constant
+            }
+        }
+        else {
+            at = conn->in.len; // garbage, drop it
+            break;
+        }
+        at += size;
+    }
+    memmove(conn->in.data, conn->in.data + at, conn->in.len - at);
+    conn->in.len -= at;
+}
+
+int run_load_client(const char* socket_path, int n_levels, int n_sessions) {
+    const int per_conn = 1024;
+    int n_conns = (n_sessions + per_conn - 1) / per_conn;
+    load_conn_t* conns = calloc(n_conns, sizeof(load_conn_t));
+    struct pollfd* fds = calloc(n_conns, sizeof(struct pollfd));
+    load_stats_t stats = {0};
+    int status = 1;
+    if (!conns || !fds) goto cleanup;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    for (int c = 0; c < n_conns; c++) {
+        conns[c].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        // a session can be reopened before its END is parsed, leave room for that
+        conns[c].live = malloc(2 * per_conn * sizeof(uint32_t));
+        if (conns[c].fd < 0 || !conns[c].live || connect(conns[c].fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+            perror("connect");
+            goto cleanup;
+        }
+        fds[c].fd = conns[c].fd;
+        fds[c].events = POLLIN;
+        for (int s = c * per_conn; s < n_sessions && s < (c + 1) * per_conn; s++) {
+            send_open(conns[c].fd, (uint32_t) (s % n_levels));
+        }
+    }
+
+    uint64_t start = now_ms();
+    uint64_t next_keys = start;
+    const char keys[] = {'W', 'A', 'S', 'D'};
+    while (now_ms() - start < LOAD_CLIENT_SECONDS * 1000) {
+        if (poll(fds, n_conns, 10) < 0 && errno != EINTR) break;
+
+        for (int c = 0; c < n_conns; c++) {
+            if (!(fds[c].revents & (POLLIN | POLLHUP))) continue;
+            if (buffer_reserve(&conns[c].in, 65536) != 0) goto cleanup;
+            ssize_t n = read(conns[c].fd, conns[c].in.data + conns[c].in.len, 65536);
+            if (n <= 0) {
+                fprintf(stderr, "Server closed the connection\n");
+                goto cleanup;
+            }
+            conns[c].in.len += n;
+            stats.bytes += n;
+            load_client_parse(&conns[c], &stats, n_levels);
+        }
+
+        // Every session presses a random key ten times per second
+        if (now_ms() >= next_keys) {
+            next_keys += 100;
+            for (int c = 0; c < n_conns; c++) {
+                unsigned char msgs[MSG_KEY_SIZE * 2 * per_conn];
+                size_t len = 0;
+                for (int i = 0; i < conns[c].n_live; i++, len += MSG_KEY_SIZE) {
+                    msgs[len] = MSG_KEY;
+                    put_u32(msgs + len + 1, conns[c].live[i]);
+                    msgs[len + 5] = (unsigned char) keys[rand() % 4];
+                }
+                send_all(conns[c].fd, msgs, len);
+            }
+        }
+    }
+
+    double seconds = (now_ms() - start) / 1000.0;
+    printf("%d sessions over %d connections for %.1f s\n"
+           "  frames %ld, deltas %ld (%.0f/s), changed cells per delta %.2f\n"
+           "  games ended %ld, sessions refused %ld, %.1f bytes per message on average\n",
+           n_sessions, n_conns, seconds, stats.frames, stats.deltas, stats.deltas / seconds,
+           stats.deltas ? (double) stats.cells / stats.deltas : 0.0, stats.ends, stats.refused,
+           stats.deltas ? (double) stats.bytes / (stats.deltas + stats.frames) : 0.0);
+    status = 0;
+
+cleanup:
+    for (int c = 0; conns && c < n_conns; c++) {
+        if (conns[c].fd > 0) close(conns[c].fd);
+        free(conns[c].in.data);
+        free(conns[c].live);
+    }
+    free(conns);
+    free(fds);
+    return status;
+}
@@ -0,0 +1,256 @@
+#include "shared.h"
+#include "display.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sched.h>
+
+#define SHARED_HEADER_SIZE 64 // header padded to its own cache line
+#define VIEW_FRAME_MS 16      // how long the viewer waits for a key before looking for a new frame
+#define SHARED_READ_TRIES 64  // attempts at a consistent copy before shared_read gives up until the next call
+
+size_t shared_frame_size(int capacity) {
+    size_t size = sizeof(shared_frame_t) + (size_t) capacity * sizeof(board_pos_t);
+    return (size + 63) & ~(size_t) 63;
+}
+
+// Helper private function for the total size of the mapping
+static size_t shared_size(int capacity) {
+    return SHARED_HEADER_SIZE + 2 * shared_frame_size(capacity);
+}
+
+// Helper private function to get one of the two frames
+static shared_frame_t* shared_frame(shared_board_t* shared, unsigned index) {
+    return (shared_frame_t*) ((char*) shared + SHARED_HEADER_SIZE + (index % 2) * shared_frame_size(shared->capacity));
+}
+
+shared_board_t* shared_create(const char* name) {
+    char shm_name[256], fifo_path[256];
+    snprintf(shm_name, sizeof(shm_name), SHARED_NAME_FORMAT, name);
+    snprintf(fifo_path, sizeof(fifo_path), SHARED_FIFO_FORMAT, name);
+
+    int fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    size_t size = shared_size(SHARED_CAPACITY);
+    if (ftruncate(fd, size) != 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(shm_name);
+        return NULL;
+    }
+    shared_board_t* shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(shm_name);
+        return NULL;
+    }
+
+    unlink(fifo_path);
+    if (mkfifo(fifo_path, 0600) != 0) {
+        perror("mkfifo");
+        munmap(shared, size);
+        shm_unlink(shm_name);
+        return NULL;
+    }
+
+    shared->capacity = SHARED_CAPACITY;
+    atomic_init(&shared->latest, 0);
+    atomic_init(&shared->closed, 0);
+    shared->magic = SHARED_MAGIC; // last, viewers check it to know the region is ready
+    return shared;
+}
+
+shared_board_t* shared_attach(const char* name) {
+    char shm_name[256];
+    snprintf(shm_name, sizeof(shm_name), SHARED_NAME_FORMAT, name);
+
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+
+    // Map the header alone first to learn how big the frames are
+    struct stat st;
+    shared_board_t* header = NULL;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= SHARED_HEADER_SIZE) {
+        header = mmap(NULL, SHARED_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (!header || header == MAP_FAILED || header->magic != SHARED_MAGIC ||
+        (size_t) st.st_size < shared_size(header->capacity)) {
+        fprintf(stderr, "%s is not a pacmanist game\n", shm_name);
+        if (header && header != MAP_FAILED) munmap(header, SHARED_HEADER_SIZE);
+        close(fd);
+        return NULL;
+    }
+    size_t size = shared_size(header->capacity);
+    munmap(header, SHARED_HEADER_SIZE);
+
+    shared_board_t* shared = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return shared;
+}
+
+int shared_publish(shared_board_t* shared, board_t* board, int mode) {
+    long cells = (long) board->width * board->height;
+    if (cells > shared->capacity || board->n_ghosts > MAX_GHOSTS) {
+        return -1;
+    }
+
+    // Write the frame readers are not pointed at, seqlock style: odd version while writing
+    unsigned latest = atomic_load_explicit(&shared->latest, memory_order_relaxed);
+    shared_frame_t* frame = shared_frame(shared, latest + 1);
+    atomic_fetch_add_explicit(&frame->version, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    frame->mode = mode;
+    frame->width = board->width;
+    frame->height = board->height;
+    frame->n_pacmans = board->n_pacmans < MAX_PACMANS ? board->n_pacmans : MAX_PACMANS;
+    memcpy(frame->pacmans, board->pacmans, frame->n_pacmans * sizeof(pacman_t));
+    frame->dots_left = board->dots_left;
+    frame->dots_total = board->dots_total;
+    frame->n_ghosts = board->n_ghosts;
+    memcpy(frame->ghosts, board->ghosts, board->n_ghosts * sizeof(ghost_t));
+    memcpy(frame->level_name, board->level_name, sizeof(frame->level_name));
+    flatten_cells(board, frame->cells);
+
+    atomic_fetch_add_explicit(&frame->version, 1, memory_order_release);
+    atomic_store_explicit(&shared->latest, latest + 1, memory_order_release);
+    return 0;
+}
+
+unsigned shared_read(shared_board_t* shared, shared_frame_t* out) {
+    for (int try = 0; try < SHARED_READ_TRIES; try++) {
+        if (try > 0) {
+            if (atomic_load(&shared->closed)) break; // a simulation that died mid-write never finishes the frame
+            sched_yield(); // let the simulation finish the frame
+        }
+        unsigned latest = atomic_load_explicit(&shared->latest, memory_order_acquire);
+        shared_frame_t* frame = shared_frame(shared, latest);
+        unsigned version = atomic_load_explicit(&frame->version, memory_order_acquire);
+        if (version & 1) continue; // being rewritten, the simulation is two frames ahead
+
+        out->mode = frame->mode;
+        out->width = frame->width;
+        out->height = frame->height;
+        out->n_pacmans = frame->n_pacmans;
+        memcpy(out->pacmans, frame->pacmans, sizeof(out->pacmans));
+        out->dots_left = frame->dots_left;
+        out->dots_total = frame->dots_total;
+        out->n_ghosts = frame->n_ghosts;
+        memcpy(out->ghosts, frame->ghosts, sizeof(out->ghosts));
+        memcpy(out->level_name, frame->level_name, sizeof(out->level_name));
+        long cells = (long) out->width * out->height;
+        if (cells < 0 || cells > shared->capacity || out->n_ghosts < 0 || out->n_ghosts > MAX_GHOSTS ||
+            out->n_pacmans < 1 || out->n_pacmans > MAX_PACMANS) {
+            continue; // torn header, the version check would fail anyway
+        }
+        memcpy(out->cells, frame->cells, cells * sizeof(board_pos_t));
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&frame->version, memory_order_relaxed) == version) {
+            out->level_name[sizeof(out->level_name) - 1] = '\0';
+            return latest;
+        }
+    }
+    return 0;
+}
+
+void shared_close(shared_board_t* shared, const char* name, int owner) {
+    if (owner) {
+        char shm_name[256], fifo_path[256];
+        snprintf(shm_name, sizeof(shm_name), SHARED_NAME_FORMAT, name);
+        snprintf(fifo_path, sizeof(fifo_path), SHARED_FIFO_FORMAT, name);
+        atomic_store(&shared->closed, 1);
+        shm_unlink(shm_name); // attached viewers keep their mapping until they notice
+        unlink(fifo_path);
+    }
+    munmap(shared, shared_size(shared->capacity));
+}
+
+int shared_view(const char* name, int control) {
+    shared_board_t* shared = shared_attach(name);
+    if (!shared) return 1;
+
+    int fifo = -1;
+    if (control) {
+        signal(SIGPIPE, SIG_IGN); // a finished simulation shows up as EPIPE instead
+        char fifo_path[256];
+        snprintf(fifo_path, sizeof(fifo_path), SHARED_FIFO_FORMAT, name);
+        fifo = open(fifo_path, O_WRONLY | O_NONBLOCK);
+        if (fifo < 0) {
+            perror("Erro ao abrir o FIFO de teclas");
+            shared_close(shared, name, 0);
+            return 1;
+        }
+    }
+
+    shared_frame_t* frame = malloc(shared_frame_size(shared->capacity));
+    if (!frame) {
+        if (fifo >= 0) close(fifo);
+        shared_close(shared, name, 0);
+        return 1;
+    }
+
+    terminal_init();
+    set_input_delay(VIEW_FRAME_MS);
+
+    board_t view; // draw_board works on a board_t, the frames are copied into its tiles
+    memset(&view, 0, sizeof(view));
+    unsigned shown = 0; // frames are numbered from 1
+    for (;;) {
+        unsigned latest = atomic_load_explicit(&shared->latest, memory_order_acquire);
+        unsigned read = latest != shown ? shared_read(shared, frame) : 0;
+        if (read != 0) {
+            shown = read;
+
+            if (!view.chunks || view.width != frame->width || view.height != frame->height) {
+                release_tiles(&view);
+                view.width = frame->width;
+                view.height = frame->height;
+                if (init_tiles(&view) != 0) break;
+            }
+            if (set_cells(&view, frame->cells) != 0) break;
+            view.n_pacmans = frame->n_pacmans;
+            view.pacmans = frame->pacmans;
+            view.dots_left = frame->dots_left;
+            view.dots_total = frame->dots_total;
+            view.n_ghosts = frame->n_ghosts;
+            view.ghosts = frame->ghosts;
+            memcpy(view.level_name, frame->level_name, sizeof(view.level_name));
+            draw_board(&view, frame->mode);
+            refresh_screen();
+        }
+        else if (atomic_load(&shared->closed)) {
+            break; // the last frame is on screen (or can no longer be read) and no more will come
+        }
+
+        char key = get_input();
+        if (key != '\0' && fifo >= 0 && write(fifo, &key, 1) < 0 && errno == EPIPE) {
+            break;
+        }
+        if (key == 'Q') break;
+    }
+
+    terminal_cleanup();
+    release_tiles(&view);
+    free(frame);
+    if (fifo >= 0) close(fifo);
+    shared_close(shared, name, 0);
+    return 0;
+}
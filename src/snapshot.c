@@ -0,0 +1,155 @@
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+void snapshot_init(snapshot_board_t* snapshots) {
+    atomic_init(&snapshots->current, NULL);
+    atomic_init(&snapshots->epoch, 1);
+    for (int i = 0; i < MAX_SNAPSHOT_READERS; i++) atomic_init(&snapshots->readers[i], 0);
+    atomic_init(&snapshots->slots, 0);
+    snapshots->retired = NULL;
+    snapshots->spares = NULL;
+    snapshots->n_spares = 0;
+}
+
+// Helper private function to free one copy
+static void free_snapshot(snapshot_t* snapshot) {
+    release_tiles(&snapshot->board);
+    free(snapshot);
+}
+
+// Helper private function: moves the retired copies no reader can hold to the spares
+static void reclaim(snapshot_board_t* snapshots) {
+    // Readers that took their copy at epoch e saw every publication up to e
+    unsigned long oldest = 0;
+    for (int i = 0; i < MAX_SNAPSHOT_READERS; i++) {
+        unsigned long entered = atomic_load(&snapshots->readers[i]);
+        if (entered != 0 && (oldest == 0 || entered < oldest)) oldest = entered;
+    }
+
+    snapshot_t** link = &snapshots->retired;
+    while (*link) {
+        snapshot_t* snapshot = *link;
+        if (oldest != 0 && snapshot->retired > oldest) {
+            link = &snapshot->next; // a reader may have taken it before it was replaced
+            continue;
+        }
+        *link = snapshot->next;
+        if (snapshots->n_spares < SNAPSHOT_SPARES) {
+            snapshot->next = snapshots->spares;
+            snapshots->spares = snapshot;
+            snapshots->n_spares++;
+        }
+        else {
+            free_snapshot(snapshot);
+        }
+    }
+}
+
+int snapshot_publish(snapshot_board_t* snapshots, const board_t* board, int mode) {
+    // A spare big enough, or a new copy
+    snapshot_t* snapshot = snapshots->spares;
+    if (snapshot) {
+        snapshots->spares = snapshot->next;
+        snapshots->n_spares--;
+    }
+    else {
+        snapshot = calloc(1, sizeof(snapshot_t));
+        if (!snapshot) return -1;
+    }
+
+    // The copy keeps its tiles from one publication to the next, only the cells are copied into them
+    board_t own = snapshot->board;
+    snapshot->board = *board;
+    snapshot->board.chunks = own.chunks;
+    snapshot->board.chunks_x = own.chunks_x;
+    snapshot->board.chunks_y = own.chunks_y;
+    snapshot->board.tiles_x = own.tiles_x;
+    snapshot->board.tiles_y = own.tiles_y;
+    if (copy_cells(&snapshot->board, board) != 0) {
+        free_snapshot(snapshot);
+        return -1;
+    }
+    snapshot->board.n_pacmans = board->n_pacmans < MAX_PACMANS ? board->n_pacmans : MAX_PACMANS;
+    snapshot->board.n_ghosts = board->n_ghosts < MAX_GHOSTS ? board->n_ghosts : MAX_GHOSTS;
+    memcpy(snapshot->pacmans, board->pacmans, snapshot->board.n_pacmans * sizeof(pacman_t));
+    memcpy(snapshot->ghosts, board->ghosts, snapshot->board.n_ghosts * sizeof(ghost_t));
+    for (int p = 0; p < snapshot->board.n_pacmans; p++) snapshot->pacmans[p].program = NULL;
+    for (int g = 0; g < snapshot->board.n_ghosts; g++) snapshot->ghosts[g].program = NULL;
+    snapshot->board.pacmans = snapshot->pacmans;
+    snapshot->board.ghosts = snapshot->ghosts;
+    snapshot->board.journal = NULL;
+    snapshot->board.heat = NULL;
+    snapshot->board.changes = NULL;
+    snapshot->mode = mode;
+
+    // Swap it in first, then move the epoch on: a reader entering at the new epoch sees the new copy
+    snapshot_t* previous = atomic_load(&snapshots->current);
+    snapshot->number = previous ? previous->number + 1 : 0;
+    atomic_store(&snapshots->current, snapshot);
+    unsigned long epoch = atomic_fetch_add(&snapshots->epoch, 1) + 1;
+    if (previous) {
+        previous->retired = epoch;
+        previous->next = snapshots->retired;
+        snapshots->retired = previous;
+    }
+    reclaim(snapshots);
+    return 0;
+}
+
+int snapshot_reserve(snapshot_board_t* snapshots, const board_t* board) {
+    while (snapshots->n_spares < SNAPSHOT_SPARES) {
+        snapshot_t* snapshot = calloc(1, sizeof(snapshot_t));
+        if (!snapshot) return -1;
+        snapshot->next = snapshots->spares;
+        snapshots->spares = snapshot;
+        snapshots->n_spares++;
+    }
+    for (snapshot_t* snapshot = snapshots->spares; snapshot; snapshot = snapshot->next) {
+        if (copy_cells(&snapshot->board, board) != 0) return -1;
+    }
+    return 0;
+}
+
+int snapshot_join(snapshot_board_t* snapshots) {
+    unsigned slots = atomic_load(&snapshots->slots);
+    for (;;) {
+        int free_slot = -1;
+        for (int i = 0; i < MAX_SNAPSHOT_READERS && free_slot < 0; i++) {
+            if (!(slots & (1u << i))) free_slot = i;
+        }
+        if (free_slot < 0) return -1;
+        if (atomic_compare_exchange_weak(&snapshots->slots, &slots, slots | (1u << free_slot))) return free_slot;
+    }
+}
+
+void snapshot_leave(snapshot_board_t* snapshots, int reader) {
+    atomic_store(&snapshots->readers[reader], 0);
+    atomic_fetch_and(&snapshots->slots, ~(1u << reader));
+}
+
+const snapshot_t* snapshot_acquire(snapshot_board_t* snapshots, int reader) {
+    atomic_store(&snapshots->readers[reader], atomic_load(&snapshots->epoch));
+    return atomic_load(&snapshots->current);
+}
+
+void snapshot_release(snapshot_board_t* snapshots, int reader) {
+    atomic_store(&snapshots->readers[reader], 0);
+}
+
+// Helper private function to free a retired or spare list
+static void free_list(snapshot_t* snapshot) {
+    while (snapshot) {
+        snapshot_t* next = snapshot->next;
+        free_snapshot(snapshot);
+        snapshot = next;
+    }
+}
+
+void snapshot_destroy(snapshot_board_t* snapshots) {
+    snapshot_t* current = atomic_load(&snapshots->current);
+    if (current) free_snapshot(current);
+    free_list(snapshots->retired);
+    free_list(snapshots->spares);
+    snapshot_init(snapshots);
+}
@@ -0,0 +1,368 @@
+#include "solver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+
+#define N_SOLVER_MOVES 4
+#define MIN_STATES_PER_THREAD 8
+
+static const char solver_moves[N_SOLVER_MOVES] = {'W', 'S', 'A', 'D'};
+
+typedef struct {
+    int parent; // previous step of the plan, -1 for the first play
+    char move;  // command played in this step
+} step_t;
+
+typedef struct {
+    board_t board;
+    int valid;          // whether 'board' holds an allocated copy
+    int from;           // index of the beam state this one was expanded from
+    int step;           // last step of the plan that leads to this state
+    int result;         // result of play_turn for the last play
+    unsigned long hash; // fingerprint used to drop duplicated states
+} state_t;
+
+typedef struct {
+    const state_t* beam;
+    state_t* children;
+    int from, to;  // range of beam states expanded by this job
+    long explored;
+} expand_job_t;
+
+typedef struct {
+    int score;
+    int index;
+} candidate_t;
+
+// Helper private function to mix a value into a running hash
+static inline unsigned long mix_hash(unsigned long h, long value) {
+    h ^= (unsigned long) value;
+    h *= 1099511628211UL;
+    return h ^ (h >> 29);
+}
+
+// Helper private function to fingerprint everything that changes how a board will play out
+static unsigned long hash_state(const board_t* board) {
+    const pacman_t* pac = &board->pacmans[0];
+    unsigned long h = 1469598103934665603UL;
+    h = mix_hash(h, pac->pos_x);
+    h = mix_hash(h, pac->pos_y);
+    h = mix_hash(h, pac->points);
+    h = mix_hash(h, pac->wake > board->tick ? pac->wake - board->tick : 0);
+    h = mix_hash(h, board->seed);
+    for (int g = 0; g < board->n_ghosts; g++) {
+        const ghost_t* ghost = &board->ghosts[g];
+        h = mix_hash(h, ghost->pos_x);
+        h = mix_hash(h, ghost->pos_y);
+        h = mix_hash(h, ghost->behavior.pc);
+        for (int d = 0; d < ghost->behavior.depth; d++) {
+            h = mix_hash(h, ghost->behavior.loops[d]);
+        }
+        h = mix_hash(h, ghost->wake > board->tick ? ghost->wake - board->tick : 0);
+        h = mix_hash(h, ghost->charged);
+    }
+    // The other pacmans follow their programs
+    for (int p = 1; p < board->n_pacmans; p++) {
+        const pacman_t* other = &board->pacmans[p];
+        h = mix_hash(h, other->alive ? (long) other->pos_y * board->width + other->pos_x : -1);
+        h = mix_hash(h, other->points);
+        h = mix_hash(h, other->behavior.pc);
+        for (int d = 0; d < other->behavior.depth; d++) {
+            h = mix_hash(h, other->behavior.loops[d]);
+        }
+        h = mix_hash(h, other->wake > board->tick ? other->wake - board->tick : 0);
+    }
+    return h ? h : 1; // 0 marks empty slots of the seen table
+}
+
+// Helper private function that computes, for every cell, the walking distance to the nearest portal
+static int* portal_distances(const board_t* board) {
+    long size = (long) board->width * board->height;
+    int unreachable = size < INT_MAX ? (int) size : INT_MAX;
+    int* dist = malloc(size * sizeof(int));
+    long* queue = malloc(size * sizeof(long));
+    if (!dist || !queue) {
+        free(dist);
+        free(queue);
+        return NULL;
+    }
+
+    long head = 0, tail = 0;
+    for (long i = 0; i < size; i++) {
+        dist[i] = unreachable;
+        if (board_cell_at(board, i)->has_portal) {
+            dist[i] = 0;
+            queue[tail++] = i;
+        }
+    }
+
+    while (head < tail) {
+        long idx = queue[head++];
+        int x = (int) (idx % board->width);
+        int y = (int) (idx / board->width);
+        int next[4][2] = {{x, y - 1}, {x, y + 1}, {x - 1, y}, {x + 1, y}};
+        for (int n = 0; n < 4; n++) {
+            int nx = next[n][0], ny = next[n][1];
+            if (nx < 0 || nx >= board->width || ny < 0 || ny >= board->height) continue;
+            long nidx = (long) ny * board->width + nx;
+            if (board_cell(board, nx, ny)->content == 'W' || dist[nidx] <= dist[idx] + 1) continue;
+            dist[nidx] = dist[idx] + 1;
+            queue[tail++] = nidx;
+        }
+    }
+
+    free(queue);
+    return dist;
+}
+
+// Helper private function run by every worker, plays each move on a copy of each beam state
+static void* expand_range(void* arg) {
+    expand_job_t* job = (expand_job_t*) arg;
+    mute_debug(1); // simulated deaths are not interesting in the debug file
+
+    for (int i = job->from; i < job->to; i++) {
+        for (int m = 0; m < N_SOLVER_MOVES; m++) {
+            state_t* child = &job->children[i * N_SOLVER_MOVES + m];
+            child->from = i;
+            child->valid = (clone_board(&child->board, &job->beam[i].board) == 0);
+            if (!child->valid) continue;
+
+            command_t command = {.command = solver_moves[m], .turns = 1};
+            child->result = play_turn(&child->board, &command);
+            job->explored++;
+        }
+    }
+    return NULL;
+}
+
+// Helper private function to expand the whole beam, splitting it between threads when it is worth it
+static long expand_beam(const state_t* beam, int n_beam, state_t* children, int n_threads) {
+    if (n_threads > n_beam / MIN_STATES_PER_THREAD) {
+        n_threads = n_beam / MIN_STATES_PER_THREAD;
+    }
+    if (n_threads < 1) n_threads = 1;
+
+    expand_job_t jobs[n_threads];
+    pthread_t threads[n_threads];
+    int started[n_threads];
+
+    for (int t = 0; t < n_threads; t++) {
+        jobs[t].beam = beam;
+        jobs[t].children = children;
+        jobs[t].from = (int) ((long) n_beam * t / n_threads);
+        jobs[t].to = (int) ((long) n_beam * (t + 1) / n_threads);
+        jobs[t].explored = 0;
+        started[t] = (t > 0 && pthread_create(&threads[t], NULL, expand_range, &jobs[t]) == 0);
+    }
+
+    // The calling thread takes the first slice, and any slice whose thread could not start
+    expand_range(&jobs[0]);
+    mute_debug(0);
+    long explored = jobs[0].explored;
+    for (int t = 1; t < n_threads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+        else {
+            expand_range(&jobs[t]);
+            mute_debug(0);
+        }
+        explored += jobs[t].explored;
+    }
+    return explored;
+}
+
+// Helper private function to insert a hash in the seen table, returns 1 if it was already there
+static int seen_before(unsigned long* seen, int mask, unsigned long hash) {
+    for (int slot = (int) (hash & mask);; slot = (slot + 1) & mask) {
+        if (seen[slot] == hash) return 1;
+        if (seen[slot] == 0) {
+            seen[slot] = hash;
+            return 0;
+        }
+    }
+}
+
+static int compare_candidates(const void* a, const void* b) {
+    const candidate_t* ca = (const candidate_t*) a;
+    const candidate_t* cb = (const candidate_t*) b;
+    if (ca->score != cb->score) return cb->score - ca->score; // best first
+    return ca->index - cb->index;                            // keep the order deterministic
+}
+
+// Helper private function to append a step to the plan history
+static int push_step(step_t** history, int* n_steps, int* capacity, int parent, char move) {
+    if (*n_steps == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 1024;
+        step_t* grown = realloc(*history, new_capacity * sizeof(step_t));
+        if (!grown) return -1;
+        *history = grown;
+        *capacity = new_capacity;
+    }
+    (*history)[*n_steps].parent = parent;
+    (*history)[*n_steps].move = move;
+    return (*n_steps)++;
+}
+
+// Helper private function to turn the last step of a plan into the string of commands
+static char* build_plan(const step_t* history, int last, int ticks) {
+    char* moves = malloc(ticks + 1);
+    if (!moves) return NULL;
+    moves[ticks] = '\0';
+    for (int i = ticks - 1, step = last; i >= 0 && step >= 0; i--, step = history[step].parent) {
+        moves[i] = history[step].move;
+    }
+    return moves;
+}
+
+void solver_default_opts(solver_opts_t* opts) {
+    opts->beam_width = SOLVER_BEAM_WIDTH;
+    opts->max_ticks = SOLVER_MAX_TICKS;
+    opts->n_threads = 0;
+}
+
+int solve_board(const board_t* board, const solver_opts_t* opts, solver_result_t* result) {
+    memset(result, 0, sizeof(*result));
+
+    int width = opts->beam_width > 0 ? opts->beam_width : SOLVER_BEAM_WIDTH;
+    int n_threads = opts->n_threads;
+    if (n_threads <= 0) n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads <= 0) n_threads = 1;
+
+    int seen_size = 1;
+    while (seen_size < width * N_SOLVER_MOVES * 2) seen_size <<= 1;
+
+    int* dist = portal_distances(board);
+    state_t* beam = calloc(width, sizeof(state_t));
+    state_t* children = calloc(width * N_SOLVER_MOVES, sizeof(state_t));
+    candidate_t* candidates = malloc(width * N_SOLVER_MOVES * sizeof(candidate_t));
+    unsigned long* seen = malloc(seen_size * sizeof(unsigned long));
+    step_t* history = NULL;
+    int n_steps = 0, capacity = 0;
+    int status = -1;
+
+    if (!dist || !beam || !children || !candidates || !seen || clone_board(&beam[0].board, board) != 0) {
+        goto cleanup;
+    }
+    beam[0].valid = 1;
+    beam[0].step = -1;
+    int n_beam = 1;
+
+    // No amount of searching helps when walls cut pacman off from every portal
+    const pacman_t* start = &board->pacmans[0];
+    long size = (long) board->width * board->height;
+    if (dist[(long) start->pos_y * board->width + start->pos_x] == (size < INT_MAX ? size : INT_MAX)) {
+        status = 0;
+        goto cleanup;
+    }
+
+    for (int tick = 1; tick <= opts->max_ticks && n_beam > 0; tick++) {
+        result->explored += expand_beam(beam, n_beam, children, n_threads);
+        int n_children = n_beam * N_SOLVER_MOVES;
+        int n_candidates = 0;
+        int portal = -1;
+        memset(seen, 0, seen_size * sizeof(unsigned long));
+
+        for (int c = 0; c < n_children; c++) {
+            state_t* child = &children[c];
+            if (!child->valid) continue;
+
+            pacman_t* pac = &child->board.pacmans[0];
+            if (child->result == REACHED_PORTAL) {
+                if (portal < 0 || total_points(&child->board) > total_points(&children[portal].board)) portal = c;
+                continue;
+            }
+            child->hash = hash_state(&child->board);
+            if (child->result == DEAD_PACMAN || !pac->alive || seen_before(seen, seen_size - 1, child->hash)) {
+                unload_level(&child->board);
+                child->valid = 0;
+                continue;
+            }
+
+            long idx = (long) pac->pos_y * child->board.width + pac->pos_x;
+            candidates[n_candidates].score = total_points(&child->board) * SOLVER_DOT_WEIGHT - dist[idx];
+            candidates[n_candidates].index = c;
+            n_candidates++;
+        }
+
+        if (portal >= 0) {
+            state_t* child = &children[portal];
+            int last = push_step(&history, &n_steps, &capacity, beam[child->from].step,
+                                 solver_moves[portal % N_SOLVER_MOVES]);
+            result->moves = last >= 0 ? build_plan(history, last, tick) : NULL;
+            if (!result->moves) goto cleanup;
+            result->solved = 1;
+            result->ticks = tick;
+            result->points = total_points(&child->board);
+            status = 0;
+            goto cleanup;
+        }
+
+        qsort(candidates, n_candidates, sizeof(candidate_t), compare_candidates);
+
+        // Keep the best states as the next beam, stepping the plan history for each one
+        int n_next = n_candidates < width ? n_candidates : width;
+        for (int k = n_candidates - 1; k >= n_next; k--) {
+            state_t* child = &children[candidates[k].index];
+            unload_level(&child->board);
+            child->valid = 0;
+        }
+        if (n_next == 0) {
+            // Every child died or was seen before: nothing is left to search
+            for (int b = 0; b < n_beam; b++) {
+                unload_level(&beam[b].board);
+                beam[b].valid = 0;
+            }
+            n_beam = 0;
+            result->ticks = tick;
+            break;
+        }
+        int parents[n_next];
+        for (int k = 0; k < n_next; k++) {
+            parents[k] = beam[children[candidates[k].index].from].step;
+        }
+        for (int b = 0; b < n_beam; b++) {
+            unload_level(&beam[b].board);
+            beam[b].valid = 0;
+        }
+        for (int k = 0; k < n_next; k++) {
+            int c = candidates[k].index;
+            int step = push_step(&history, &n_steps, &capacity, parents[k], solver_moves[c % N_SOLVER_MOVES]);
+            if (step < 0) goto cleanup; // the children not moved yet are released by the cleanup
+            beam[k] = children[c];
+            beam[k].step = step;
+            children[c].valid = 0;
+        }
+        n_beam = n_next;
+
+        result->ticks = tick;
+        if (n_beam > 0) {
+            result->points = total_points(&beam[0].board);
+        }
+    }
+    status = 0; // search ran until the tick limit or until every state died
+
+cleanup:
+    if (beam) {
+        for (int b = 0; b < width; b++) {
+            if (beam[b].valid) unload_level(&beam[b].board);
+        }
+    }
+    if (children) {
+        for (int c = 0; c < width * N_SOLVER_MOVES; c++) {
+            if (children[c].valid) unload_level(&children[c].board);
+        }
+    }
+    free(dist);
+    free(beam);
+    free(children);
+    free(candidates);
+    free(seen);
+    free(history);
+    return status;
+}
+
+void solver_free_result(solver_result_t* result) {
+    free(result->moves);
+    result->moves = NULL;
+}
@@ -0,0 +1,60 @@
+#include "watch.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// Helper private function for the files worth reloading
+static int is_watched_name(const char* name) {
+    const char* dot = strrchr(name, '.');
+    return dot && (strcmp(dot, ".lvl") == 0 || strcmp(dot, ".p") == 0 || strcmp(dot, ".m") == 0);
+}
+
+int watch_open(const char* directory) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    if (inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify_add_watch");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int watch_wait(int fd, int milliseconds) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int ready;
+    while ((ready = poll(&pfd, 1, milliseconds)) < 0 && errno == EINTR) {
+    }
+    return ready > 0;
+}
+
+int watch_changes(int fd, char names[][MAX_FILENAME], int max) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int n = 0;
+    ssize_t len;
+
+    while ((len = read(fd, events, sizeof(events))) > 0) {
+        for (char* at = events; at < events + len; at += sizeof(struct inotify_event) + ((struct inotify_event*) at)->len) {
+            const struct inotify_event* event = (const struct inotify_event*) at;
+            if (event->len == 0 || !is_watched_name(event->name)) continue;
+
+            // Editors often write a file more than once per save, report it once
+            int seen = 0;
+            for (int i = 0; i < n && !seen; i++) seen = strcmp(names[i], event->name) == 0;
+            if (!seen && n < max) {
+                snprintf(names[n++], MAX_FILENAME, "%s", event->name);
+            }
+        }
+    }
+    return n;
+}
+
+void watch_close(int fd) {
+    if (fd >= 0) close(fd);
+}